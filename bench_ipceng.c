@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "ipceng.h"
+
+#define BENCH_MSGCOUNT		1
+#define BENCH_MSGSIZE		32
+#define BENCH_ROUNDS		20000
+
+long long now_ns()
+{
+	struct timespec tm;
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return (long long)tm.tv_sec * 1000000000LL + tm.tv_nsec;
+}
+
+// push latency against number of qdoors in the engine; the measured qdoor is
+// always the last added one, which is the worst case for a linear lookup
+int qdoor_push_bench()
+{
+	int counts[] = {1, 16, 128, 512, 1024, 2048, 4096};
+	int i, j, k, added = 0;
+	char name[32];
+
+	// each qdoor holds two mqueues, so default RLIMIT_MSGQUEUE is too small
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_MSGQUEUE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_MSGQUEUE, &rl);
+	}
+
+	struct ipceng *eng = ipceng_init("bench");
+	printf("%10s %16s %16s\n", "qdoors", "push (ns/msg)", "push_h (ns/msg)");
+	for (i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+		for (; added < counts[i]; added++) {
+			sprintf(name, "peer%d", added);
+			if (ipceng_qdoor_add(eng, name, BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0) != 0) {
+				printf("stopped at %d qdoors: %s (check ulimit -q and /proc/sys/fs/mqueue/queues_max)\n", \
+					added, ipceng_errmsg(eng));
+				goto out;
+			}
+		}
+		// receiving side of the last added qdoor
+		struct ipceng *peer = ipceng_init(name);
+		if (ipceng_qdoor_add(peer, "bench", BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0) != 0) {
+			printf("peer error: %s\n", ipceng_errmsg(peer));
+			goto out;
+		}
+
+		long long total = 0, total_h = 0;
+		char *buff;
+		for (j = 0; j < BENCH_ROUNDS; j++) {
+			long long start = now_ns();
+			for (k = 0; k < BENCH_MSGCOUNT; k++)
+				ipceng_qdoor_push(eng, name, "bench message", 0);
+			total += now_ns() - start;
+			for (k = 0; k < BENCH_MSGCOUNT; k++) {
+				if (ipceng_qdoor_pop(peer, "bench", &buff, NULL) == 0)
+					free(buff);
+			}
+		}
+		// same measurement without name resolution
+		ipceng_qdoor_t qd = ipceng_qdoor_get(eng, name);
+		for (j = 0; j < BENCH_ROUNDS; j++) {
+			long long start = now_ns();
+			for (k = 0; k < BENCH_MSGCOUNT; k++)
+				ipceng_qdoor_push_h(eng, qd, "bench message", 0);
+			total_h += now_ns() - start;
+			for (k = 0; k < BENCH_MSGCOUNT; k++) {
+				if (ipceng_qdoor_pop(peer, "bench", &buff, NULL) == 0)
+					free(buff);
+			}
+		}
+		printf("%10d %16.1f %16.1f\n", added, (double)total / (BENCH_ROUNDS * BENCH_MSGCOUNT), \
+			(double)total_h / (BENCH_ROUNDS * BENCH_MSGCOUNT));
+
+		ipceng_qdoor_del_all(peer);
+		ipceng_term(peer);
+	}
+
+out:
+	ipceng_qdoor_del_all(eng);
+	ipceng_term(eng);
+	return 0;
+}
+
+// push+pop_into round trip of one small message through mq and ring qdoors
+int transport_bench()
+{
+	struct ipceng *eng1 = ipceng_init("tbench1");
+	struct ipceng *eng2 = ipceng_init("tbench2");
+	char *kinds[] = {"mq", "ring"};
+	char buff[IPCENG_DEFAULT_RINGSIZE];
+	size_t len;
+	int i, j;
+
+	printf("%10s %16s\n", "transport", "push+pop (ns/msg)");
+	for (i = 0; i < 2; i++) {
+		int ret1, ret2;
+		if (i == 0) {
+			ret1 = ipceng_qdoor_add(eng1, "tbench2", BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0);
+			ret2 = ipceng_qdoor_add(eng2, "tbench1", BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0);
+		} else {
+			ret1 = ipceng_qdoor_add_ring(eng1, "tbench2", -1, 0, 0);
+			ret2 = ipceng_qdoor_add_ring(eng2, "tbench1", -1, 0, 0);
+		}
+		if (ret1 != 0 || ret2 != 0) {
+			printf("%s add error: %s / %s\n", kinds[i], ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+			break;
+		}
+		ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "tbench2");
+		ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "tbench1");
+
+		long long start = now_ns();
+		for (j = 0; j < BENCH_ROUNDS; j++) {
+			ipceng_qdoor_push_bin(eng1, qd1, "bench message", 14, 0);
+			ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL);
+		}
+		printf("%10s %16.1f\n", kinds[i], (double)(now_ns() - start) / BENCH_ROUNDS);
+
+		ipceng_qdoor_del_all(eng1);
+		ipceng_qdoor_del_all(eng2);
+	}
+
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+// moving a 2 MB message: chunked through a qdoor by hand vs spilled into shm
+int spill_bench()
+{
+	struct ipceng *eng1 = ipceng_init("sbench1");
+	struct ipceng *eng2 = ipceng_init("sbench2");
+	size_t big_len = 2 * 1024 * 1024, chunk = 8192, off, len;
+	int j, rounds = 200;
+
+	if (ipceng_qdoor_add(eng1, "sbench2", 10, chunk, 3, 3) != 0 || \
+		ipceng_qdoor_add(eng2, "sbench1", 10, chunk, 3, 3) != 0) {
+		printf("spill bench add error: %s\n", ipceng_errmsg(eng1));
+		goto out;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "sbench2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "sbench1");
+	char *big = (char *)calloc(big_len, 1), *dst = (char *)malloc(big_len);
+	const void *view;
+
+	long long start = now_ns();
+	for (j = 0; j < rounds; j++) {
+		for (off = 0; off < big_len; off += chunk) {
+			ipceng_qdoor_push_bin(eng1, qd1, big + off, chunk, 0);
+			ipceng_qdoor_pop_into(eng2, qd2, dst + off, chunk, &len, NULL);
+		}
+	}
+	printf("%10s %16.1f\n", "chunked", (double)(now_ns() - start) / rounds / 1000);
+
+	ipceng_qdoor_set_spill(eng1, qd1, chunk, big_len, 4);
+	start = now_ns();
+	for (j = 0; j < rounds; j++) {
+		ipceng_qdoor_push_bin(eng1, qd1, big, big_len, 0);
+		ipceng_qdoor_pop_view(eng2, qd2, &view, &len, NULL);
+		ipceng_qdoor_release(eng2, qd2);
+	}
+	printf("%10s %16.1f\n", "spilled", (double)(now_ns() - start) / rounds / 1000);
+	free(big);
+	free(dst);
+
+out:
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+// publishing one message to n subscribers: one qdoor push per subscriber vs
+// one broadcast channel push
+int bcast_bench()
+{
+	int counts[] = {1, 8, 40};
+	int i, j, k, msg = 0, rounds = 2000;
+	char name[32];
+
+	printf("%10s %16s %16s\n", "readers", "qdoors (ns/msg)", "bcast (ns/msg)");
+	for (i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+		struct ipceng *pub = ipceng_init("bpub");
+		struct ipceng *subs[40];
+		ipceng_qdoor_t qds[40], sub_qds[40];
+		for (k = 0; k < counts[i]; k++) {
+			sprintf(name, "bsub%d", k);
+			subs[k] = ipceng_init(name);
+			ipceng_qdoor_add(pub, name, 10, 64, 0, 0);
+			ipceng_qdoor_add(subs[k], "bpub", 10, 64, 0, 0);
+			ipceng_chan_add(subs[k], "bbench", IPCENG_CHAN_BCAST, 1024, 64, 0, 0);
+			qds[k] = ipceng_qdoor_get(pub, name);
+			sub_qds[k] = ipceng_qdoor_get(subs[k], "bpub");
+		}
+		ipceng_chan_add(pub, "bbench", IPCENG_CHAN_BCAST, 1024, 64, 0, 0);
+		ipceng_chan_t ch = ipceng_chan_get(pub, "bbench");
+
+		long long total = 0, total_b = 0;
+		char buff[64];
+		size_t len;
+		for (j = 0; j < rounds; j++) {
+			long long start = now_ns();
+			for (k = 0; k < counts[i]; k++)
+				ipceng_qdoor_push_bin(pub, qds[k], &msg, sizeof(msg), 0);
+			total += now_ns() - start;
+			for (k = 0; k < counts[i]; k++)
+				ipceng_qdoor_pop_into(subs[k], sub_qds[k], buff, sizeof(buff), &len, NULL);
+			start = now_ns();
+			ipceng_chan_push(pub, ch, &msg, sizeof(msg), 0);
+			total_b += now_ns() - start;
+		}
+		printf("%10d %16.1f %16.1f\n", counts[i], (double)total / rounds, (double)total_b / rounds);
+
+		for (k = 0; k < counts[i]; k++) {
+			ipceng_qdoor_del_all(subs[k]);
+			ipceng_term(subs[k]);
+		}
+		ipceng_qdoor_del_all(pub);
+		ipceng_chan_del_all(pub);
+		ipceng_term(pub);
+	}
+	return 0;
+}
+
+// push+pop of 32-byte messages through a 1 KB mq qdoor, one mq message each
+// vs coalesced into batches
+int coalesce_bench()
+{
+	struct ipceng *eng1 = ipceng_init("cbench1");
+	struct ipceng *eng2 = ipceng_init("cbench2");
+	char msg[BENCH_MSGSIZE], buff[1024];
+	size_t len;
+	int i, j, k;
+
+	if (ipceng_qdoor_add(eng1, "cbench2", 8, sizeof(buff), 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "cbench1", 8, sizeof(buff), 0, 0) != 0) {
+		printf("add error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		goto out;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "cbench2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "cbench1");
+	memset(msg, 'c', sizeof(msg));
+
+	printf("%10s %16s\n", "32B msgs", "push+pop (ns/msg)");
+	for (i = 0; i < 2; i++) {
+		// a burst fills the mq: 8 messages, or 8 batches of 28 messages
+		int burst = i ? 8 * ((sizeof(buff) - 16) / (sizeof(msg) + 4)) : 8;
+		if (i == 1)
+			ipceng_qdoor_set_coalesce(eng1, qd1, sizeof(buff), 0, 0);
+		long long start = now_ns();
+		for (j = 0; j < BENCH_ROUNDS / 8; j++) {
+			for (k = 0; k < burst; k++)
+				ipceng_qdoor_push_bin(eng1, qd1, msg, sizeof(msg), 0);
+			ipceng_qdoor_flush(eng1, qd1);
+			for (k = 0; k < burst; k++)
+				ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL);
+		}
+		printf("%10s %16.1f\n", i ? "coalesced" : "plain", \
+			(double)(now_ns() - start) / ((BENCH_ROUNDS / 8) * burst));
+	}
+
+out:
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+// push+pop of a 4 KB telemetry-like text message, plain vs compressed
+int compress_bench()
+{
+	struct ipceng *eng1 = ipceng_init("zbench1");
+	struct ipceng *eng2 = ipceng_init("zbench2");
+	char text[4096], buff[8192];
+	size_t len;
+	int i, j, n = 0;
+
+	for (i = 0; n < 4000; i++)
+		n += sprintf(text + n, "{\"sensor\":%d,\"temp\":%d,\"ok\":true},", i % 16, 20 + i % 7);
+	if (ipceng_qdoor_add(eng1, "zbench2", 8, sizeof(buff), 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "zbench1", 8, sizeof(buff), 0, 0) != 0) {
+		printf("add error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		goto out;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "zbench2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "zbench1");
+
+	printf("%10s %16s\n", "4KB text", "push+pop (ns/msg)");
+	for (i = 0; i < 2; i++) {
+		if (i == 1)
+			ipceng_qdoor_set_compress(eng1, qd1, 256);
+		long long start = now_ns();
+		for (j = 0; j < BENCH_ROUNDS; j++) {
+			ipceng_qdoor_push_bin(eng1, qd1, text, n, 0);
+			ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL);
+		}
+		printf("%10s %16.1f\n", i ? "lz" : "plain", (double)(now_ns() - start) / BENCH_ROUNDS);
+	}
+
+out:
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+// push+pop_h of one small message into a heap buffer, from malloc vs from the
+// buffer pool of the qdoor; ring qdoors, so the allocation is not hidden by
+// mq syscalls
+int pool_bench()
+{
+	struct ipceng *eng1 = ipceng_init("pbench1");
+	struct ipceng *eng2 = ipceng_init("pbench2");
+	char *msg;
+	int i, j;
+
+	if (ipceng_qdoor_add_ring(eng1, "pbench2", -1, 0, 0) != 0 || \
+		ipceng_qdoor_add_ring(eng2, "pbench1", -1, 0, 0) != 0) {
+		printf("add error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		goto out;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "pbench2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "pbench1");
+
+	printf("%10s %16s\n", "pop buffer", "push+pop (ns/msg)");
+	for (i = 0; i < 2; i++) {
+		if (i == 1)
+			ipceng_qdoor_set_pool(eng2, qd2, 8);
+		long long start = now_ns();
+		for (j = 0; j < BENCH_ROUNDS; j++) {
+			ipceng_qdoor_push_h(eng1, qd1, "bench message", 0);
+			if (ipceng_qdoor_pop_h(eng2, qd2, &msg, NULL) == 0)
+				ipceng_buf_release(eng2, qd2, msg);
+		}
+		printf("%10s %16.1f\n", i ? "pool" : "malloc", (double)(now_ns() - start) / BENCH_ROUNDS);
+	}
+	ipceng_qdoor_set_pool(eng2, qd2, 0);
+
+out:
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+#define BENCH_MAXTHREADS	8
+
+struct threads_bench_arg {
+	struct ipceng *eng;
+	struct ipceng *peer;
+	char name[16];
+};
+
+void *threads_bench_worker(void *arg)
+{
+	struct threads_bench_arg *t = (struct threads_bench_arg *)arg;
+	char msg[BENCH_MSGSIZE] = "bench", buff[BENCH_MSGSIZE];
+	size_t len;
+	int i;
+	ipceng_qdoor_t pqd = ipceng_qdoor_get(t->peer, "tbench");
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		// looked up on every message, like a caller holding only names
+		ipceng_qdoor_t qd = ipceng_qdoor_get(t->eng, t->name);
+		ipceng_qdoor_push_bin(t->eng, qd, msg, sizeof(msg), 0);
+		ipceng_qdoor_pop_into(t->peer, pqd, buff, sizeof(buff), &len, NULL);
+	}
+	return NULL;
+}
+
+// aggregate push+pop throughput of threads sharing one engine, each thread
+// with its own qdoor (and peer engine)
+int threads_bench()
+{
+	struct ipceng *eng = ipceng_init("tbench");
+	struct threads_bench_arg t[BENCH_MAXTHREADS];
+	pthread_t th[BENCH_MAXTHREADS];
+	int i, n;
+
+	for (i = 0; i < BENCH_MAXTHREADS; i++) {
+		sprintf(t[i].name, "tpeer%d", i);
+		t[i].eng = eng;
+		t[i].peer = ipceng_init(t[i].name);
+	}
+	for (i = 0; i < BENCH_MAXTHREADS; i++) {
+		if (ipceng_qdoor_add(eng, t[i].name, BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0) != 0 || \
+			ipceng_qdoor_add(t[i].peer, "tbench", BENCH_MSGCOUNT, BENCH_MSGSIZE, 0, 0) != 0) {
+			printf("add error: %s\n", ipceng_errmsg(eng));
+			goto out;
+		}
+	}
+
+	printf("%10s %16s\n", "threads", "push+pop (msg/s)");
+	for (n = 1; n <= BENCH_MAXTHREADS; n *= 2) {
+		long long start = now_ns();
+		for (i = 0; i < n; i++)
+			pthread_create(&th[i], NULL, threads_bench_worker, &t[i]);
+		for (i = 0; i < n; i++)
+			pthread_join(th[i], NULL);
+		printf("%10d %16.0f\n", n, (double)n * BENCH_ROUNDS * 1e9 / (now_ns() - start));
+	}
+
+out:
+	ipceng_qdoor_del_all(eng);
+	ipceng_term(eng);
+	for (i = 0; i < BENCH_MAXTHREADS; i++) {
+		ipceng_qdoor_del_all(t[i].peer);
+		ipceng_term(t[i].peer);
+	}
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	qdoor_push_bench();
+	transport_bench();
+	printf("%10s %16s\n", "2MB msg", "push+pop (us)");
+	spill_bench();
+	bcast_bench();
+	coalesce_bench();
+	compress_bench();
+	pool_bench();
+	threads_bench();
+	return 0;
+}
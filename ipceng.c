@@ -3,14 +3,63 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 #include <time.h>
+#include <sched.h>
 
 // macros
 #ifndef free_safe
 #define free_safe(ptr) do{ free(ptr); (ptr)=NULL; } while(0)
 #endif
 
+// allocator helpers (see ipceng_set_allocator)
+#define _ipceng_free_safe(mem, ptr) do{ _ipceng_dealloc(mem, ptr); (ptr)=NULL; } while(0)
+
+#define _IPCENG_CACHELINE		64
+#define _IPCENG_ALIGN8(x)		(((x) + 7) & ~(size_t)7)
+#define _IPCENG_ALIGN64(x)		(((x) + 63) & ~(size_t)63)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _ipceng_cpu_relax()		__builtin_ia32_pause()
+#else
+#define _ipceng_cpu_relax()		__asm__ __volatile__("" ::: "memory")
+#endif
+
 // internal helper functions
+static inline void *_ipceng_alloc(struct ipceng_allocator *mem, size_t size)
+{
+	return mem->alloc ? mem->alloc(size, mem->ctx) : malloc(size);
+}
+
+static inline void *_ipceng_zalloc(struct ipceng_allocator *mem, size_t size)
+{
+	void *ptr = _ipceng_alloc(mem, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+static inline char *_ipceng_strdup(struct ipceng_allocator *mem, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *dup = (char *)_ipceng_alloc(mem, len);
+	if (dup != NULL)
+		memcpy(dup, str, len);
+	return dup;
+}
+
+static inline void _ipceng_dealloc(struct ipceng_allocator *mem, void *ptr)
+{
+	if (mem->free)
+		mem->free(ptr, mem->ctx);
+	else
+		free(ptr);
+}
 static int _read_procfile_oneline(char *file_name, char **buff)
 {
 	if (!file_name || !buff)
@@ -40,6 +89,30 @@ enum ipcstate
 	IPC_STATE_CLOSED
 };
 
+enum qdoortype
+{
+	// pair of posix message queues
+	QDOOR_TYPE_MQ,
+	// pair of single-producer/single-consumer shared memory rings
+	QDOOR_TYPE_RING
+};
+
+// stages of mapping a shm; used to tell where mapping failed
+enum shmstage
+{
+	SHM_STAGE_OPEN,
+	SHM_STAGE_TRUNCATE,
+	SHM_STAGE_MMAP,
+	SHM_STAGE_DONE
+};
+
+// hash index node; embedded in every hashed object
+struct hnode
+{
+	unsigned int hash;
+	struct hlist_node node;
+};
+
 struct mqwrap
 {
 	char *name;
@@ -50,14 +123,286 @@ struct mqwrap
 	enum ipcstate state;
 };
 
+// a received message; data is either in the receive buffer, in a heap copy
+// (owned) or in a slot of the spill pool of the peer (slot >= 0), which should
+// be released after use; call_id is set for call requests and replies, flags
+// has FRAME_FLAG_TYPED for typed messages, stamp is the send time of stamped
+// messages until it is recorded (0 otherwise)
+struct msgview
+{
+	const void *data;
+	size_t len;
+	int prio;
+	int slot;
+	void *owned;
+	uint8_t kind;
+	uint8_t flags;
+	uint32_t call_id;
+	uint64_t stamp;
+};
+
+// message received but not consumed yet (see _ipceng_qdoor_stash)
+struct stashmsg
+{
+	struct list_head _list;
+	struct msgview view;
+};
+
+// call waiting for its reply (see ipceng_call/ipceng_call_async); id 0 marks a
+// free entry of the pending table
+struct pendcall
+{
+	uint32_t id;
+	bool done;
+	ipceng_reply_cb cb;
+	void *ctx;
+	void *resp;
+	size_t resp_len;
+};
+
+// runtime metrics of one direction of a qdoor/shm (see ipceng_stats_get)
+struct iodir
+{
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t again;
+	uint64_t timeout;
+	uint64_t errors;
+};
+
+struct iostats
+{
+	struct iodir tx;
+	struct iodir rx;
+	// highest depths sampled so far, by stats calls only: mq depths need
+	// mq_getattr, and the pushing side of a ring does not read the tail of
+	// the peer on every push
+	long depth_sampled_max;
+	long peer_depth_sampled_max;
+};
+
+// metrics helpers; a qdoor direction has one thread at a time, so its
+// counters are just stored (readers still see whole values), shm ones may be
+// updated by any number of threads
+static inline void _ipceng_stat_add(uint64_t *ctr, uint64_t n, bool shared)
+{
+	if (shared)
+		__atomic_fetch_add(ctr, n, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(ctr, __atomic_load_n(ctr, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// counting an operation of len bytes which returned ret (errno on failure)
+static inline void _ipceng_stat_io(struct iodir *dir, int ret, size_t len, bool shared)
+{
+	if (ret == 0) {
+		_ipceng_stat_add(&dir->msgs, 1, shared);
+		_ipceng_stat_add(&dir->bytes, len, shared);
+	} else if (errno == EAGAIN) {
+		_ipceng_stat_add(&dir->again, 1, shared);
+	} else if (errno == ETIMEDOUT) {
+		_ipceng_stat_add(&dir->timeout, 1, shared);
+	} else {
+		_ipceng_stat_add(&dir->errors, 1, shared);
+	}
+}
+
+// one-way latency histogram of a qdoor (see ipceng_qdoor_set_latency), log-
+// linear like HdrHistogram: values below 2^_IPCENG_LAT_SUBBITS ns get a bucket
+// each, every power of two above is split into 2^_IPCENG_LAT_SUBBITS buckets
+// (~3% wide); values from 2^_IPCENG_LAT_MAXBITS ns (~18 minutes) on go into
+// the last bucket, max is exact
+#define _IPCENG_LAT_SUBBITS		5
+#define _IPCENG_LAT_MAXBITS		40
+#define _IPCENG_LAT_BUCKETS		((_IPCENG_LAT_MAXBITS - _IPCENG_LAT_SUBBITS + 1) << _IPCENG_LAT_SUBBITS)
+struct lathist
+{
+	uint64_t max;
+	uint64_t buckets[_IPCENG_LAT_BUCKETS];
+};
+
+static inline uint64_t _ipceng_now_ns()
+{
+	struct timespec tm;
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return (uint64_t)tm.tv_sec * 1000000000ULL + tm.tv_nsec;
+}
+
+// bucket of a latency of v ns
+static inline unsigned int _ipceng_lat_bucket(uint64_t v)
+{
+	if (v >= (1ULL << _IPCENG_LAT_MAXBITS))
+		v = (1ULL << _IPCENG_LAT_MAXBITS) - 1;
+	if (v < (1u << _IPCENG_LAT_SUBBITS))
+		return v;
+	unsigned int msb = 63 - __builtin_clzll(v);
+	return ((msb - _IPCENG_LAT_SUBBITS + 1) << _IPCENG_LAT_SUBBITS) + \
+		(unsigned int)(v >> (msb - _IPCENG_LAT_SUBBITS)) - (1u << _IPCENG_LAT_SUBBITS);
+}
+
+// highest latency which falls into bucket idx
+static inline uint64_t _ipceng_lat_value(unsigned int idx)
+{
+	if (idx < (1u << _IPCENG_LAT_SUBBITS))
+		return idx;
+	unsigned int shift = (idx >> _IPCENG_LAT_SUBBITS) - 1;
+	uint64_t sub = (idx & ((1u << _IPCENG_LAT_SUBBITS) - 1)) + (1u << _IPCENG_LAT_SUBBITS);
+	return ((sub + 1) << shift) - 1;
+}
+
+// recording a message sent at stamp (0 if it is not stamped); like qdoor
+// counters, a histogram is written by one thread at a time
+static inline void _ipceng_lat_record(struct lathist *lat, uint64_t stamp)
+{
+	if (stamp == 0)
+		return;
+	uint64_t now = _ipceng_now_ns();
+	uint64_t delta = (now > stamp) ? now - stamp : 0;
+	_ipceng_stat_add(&lat->buckets[_ipceng_lat_bucket(delta)], 1, false);
+	if (delta > __atomic_load_n(&lat->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&lat->max, delta, __ATOMIC_RELAXED);
+}
+
+// receive buffer pool of a qdoor (see ipceng_qdoor_set_pool): nblocks blocks
+// of blk bytes in one slab; free blocks are a stack linked through their
+// first bytes, its head is the top block index (_IPCENG_BUFPOOL_NONE if
+// empty) with a change counter in the upper half, so that a block popped and
+// pushed back meanwhile does not go unnoticed
+#define _IPCENG_BUFPOOL_NONE		0xffffffffu
+struct bufpool
+{
+	char *slab;
+	size_t blk;
+	unsigned int nblocks;
+	uint64_t head;
+	// blocks handed out
+	unsigned int used;
+};
+
 struct qdoor
 {
 	char *name;
-	// embedded message queues descriptors and names
+	enum qdoortype type;
+	// allocator of the engine and receive buffer pool (NULL if not set)
+	struct ipceng_allocator *mem;
+	struct bufpool *pool;
+	// runtime metrics
+	struct iostats stats;
+	// one-way latency (see ipceng_qdoor_set_latency): while stamp is set, sent
+	// messages are stamped and stamped ones received are recorded into lat,
+	// which is kept once allocated
+	bool stamp;
+	struct lathist *lat;
+	// embedded message queues descriptors and names; for QDOOR_TYPE_RING only
+	// name, timeout, attr.mq_msgsize and state are used
 	struct mqwrap sendq;
 	struct mqwrap recvq;
+	// shared memory rings of QDOOR_TYPE_RING (NULL otherwise) and the last
+	// seen peer positions, so the peer cache line is read only when needed
+	struct shm *sendr;
+	struct shm *recvr;
+	uint64_t sendr_tail;
+	uint64_t recvr_head;
+	// large message spill (see ipceng_qdoor_set_spill): own pool for messages
+	// above spill_threshold, pool of peer (attached on the first spilled
+	// message received) and next own slot to try
+	struct shm *sendp;
+	struct shm *recvp;
+	size_t spill_threshold;
+	unsigned int spill_hint;
+	// received messages put aside, either by a pop with a too small buffer or
+	// while waiting for a call reply; they are returned before new ones
+	struct list_head stash;
+	// message lent out by ipceng_qdoor_pop_view with its receive buffer, and
+	// receive buffer of calls and taken messages
+	struct msgview lent;
+	char *lent_buff;
+	char *rx_buff;
+	// pending calls, indexed by call id & (calls_size - 1)
+	struct pendcall *calls;
+	unsigned int calls_size;
+	unsigned int calls_count;
+	uint32_t next_call_id;
+	// sequence number of the last typed message sent
+	uint32_t typed_seq;
+	// scheduler weight (0 = not scheduled) and deficit in bytes (see
+	// ipceng_sched_pop)
+	unsigned int weight;
+	size_t deficit;
+	// credit flow control (see ipceng_qdoor_set_credit): window (0 if
+	// disabled), shared counters of the sending direction (NULL until a
+	// window is set) and receiving direction (mapped by add and open, see
+	// struct credithdr) and consumed count of the peer as last seen
+	unsigned int credit_window;
+	struct shm *sendc;
+	struct shm *recvc;
+	uint64_t peer_consumed;
+	ipceng_credit_cb on_credit;
+	void *on_credit_ctx;
+	// sending side coalescing (see ipceng_qdoor_set_coalesce): small messages
+	// are packed into batch (NULL if disabled) until one of the limits is
+	// reached; batch_due is on CLOCK_MONOTONIC; the batch and its settings
+	// are guarded by batch_lock, as pushing threads and ipceng_wait flush it
+	pthread_mutex_t batch_lock;
+	size_t coalesce_bytes;
+	unsigned int coalesce_msgs;
+	unsigned int coalesce_usecs;
+	char *batch;
+	size_t batch_len;
+	unsigned int batch_count;
+	int batch_prio;
+	struct timespec batch_due;
+	// receiving side: received batch being unpacked, with stamped messages if
+	// unbatch_stamp
+	char *unbatch;
+	size_t unbatch_len;
+	size_t unbatch_off;
+	int unbatch_prio;
+	bool unbatch_stamp;
+	// compression (see ipceng_qdoor_set_compress): messages above lz_threshold
+	// (0 if disabled) are compressed into lz_buff, using lz_table as match
+	// finder; received ones are decompressed into unlz (unlz_cap bytes)
+	size_t lz_threshold;
+	uint8_t *lz_buff;
+	uint32_t *lz_table;
+	uint8_t *unlz;
+	size_t unlz_cap;
 	// internal qdoor linked list member
 	struct list_head _list;
+	// internal qdoor hash index member
+	struct hnode _hnode;
+	// index of handle slot of the qdoor
+	unsigned int slot;
+	// message callback (see ipceng_qdoor_on_message)
+	ipceng_msg_cb on_msg;
+	void *on_msg_ctx;
+};
+
+// bytes a send stamp of qd takes in front of a message
+static inline size_t _ipceng_stamp_len(struct qdoor *qd)
+{
+	return qd->stamp ? sizeof(uint64_t) : 0;
+}
+
+struct chan
+{
+	char *name;
+	int type;
+	// shared memory holding the queue (see struct chanhdr)
+	struct shm *sh;
+	int timeout_send;
+	int timeout_recv;
+	size_t msgsize;
+	// IPCENG_CHAN_BCAST reader: position of next message and number of
+	// messages lost to overruns
+	uint64_t cursor;
+	uint64_t lost;
+	// internal handle slot index
+	unsigned int slot;
+	// internal hash index member (keyed on name)
+	struct hnode _hnode;
+	// internal list member
+	struct list_head _list;
 };
 
 struct shm
@@ -71,570 +416,5410 @@ struct shm
 	enum ipcstate state;
 	// internal pointer to hold output of mmap
 	void *ptr;
+	// runtime metrics of ipceng_shm_read/ipceng_shm_write (rx/tx)
+	struct iostats stats;
 	// internal shm linked list member
 	struct list_head _list;
+	// internal shm hash index member (keyed on nickname)
+	struct hnode _hnode;
+	// index of handle slot of the shm
+	unsigned int slot;
 };
 
-// main function implementation
-struct ipceng *ipceng_init(char *name)
+// handle slot; a handle is ((slot index + 1) << 32 | slot generation), and the
+// generation is bumped whenever the slot object is deleted, so stale handles
+// never resolve to a reused slot
+struct ipceng_slot
 {
-	if (!name)
-		return NULL;
+	void *obj;
+	unsigned int gen;
+	// next free slot (index + 1) when obj is NULL
+	unsigned int next_free;
+};
 
-	struct ipceng *new_eng = (struct ipceng *)malloc(sizeof(struct ipceng));
-	new_eng->name = strdup(name);
-	new_eng->has_log = true;
-	new_eng->err_code = IPCENG_ERR_NOERROR;
-	new_eng->err_msg = strdup("no error");
-	INIT_LIST_HEAD(&new_eng->qdoor_list);
-	new_eng->qdoor_count = 0;
-	INIT_LIST_HEAD(&new_eng->shm_list);
-	new_eng->shm_count = 0;
-	INIT_LIST_HEAD(&new_eng->_list);
+// per thread record of a read section (see _ipceng_read_enter), on a cache
+// line of its own
+struct ipceng_reader
+{
+	// epoch of the object when the read section was entered, 0 outside
+	uint64_t epoch;
+	// user callbacks running in the read section (see _ipceng_read_hold);
+	// it is not left while there are any
+	unsigned int depth;
+	struct ipceng_reader *next;
+	// owner thread (address of its cached record pointer)
+	void *owner;
+} __attribute__((aligned(_IPCENG_CACHELINE)));
 
-	return new_eng;
-}
+// object removed by a writer, freed by free_fn once readers are past epoch
+struct retired
+{
+	struct list_head _list;
+	uint64_t epoch;
+	void *ptr;
+	void (*free_fn)(struct ipceng *eng, void *ptr);
+};
+
+struct ipceng_handler
+{
+	ipceng_handler_fn fn;
+	void *ctx;
+};
 
-void ipceng_set_error(struct ipceng *eng, int _errno, char *_errmsg)
+// shm mapping helpers
+static struct shm *_ipceng_shm_new(struct ipceng_allocator *mem, char *name, char *nickname,
+	size_t size)
 {
-	eng->err_code = _errno;
-	free_safe(eng->err_msg);
-	eng->err_msg = strdup(_errmsg);
+	struct shm *new_shm = (struct shm *)_ipceng_alloc(mem, sizeof(struct shm));
+	if (new_shm == NULL)
+		return NULL;
+	new_shm->name = _ipceng_strdup(mem, name);
+	new_shm->nickname = _ipceng_strdup(mem, nickname);
+	if (new_shm->name == NULL || new_shm->nickname == NULL) {
+		_ipceng_free_safe(mem, new_shm->nickname);
+		_ipceng_free_safe(mem, new_shm->name);
+		_ipceng_free_safe(mem, new_shm);
+		return NULL;
+	}
+	new_shm->oflag = O_CREAT | O_RDWR;
+	new_shm->mode = 0664;
+	new_shm->size = size;
+	new_shm->state = IPC_STATE_CLOSED;
+	memset(&new_shm->stats, 0, sizeof(new_shm->stats));
+	return new_shm;
 }
 
-int ipceng_term(struct ipceng *eng)
+// opening (and creating if needed) sh->name, setting its size with ftruncate
+// (or taking its size if sh->size is 0) and memory mapping it
+static enum shmstage _ipceng_shm_map(struct shm *sh)
 {
-	if (ipceng_qdoor_close_all(eng) != 0) {
-		ipceng_set_error(eng, IPCENG_ERR_TERM, \
-			"terminating ipceng object failed: terminating qdoors failed");
-		return -1;
+	sh->shmd = shm_open(sh->name, sh->oflag, sh->mode);
+	if (sh->shmd == -1)
+		return SHM_STAGE_OPEN;
+	// zero size means attaching an existing shm with its current size
+	struct stat st;
+	if (sh->size == 0 && fstat(sh->shmd, &st) == 0)
+		sh->size = st.st_size;
+	if (sh->size == 0 || ftruncate(sh->shmd, sh->size) != 0) {
+		close(sh->shmd);
+		return SHM_STAGE_TRUNCATE;
 	}
-	free_safe(eng->name);
-	free_safe(eng->err_msg);
-	free_safe(eng);
+	sh->ptr = mmap(NULL, sh->size, PROT_READ | PROT_WRITE, \
+		MAP_SHARED, sh->shmd, 0);
+	if (sh->ptr == MAP_FAILED) {
+		close(sh->shmd);
+		return SHM_STAGE_MMAP;
+	}
+	sh->state = IPC_STATE_OPENED;
+	return SHM_STAGE_DONE;
+}
 
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
+static void _ipceng_shm_unmap(struct shm *sh)
+{
+	if (sh->state != IPC_STATE_CLOSED) {
+		close(sh->shmd);
+		munmap(sh->ptr, sh->size);
+		sh->state = IPC_STATE_CLOSED;
+	}
 }
 
-int ipceng_log_enable(struct ipceng *eng)
+static void _ipceng_shm_free(struct ipceng_allocator *mem, struct shm *sh)
 {
-	eng->has_log = true;
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
+	_ipceng_shm_unmap(sh);
+	_ipceng_free_safe(mem, sh->nickname);
+	_ipceng_free_safe(mem, sh->name);
+	_ipceng_free_safe(mem, sh);
 }
 
-int ipceng_log_disable(struct ipceng *eng)
+// futex helpers; the futex words live in shared memory, so the non-private
+// futex operations are used; deadlines are absolute CLOCK_REALTIME ones, same
+// as mq_timedsend/mq_timedreceive
+static inline int _ipceng_futex_wait(uint32_t *addr, uint32_t val, const struct timespec *deadline)
 {
-	eng->has_log = false;
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
+	return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, val, \
+		deadline, NULL, FUTEX_BITSET_MATCH_ANY);
 }
 
-int ipceng_errno(struct ipceng *eng)
+static inline int _ipceng_futex_wake(uint32_t *addr, int count)
 {
-	return eng->err_code;
+	return syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
 }
 
-char *ipceng_errmsg(struct ipceng *eng)
+static inline bool _ipceng_expired(const struct timespec *deadline)
 {
-	return eng->err_msg;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && \
+		now.tv_nsec >= deadline->tv_nsec);
 }
 
-int ipceng_qdoor_add(struct ipceng *eng,
-	char *qdoor_name,
-	int msg_maxcount,
-	int msg_maxsize,
-	int timeout_send,
-	int timeout_recv)
+// wait point of a shared memory ring/channel; waiters sleep on seq, which is
+// bumped by the notifier only if somebody is waiting, so an uncontended notify
+// costs a fence and a load rather than a syscall
+struct shmwait
 {
-	// qdoor should not be added already
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-				"failed to add qdoor: qdoor has been added already");
-			return -1;
-		}
-	}
-	
-	// check if target_msgmaxcount is greater than linux setting (/proc)
-	int target_msgmaxcount = (msg_maxcount == -1) ? IPCENG_DAFAULT_MSGCOUNT : msg_maxcount;
-	char *buff;
-	if (_read_procfile_oneline("/proc/sys/fs/mqueue/msg_max", &buff) != 0) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: can't read /proc/sys/fs/mqueue/msg_max");
-		return -1;
+	uint32_t seq;
+	uint32_t waiters;
+};
+
+static inline void _ipceng_notify(struct shmwait *w)
+{
+	// pairs with the fence of _ipceng_backoff: either the waiter sees the new
+	// state on its recheck, or we see it waiting here
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->waiters, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&w->seq, 1, __ATOMIC_RELEASE);
+		_ipceng_futex_wake(&w->seq, INT_MAX);
 	}
-	if (target_msgmaxcount > atoi(buff)) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: msg_maxcount is greater than linux setting /proc/sys/fs/mqueue/msg_max");
-		free_safe(buff);
-		return -1;
+}
+
+// state of a blocked ring/channel operation (see _ipceng_backoff)
+struct backoff
+{
+	struct shmwait *w;
+	unsigned int spins;
+	unsigned int limit;
+	bool armed;
+	uint32_t seq;
+};
+
+#define _ipceng_backoff_init(wait, spin_limit) \
+	{ .w = (wait), .spins = 0, .limit = (spin_limit), .armed = false, .seq = 0 }
+
+static inline void _ipceng_backoff_done(struct backoff *bo)
+{
+	if (bo->armed) {
+		__atomic_sub_fetch(&bo->w->waiters, 1, __ATOMIC_RELAXED);
+		bo->armed = false;
 	}
-	free_safe(buff);
+}
 
-	// check if target_msgmaxsize is greater than linux setting (/proc)
-	int target_msgmaxsize = (msg_maxsize == -1) ? IPCENG_DAFAULT_MSGSIZE : msg_maxsize;
-	if (_read_procfile_oneline("/proc/sys/fs/mqueue/msgsize_max", &buff) != 0) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: can't read /proc/sys/fs/mqueue/msgsize_max");
+// one waiting step of a blocked ring/channel operation, called each time the
+// caller finds its condition unmet: spinning for bo->limit steps first, then
+// registering as a waiter (the caller rechecks once more) and then sleeping on
+// the futex until notified or deadline; returns -1 (errno is set) if the
+// operation should give up; _ipceng_backoff_done should be called after the
+// condition is met
+static int _ipceng_backoff(struct backoff *bo, const struct timespec *deadline)
+{
+	if (deadline == NULL) {
+		errno = EAGAIN;
 		return -1;
 	}
-	if (target_msgmaxsize > atoi(buff)) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: msg_maxcount is greater than linux setting /proc/sys/fs/mqueue/msgsize_max");
-		free_safe(buff);
+	if (bo->spins == 0 && !bo->armed && _ipceng_expired(deadline)) {
+		errno = ETIMEDOUT;
 		return -1;
 	}
-	free_safe(buff);
-
-	// creating new_qdoor object
-	struct qdoor *new_qdoor = (struct qdoor *)malloc(sizeof(struct qdoor));
-	new_qdoor->name = strdup(qdoor_name);
-	// filling sendq and recvq
-	int mqnames_len = strlen("/2.mq") + strlen(eng->name) + strlen(qdoor_name) + 1;
-	// filling sendq
-	new_qdoor->sendq.name = (char *)malloc(mqnames_len);
-	sprintf(new_qdoor->sendq.name, "/%s2%s.mq", eng->name, qdoor_name);
-	new_qdoor->sendq.timeout = timeout_send;
-	new_qdoor->sendq.oflags = (timeout_send > 0) ? (O_CREAT | O_WRONLY) : \
-		(O_CREAT | O_WRONLY | O_NONBLOCK);
-	new_qdoor->sendq.attr.mq_flags = 0;
-	new_qdoor->sendq.attr.mq_maxmsg = target_msgmaxcount;
-	new_qdoor->sendq.attr.mq_msgsize = target_msgmaxsize;
-	new_qdoor->sendq.attr.mq_curmsgs = 0;
-	new_qdoor->sendq.mqd = mq_open(new_qdoor->sendq.name, new_qdoor->sendq.oflags, \
-		0664, &new_qdoor->sendq.attr);
-	if (new_qdoor->sendq.mqd == (mqd_t)-1) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: unable to open sending mq");
-		free_safe(new_qdoor->sendq.name);
-		free_safe(new_qdoor->name);
-		free_safe(new_qdoor);
-		return -1;
+	if (bo->spins < bo->limit) {
+		bo->spins++;
+		_ipceng_cpu_relax();
+		return 0;
 	}
-	// filling recvq
-	new_qdoor->recvq.name = (char *)malloc(mqnames_len);
-	sprintf(new_qdoor->recvq.name, "/%s2%s.mq", qdoor_name, eng->name);
-	new_qdoor->recvq.timeout = timeout_recv;
-	new_qdoor->recvq.oflags = (timeout_recv > 0) ? (O_CREAT | O_RDONLY) : \
-		(O_CREAT | O_RDONLY | O_NONBLOCK);
-	new_qdoor->recvq.attr.mq_flags = 0;
-	new_qdoor->recvq.attr.mq_maxmsg = target_msgmaxcount;
-	new_qdoor->recvq.attr.mq_msgsize = target_msgmaxsize;
-	new_qdoor->recvq.attr.mq_curmsgs = 0;
-	new_qdoor->recvq.mqd = mq_open(new_qdoor->recvq.name, new_qdoor->recvq.oflags, \
-		0664, &new_qdoor->recvq.attr);
-	if (new_qdoor->recvq.mqd == (mqd_t)-1) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
-			"failed to add qdoor: unable to open receiving mq");
-		// if can't open recvq, then should remove sendq as well
-		mq_unlink(new_qdoor->sendq.name);
-		free_safe(new_qdoor->sendq.name);
-		free_safe(new_qdoor->recvq.name);
-		free_safe(new_qdoor->name);
-		free_safe(new_qdoor);
+	if (!bo->armed) {
+		__atomic_add_fetch(&bo->w->waiters, 1, __ATOMIC_SEQ_CST);
+		bo->seq = __atomic_load_n(&bo->w->seq, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		bo->armed = true;
+		return 0;
+	}
+	if (_ipceng_futex_wait(&bo->w->seq, bo->seq, deadline) != 0 && errno == ETIMEDOUT) {
+		_ipceng_backoff_done(bo);
 		return -1;
 	}
-	new_qdoor->sendq.state = IPC_STATE_OPENED;
-	new_qdoor->recvq.state = IPC_STATE_OPENED;
-	// adding new_qdoor into eng
-	list_add_tail(&new_qdoor->_list, &eng->qdoor_list);
-	eng->qdoor_count++;
-
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	bo->seq = __atomic_load_n(&bo->w->seq, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 	return 0;
 }
 
-void _ipceng_qdoor_del_by_entry(struct qdoor *qd)
+// shared memory ring of QDOOR_TYPE_RING qdoors; head and tail are free-running
+// byte positions, each on its own cache line, written only by the producer and
+// the consumer respectively (next to the wait point of their peer); records are
+// 8-byte aligned and never split, a record which does not fit before the end is
+// preceded by a wrap record
+#define _IPCENG_RING_MAGIC		0x474e4952			// "RING"
+#define _IPCENG_RING_WRAP		0xffffffffu
+
+struct ringhdr
 {
-	mq_unlink(qd->sendq.name);
-	free_safe(qd->sendq.name);
-	mq_unlink(qd->recvq.name);
-	free_safe(qd->recvq.name);
-	free_safe(qd->name);
-	list_del(&qd->_list);
-	free_safe(qd);
-}
+	uint32_t magic;
+	uint32_t init;
+	uint64_t size;
+	char _pad0[_IPCENG_CACHELINE - 16];
+	uint64_t head;
+	struct shmwait data_wait;
+	char _pad1[_IPCENG_CACHELINE - 16];
+	uint64_t tail;
+	struct shmwait space_wait;
+	char _pad2[_IPCENG_CACHELINE - 16];
+};
 
-int ipceng_qdoor_del(struct ipceng *eng, char *qdoor_name)
+struct ringrec
 {
-	struct qdoor *iter, *iter_n;
-	list_for_each_entry_safe(iter, iter_n, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			_ipceng_qdoor_del_by_entry(iter);
-			eng->qdoor_count--;
-			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-			return 0;
-		}
-	}
-	
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
-}
+	uint32_t len;
+	uint32_t prio;
+};
 
-int ipceng_qdoor_del_all(struct ipceng *eng)
+#define _ipceng_ring_rec(hdr, pos) \
+	((struct ringrec *)((char *)(hdr) + sizeof(struct ringhdr) + ((pos) & ((hdr)->size - 1))))
+
+// initializing a freshly mapped ring, or waiting for the peer initializing it
+static int _ipceng_ring_init(struct shm *sh, uint64_t size)
 {
-	struct qdoor *iter, *iter_n;
-	list_for_each_entry_safe(iter, iter_n, &eng->qdoor_list, _list) {
-		_ipceng_qdoor_del_by_entry(iter);
-		eng->qdoor_count--;
+	struct ringhdr *hdr = (struct ringhdr *)sh->ptr;
+	uint32_t fresh = 0;
+	if (__atomic_compare_exchange_n(&hdr->init, &fresh, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		hdr->size = size;
+		__atomic_store_n(&hdr->magic, _IPCENG_RING_MAGIC, __ATOMIC_RELEASE);
+	} else {
+		while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != _IPCENG_RING_MAGIC)
+			sched_yield();
 	}
-	
-	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
+	return (hdr->size == size) ? 0 : -1;
 }
 
-int ipceng_qdoor_open(struct ipceng *eng, char *qdoor_name)
+static int _ipceng_ring_send(struct qdoor *qd, const void *data, size_t len, int prio,
+	const struct timespec *deadline, unsigned int spin_limit)
 {
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			if (iter->sendq.state != IPC_STATE_OPENED) {
-				iter->sendq.mqd = mq_open(iter->sendq.name, iter->sendq.oflags, \
-					0664, &iter->sendq.attr);
-				if (iter->sendq.mqd == (mqd_t)-1) {
-					ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
-						"failed to open qdoor: unable to open sending mq");
-					return -1;
-				}
-				iter->sendq.state = IPC_STATE_OPENED;
-			}
-			if (iter->recvq.state != IPC_STATE_OPENED) {
-				iter->recvq.mqd = mq_open(iter->recvq.name, iter->recvq.oflags, \
-					0664, &iter->recvq.attr);
-				if (iter->recvq.mqd == (mqd_t)-1) {
-					ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
-						"failed to open qdoor: unable to open receiving mq");
-					// should close sendq if recvq opening is failed as well
-					mq_close(iter->sendq.mqd);
-					iter->sendq.state = IPC_STATE_CLOSED;
-					return -1;
-				}
-				iter->recvq.state = IPC_STATE_OPENED;
-			}
-			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-			return 0;
-		}
+	if (qd->sendq.state != IPC_STATE_OPENED) {
+		errno = EBADF;
+		return -1;
+	}
+	if (len > qd->sendq.attr.mq_msgsize) {
+		errno = EMSGSIZE;
+		return -1;
 	}
 
-	ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, "failed to open qdoor: qdoor not found");
-	return -1;
+	struct ringhdr *hdr = (struct ringhdr *)qd->sendr->ptr;
+	uint64_t head = hdr->head;
+	uint64_t need = sizeof(struct ringrec) + _IPCENG_ALIGN8(len);
+	uint64_t room = hdr->size - (head & (hdr->size - 1));
+	uint64_t pad = (room < need) ? room : 0;
+	struct backoff bo = _ipceng_backoff_init(&hdr->space_wait, spin_limit);
+	while (head + pad + need - qd->sendr_tail > hdr->size) {
+		qd->sendr_tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+		if (head + pad + need - qd->sendr_tail <= hdr->size)
+			break;
+		if (_ipceng_backoff(&bo, deadline) != 0)
+			return -1;
+	}
+	_ipceng_backoff_done(&bo);
+
+	if (pad) {
+		_ipceng_ring_rec(hdr, head)->len = _IPCENG_RING_WRAP;
+		head += pad;
+	}
+	struct ringrec *rec = _ipceng_ring_rec(hdr, head);
+	rec->len = len;
+	rec->prio = prio;
+	memcpy(rec + 1, data, len);
+	__atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->data_wait);
+	return 0;
 }
 
-void _ipceng_qdoor_close_by_entry(struct qdoor *qd)
+static ssize_t _ipceng_ring_recv(struct qdoor *qd, void *buff, size_t cap, int *prio,
+	const struct timespec *deadline, unsigned int spin_limit)
 {
+	if (qd->recvq.state != IPC_STATE_OPENED) {
+		errno = EBADF;
+		return -1;
+	}
+
+	struct ringhdr *hdr = (struct ringhdr *)qd->recvr->ptr;
+	uint64_t tail = hdr->tail;
+	struct backoff bo = _ipceng_backoff_init(&hdr->data_wait, spin_limit);
+	while (tail == qd->recvr_head) {
+		qd->recvr_head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		if (tail != qd->recvr_head)
+			break;
+		if (_ipceng_backoff(&bo, deadline) != 0)
+			return -1;
+	}
+	_ipceng_backoff_done(&bo);
+
+	struct ringrec *rec = _ipceng_ring_rec(hdr, tail);
+	if (rec->len == _IPCENG_RING_WRAP) {
+		tail += hdr->size - (tail & (hdr->size - 1));
+		rec = _ipceng_ring_rec(hdr, tail);
+	}
+	size_t len = rec->len;
+	if (len > cap) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	memcpy(buff, rec + 1, len);
+	if (prio)
+		*prio = rec->prio;
+	__atomic_store_n(&hdr->tail, tail + sizeof(struct ringrec) + _IPCENG_ALIGN8(len), \
+		__ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->space_wait);
+	return len;
+}
+
+// shared memory bounded queue of channels (Vyukov's array queue); each cell
+// has a sequence number telling whether it is free for position pos (seq ==
+// pos) or holds the message of position pos (seq == pos + 1), so producers
+// only race on enqueue_pos and a single consumer needs no atomic rmw at all;
+// IPCENG_CHAN_BCAST channels use the same layout differently: the only writer
+// never waits and the seq of a cell is a seqlock (2 * pos + 1 while writing the
+// message of position pos, 2 * pos + 2 when it is written), so each reader
+// follows enqueue_pos with its own cursor and notices when it is overrun
+#define _IPCENG_CHAN_MAGIC		0x4e414843			// "CHAN"
+
+struct chanhdr
+{
+	uint32_t magic;
+	uint32_t init;
+	uint32_t type;
+	uint32_t cell_size;
+	uint64_t cell_count;
+	char _pad0[_IPCENG_CACHELINE - 24];
+	uint64_t enqueue_pos;
+	struct shmwait not_empty;
+	char _pad1[_IPCENG_CACHELINE - 16];
+	uint64_t dequeue_pos;
+	struct shmwait not_full;
+	char _pad2[_IPCENG_CACHELINE - 16];
+};
+
+struct chancell
+{
+	uint64_t seq;
+	uint32_t len;
+	uint32_t prio;
+};
+
+#define _ipceng_chan_stride(hdr) \
+	(sizeof(struct chancell) + _IPCENG_ALIGN8((hdr)->cell_size))
+#define _ipceng_chan_cell(hdr, pos) \
+	((struct chancell *)((char *)(hdr) + sizeof(struct chanhdr) + \
+	((pos) & ((hdr)->cell_count - 1)) * _ipceng_chan_stride(hdr)))
+
+// initializing a freshly mapped channel, or waiting for another engine
+// initializing it; all engines should agree on the channel geometry
+static int _ipceng_chan_init(struct shm *sh, uint32_t type, uint64_t cell_count,
+	uint32_t cell_size)
+{
+	struct chanhdr *hdr = (struct chanhdr *)sh->ptr;
+	uint32_t fresh = 0;
+	if (__atomic_compare_exchange_n(&hdr->init, &fresh, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		hdr->type = type;
+		hdr->cell_size = cell_size;
+		hdr->cell_count = cell_count;
+		uint64_t i;
+		for (i = 0; i < cell_count; i++)
+			_ipceng_chan_cell(hdr, i)->seq = (type == IPCENG_CHAN_BCAST) ? 0 : i;
+		__atomic_store_n(&hdr->magic, _IPCENG_CHAN_MAGIC, __ATOMIC_RELEASE);
+	} else {
+		while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != _IPCENG_CHAN_MAGIC)
+			sched_yield();
+	}
+	return (hdr->type == type && hdr->cell_count == cell_count && \
+		hdr->cell_size == cell_size) ? 0 : -1;
+}
+
+static void _ipceng_chan_publish(struct chan *ch, const void *data, size_t len, int prio)
+{
+	struct chanhdr *hdr = (struct chanhdr *)ch->sh->ptr;
+	uint64_t pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+	struct chancell *cell = _ipceng_chan_cell(hdr, pos);
+
+	__atomic_store_n(&cell->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	cell->len = len;
+	cell->prio = prio;
+	memcpy(cell + 1, data, len);
+	__atomic_store_n(&cell->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->enqueue_pos, pos + 1, __ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->not_empty);
+}
+
+// reading the next message of a broadcast channel; an overrun reader skips to
+// half a lap behind the writer, so it has some room before it is overrun again
+static ssize_t _ipceng_chan_subscribe_recv(struct chan *ch, void *buff, int *prio,
+	const struct timespec *deadline, unsigned int spin_limit)
+{
+	struct chanhdr *hdr = (struct chanhdr *)ch->sh->ptr;
+	struct backoff bo = _ipceng_backoff_init(&hdr->not_empty, spin_limit);
+	for (;;) {
+		uint64_t head = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_ACQUIRE);
+		if (ch->cursor == head) {
+			if (_ipceng_backoff(&bo, deadline) != 0)
+				return -1;
+			continue;
+		}
+		if (head - ch->cursor <= hdr->cell_count) {
+			struct chancell *cell = _ipceng_chan_cell(hdr, ch->cursor);
+			uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+			if (seq == 2 * ch->cursor + 2) {
+				size_t len = cell->len;
+				int msg_prio = cell->prio;
+				if (len > ch->msgsize)
+					len = ch->msgsize;
+				memcpy(buff, cell + 1, len);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&cell->seq, __ATOMIC_RELAXED) == seq) {
+					_ipceng_backoff_done(&bo);
+					ch->cursor++;
+					if (prio)
+						*prio = msg_prio;
+					return len;
+				}
+			}
+		}
+		// overrun: the cell has been (or is being) reused by the writer
+		uint64_t resync = head - hdr->cell_count / 2;
+		if (resync > ch->cursor) {
+			ch->lost += resync - ch->cursor;
+			ch->cursor = resync;
+		}
+	}
+}
+
+static int _ipceng_chan_send(struct chan *ch, const void *data, size_t len, int prio,
+	const struct timespec *deadline, unsigned int spin_limit)
+{
+	if (len > ch->msgsize) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (ch->type == IPCENG_CHAN_BCAST) {
+		_ipceng_chan_publish(ch, data, len, prio);
+		return 0;
+	}
+
+	struct chanhdr *hdr = (struct chanhdr *)ch->sh->ptr;
+	struct chancell *cell;
+	uint64_t pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+	struct backoff bo = _ipceng_backoff_init(&hdr->not_full, spin_limit);
+	for (;;) {
+		cell = _ipceng_chan_cell(hdr, pos);
+		int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&hdr->enqueue_pos, &pos, pos + 1, 1, \
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			// full: the cell still holds the message of one lap ago
+			if (_ipceng_backoff(&bo, deadline) != 0)
+				return -1;
+			pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	_ipceng_backoff_done(&bo);
+
+	cell->len = len;
+	cell->prio = prio;
+	memcpy(cell + 1, data, len);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->not_empty);
+	return 0;
+}
+
+static ssize_t _ipceng_chan_recv(struct chan *ch, void *buff, int *prio,
+	const struct timespec *deadline, unsigned int spin_limit)
+{
+	if (ch->type == IPCENG_CHAN_BCAST)
+		return _ipceng_chan_subscribe_recv(ch, buff, prio, deadline, spin_limit);
+
+	struct chanhdr *hdr = (struct chanhdr *)ch->sh->ptr;
+	struct chancell *cell;
+	uint64_t pos = __atomic_load_n(&hdr->dequeue_pos, __ATOMIC_RELAXED);
+	struct backoff bo = _ipceng_backoff_init(&hdr->not_empty, spin_limit);
+	for (;;) {
+		cell = _ipceng_chan_cell(hdr, pos);
+		int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0) {
+			if (ch->type == IPCENG_CHAN_MPSC) {
+				__atomic_store_n(&hdr->dequeue_pos, pos + 1, __ATOMIC_RELAXED);
+				break;
+			}
+			if (__atomic_compare_exchange_n(&hdr->dequeue_pos, &pos, pos + 1, 1, \
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			// empty: the cell has not been filled for this lap yet
+			if (_ipceng_backoff(&bo, deadline) != 0)
+				return -1;
+			pos = __atomic_load_n(&hdr->dequeue_pos, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&hdr->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	_ipceng_backoff_done(&bo);
+
+	size_t len = cell->len;
+	memcpy(buff, cell + 1, len);
+	if (prio)
+		*prio = cell->prio;
+	// freeing the cell for the next lap
+	__atomic_store_n(&cell->seq, pos + hdr->cell_count, __ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->not_full);
+	return len;
+}
+
+// spill pool of a qdoor; it is created by the sending side and attached by
+// the receiving side on the first spilled message; slot states are claimed by
+// the sender (0 -> 1) and given back by the receiver (1 -> 0)
+#define _IPCENG_POOL_MAGIC		0x4c4f4f50			// "POOL"
+
+struct poolhdr
+{
+	uint32_t magic;
+	uint32_t slot_count;
+	uint64_t slot_size;
+	struct shmwait slot_freed;
+	char _pad0[_IPCENG_CACHELINE - 24];
+};
+
+#define _ipceng_pool_states(hdr) \
+	((uint32_t *)((char *)(hdr) + sizeof(struct poolhdr)))
+#define _ipceng_pool_slot(hdr, idx) \
+	((char *)(hdr) + sizeof(struct poolhdr) + \
+	_IPCENG_ALIGN64((hdr)->slot_count * sizeof(uint32_t)) + (size_t)(idx) * (hdr)->slot_size)
+#define _ipceng_pool_size(slot_size, slot_count) \
+	(sizeof(struct poolhdr) + _IPCENG_ALIGN64((slot_count) * sizeof(uint32_t)) + \
+	(size_t)(slot_size) * (slot_count))
+
+// credit counters of one direction of a qdoor (see ipceng_qdoor_set_credit);
+// both ends map it, the sending side publishes its window and adds transport
+// messages to sent, the receiving side adds them to consumed while a window is
+// published and wakes senders waiting for credits; each side writes its own
+// cache line only; a fresh shm is zeroed, so it needs no initialization
+struct credithdr
+{
+	uint64_t sent;
+	uint32_t window;
+	char _pad0[_IPCENG_CACHELINE - 12];
+	uint64_t consumed;
+	struct shmwait consumed_wait;
+	char _pad1[_IPCENG_CACHELINE - 16];
+};
+
+// credits of qd as a sender: window less the messages not consumed yet; the
+// peer may count a message before it is counted as sent, hence the clamp
+static inline unsigned int _ipceng_credit_left(struct qdoor *qd)
+{
+	struct credithdr *hdr = (struct credithdr *)qd->sendc->ptr;
+	uint64_t consumed = __atomic_load_n(&hdr->consumed, __ATOMIC_ACQUIRE);
+	int64_t in_flight = (int64_t)(__atomic_load_n(&hdr->sent, __ATOMIC_RELAXED) - consumed);
+	if (in_flight <= 0)
+		return qd->credit_window;
+	return ((uint64_t)qd->credit_window > (uint64_t)in_flight) ? \
+		qd->credit_window - (unsigned int)in_flight : 0;
+}
+
+// counting one transport message consumed from qd for its peer, if the peer
+// published a window
+static inline void _ipceng_credit_consumed(struct qdoor *qd)
+{
+	if (qd->recvc == NULL || qd->recvc->state != IPC_STATE_OPENED)
+		return;
+	struct credithdr *hdr = (struct credithdr *)qd->recvc->ptr;
+	if (__atomic_load_n(&hdr->window, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&hdr->consumed, 1, __ATOMIC_RELEASE);
+		_ipceng_notify(&hdr->consumed_wait);
+	}
+}
+
+// mapping the credit counters of qd, created by whichever end comes first:
+// those of the receiving direction always (every qdoor counts what it
+// consumes), those of the sending direction if sending is set or they were
+// mapped before
+static int _ipceng_qdoor_map_credit(struct ipceng *eng, struct qdoor *qd, bool sending)
+{
+	int credname_len = strlen("/2.credit") + strlen(eng->name) + strlen(qd->name) + 1;
+	char credname[credname_len];
+	if (qd->sendc == NULL && sending) {
+		sprintf(credname, "/%s2%s.credit", eng->name, qd->name);
+		qd->sendc = _ipceng_shm_new(qd->mem, credname, qd->name, sizeof(struct credithdr));
+		if (qd->sendc == NULL)
+			return -1;
+	}
+	if (qd->recvc == NULL) {
+		sprintf(credname, "/%s2%s.credit", qd->name, eng->name);
+		qd->recvc = _ipceng_shm_new(qd->mem, credname, qd->name, sizeof(struct credithdr));
+		if (qd->recvc == NULL)
+			return -1;
+	}
+	if (qd->sendc && qd->sendc->state != IPC_STATE_OPENED && \
+		_ipceng_shm_map(qd->sendc) != SHM_STAGE_DONE)
+		return -1;
+	if (qd->recvc->state != IPC_STATE_OPENED && _ipceng_shm_map(qd->recvc) != SHM_STAGE_DONE)
+		return -1;
+	return 0;
+}
+
+static int _ipceng_pool_alloc(struct qdoor *qd, const struct timespec *deadline,
+	unsigned int spin_limit)
+{
+	struct poolhdr *hdr = (struct poolhdr *)qd->sendp->ptr;
+	uint32_t *states = _ipceng_pool_states(hdr);
+	struct backoff bo = _ipceng_backoff_init(&hdr->slot_freed, spin_limit);
+	for (;;) {
+		unsigned int i;
+		for (i = 0; i < hdr->slot_count; i++) {
+			unsigned int idx = (qd->spill_hint + i) % hdr->slot_count;
+			uint32_t fresh = 0;
+			if (__atomic_load_n(&states[idx], __ATOMIC_RELAXED) == 0 && \
+				__atomic_compare_exchange_n(&states[idx], &fresh, 1, 0, \
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				_ipceng_backoff_done(&bo);
+				qd->spill_hint = idx + 1;
+				return idx;
+			}
+		}
+		if (_ipceng_backoff(&bo, deadline) != 0)
+			return -1;
+	}
+}
+
+// index of the pool slot starting at ptr; -1 if ptr is not a slot of pool
+static int _ipceng_pool_index(struct shm *pool, const void *ptr)
+{
+	if (pool == NULL || pool->state != IPC_STATE_OPENED)
+		return -1;
+	struct poolhdr *hdr = (struct poolhdr *)pool->ptr;
+	const char *first = _ipceng_pool_slot(hdr, 0);
+	if ((const char *)ptr < first || (const char *)ptr >= _ipceng_pool_slot(hdr, hdr->slot_count))
+		return -1;
+	size_t off = (const char *)ptr - first;
+	return (off % hdr->slot_size == 0) ? (int)(off / hdr->slot_size) : -1;
+}
+
+static void _ipceng_pool_free(struct shm *pool, unsigned int idx)
+{
+	struct poolhdr *hdr = (struct poolhdr *)pool->ptr;
+	__atomic_store_n(&_ipceng_pool_states(hdr)[idx], 0, __ATOMIC_RELEASE);
+	_ipceng_notify(&hdr->slot_freed);
+}
+
+// buffer pool helpers (see struct bufpool); blocks are taken by the receiving
+// thread of the qdoor but may be given back by any thread
+static char *_ipceng_bufpool_get(struct bufpool *bp)
+{
+	uint64_t head = __atomic_load_n(&bp->head, __ATOMIC_ACQUIRE), next;
+	do {
+		uint32_t idx = (uint32_t)head;
+		if (idx == _IPCENG_BUFPOOL_NONE)
+			return NULL;
+		// may be stale if the block is taken meanwhile, then the exchange fails
+		uint32_t next_idx = __atomic_load_n((uint32_t *)(bp->slab + idx * bp->blk), \
+			__ATOMIC_RELAXED);
+		next = (((head >> 32) + 1) << 32) | next_idx;
+	} while (!__atomic_compare_exchange_n(&bp->head, &head, next, true, \
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	__atomic_add_fetch(&bp->used, 1, __ATOMIC_RELAXED);
+	return bp->slab + (uint32_t)head * bp->blk;
+}
+
+static inline bool _ipceng_bufpool_owns(struct bufpool *bp, const void *ptr)
+{
+	return bp != NULL && (const char *)ptr >= bp->slab && \
+		(const char *)ptr < bp->slab + bp->nblocks * bp->blk;
+}
+
+static void _ipceng_bufpool_put(struct bufpool *bp, void *ptr)
+{
+	uint32_t idx = ((char *)ptr - bp->slab) / bp->blk;
+	uint64_t head = __atomic_load_n(&bp->head, __ATOMIC_RELAXED), next;
+	do {
+		__atomic_store_n((uint32_t *)(bp->slab + idx * bp->blk), (uint32_t)head, \
+			__ATOMIC_RELAXED);
+		next = (((head >> 32) + 1) << 32) | idx;
+	} while (!__atomic_compare_exchange_n(&bp->head, &head, next, true, \
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_sub_fetch(&bp->used, 1, __ATOMIC_RELAXED);
+}
+
+static struct bufpool *_ipceng_bufpool_new(struct ipceng_allocator *mem, size_t blk,
+	unsigned int nblocks)
+{
+	struct bufpool *bp = (struct bufpool *)_ipceng_alloc(mem, sizeof(struct bufpool));
+	if (bp == NULL)
+		return NULL;
+	bp->blk = _IPCENG_ALIGN8(blk);
+	bp->nblocks = nblocks;
+	bp->slab = (char *)_ipceng_alloc(mem, bp->blk * nblocks);
+	if (bp->slab == NULL) {
+		_ipceng_dealloc(mem, bp);
+		return NULL;
+	}
+	unsigned int i;
+	for (i = 0; i < nblocks; i++)
+		*(uint32_t *)(bp->slab + i * bp->blk) = (i + 1 < nblocks) ? i + 1 : _IPCENG_BUFPOOL_NONE;
+	bp->head = 0;
+	bp->used = 0;
+	return bp;
+}
+
+static void _ipceng_bufpool_free(struct ipceng_allocator *mem, struct bufpool *bp)
+{
+	if (bp == NULL)
+		return;
+	_ipceng_dealloc(mem, bp->slab);
+	_ipceng_dealloc(mem, bp);
+}
+
+// receive buffer of mq_msgsize + 1 bytes (for the terminating zero of string
+// messages) for a pop from qd, from its pool if possible
+static inline char *_ipceng_buf_get(struct qdoor *qd)
+{
+	char *buff = qd->pool ? _ipceng_bufpool_get(qd->pool) : NULL;
+	return buff ? buff : (char *)_ipceng_alloc(qd->mem, qd->recvq.attr.mq_msgsize + 1);
+}
+
+static inline void _ipceng_buf_put(struct qdoor *qd, void *buff)
+{
+	if (_ipceng_bufpool_owns(qd->pool, buff))
+		_ipceng_bufpool_put(qd->pool, buff);
+	else
+		_ipceng_dealloc(qd->mem, buff);
+}
+
+// giving a received message back to the peer pool, if it is spilled
+static inline void _ipceng_qdoor_view_release(struct qdoor *qd, struct msgview *view)
+{
+	if (view->slot >= 0 && qd->recvp->state == IPC_STATE_OPENED)
+		_ipceng_pool_free(qd->recvp, view->slot);
+	_ipceng_free_safe(qd->mem, view->owned);
+	view->data = NULL;
+	view->slot = -1;
+}
+
+// putting a received message aside, at the front (returned next) or at the
+// back of the stash; messages in the receive buffer are copied to the heap
+static int _ipceng_qdoor_stash(struct qdoor *qd, struct msgview *view, bool front)
+{
+	struct stashmsg *sm = (struct stashmsg *)_ipceng_alloc(qd->mem, sizeof(struct stashmsg));
+	if (sm == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (view->slot < 0 && view->owned == NULL) {
+		view->owned = _ipceng_alloc(qd->mem, view->len ? view->len : 1);
+		if (view->owned == NULL) {
+			_ipceng_dealloc(qd->mem, sm);
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(view->owned, view->data, view->len);
+		view->data = view->owned;
+	}
+	sm->view = *view;
+	view->data = NULL;
+	view->owned = NULL;
+	view->slot = -1;
+	if (front)
+		list_add(&sm->_list, &qd->stash);
+	else
+		list_add_tail(&sm->_list, &qd->stash);
+	return 0;
+}
+
+static void _ipceng_qdoor_drop_views(struct qdoor *qd)
+{
+	struct stashmsg *sm, *tmp;
+	list_for_each_entry_safe(sm, tmp, &qd->stash, _list) {
+		list_del(&sm->_list);
+		_ipceng_qdoor_view_release(qd, &sm->view);
+		_ipceng_dealloc(qd->mem, sm);
+	}
+	if (qd->lent.data)
+		_ipceng_qdoor_view_release(qd, &qd->lent);
+}
+
+// internal frame header; a qdoor message starting with _IPCENG_FRAME_MAGIC
+// (non-ascii bytes, so text messages never do) is a frame; user messages which
+// happen to start with it are sent as FRAME_KIND_RAW frames, so messages are
+// always told apart
+#define _IPCENG_FRAME_MAGIC		0x9ae7c3f1
+
+enum framekind
+{
+	// escaped user message; payload follows the header
+	FRAME_KIND_RAW = 1,
+	// user message spilled into pool slot aux of the sending side
+	FRAME_KIND_SPILL = 2,
+	// call request with call id aux; payload follows the header
+	FRAME_KIND_REQUEST = 3,
+	// reply to the call with id aux; payload follows the header
+	FRAME_KIND_REPLY = 4,
+	// aux coalesced messages of the same priority, each one as a 32-bit
+	// length followed by its data
+	FRAME_KIND_BATCH = 5
+};
+
+// frame flags; FRAME_FLAG_LZ: payload of a FRAME_KIND_RAW frame is compressed
+// (see _ipceng_lz_compress) and len is its decompressed length;
+// FRAME_FLAG_TYPED: user message starts with a struct ipceng_msghdr (RAW and
+// SPILL frames; in a batch it is the top bit of the message length);
+// FRAME_FLAG_STAMP: a 64-bit CLOCK_MONOTONIC send time in nanoseconds follows
+// the header (RAW and SPILL frames; a BATCH frame has one after the length of
+// each message instead)
+#define FRAME_FLAG_LZ			0x01
+#define FRAME_FLAG_TYPED		0x02
+#define FRAME_FLAG_STAMP		0x04
+#define _IPCENG_BATCH_TYPED		0x80000000u
+
+struct frame
+{
+	uint32_t magic;
+	uint8_t kind;
+	uint8_t flags;
+	uint16_t _reserved;
+	uint32_t len;
+	uint32_t aux;
+};
+
+static inline bool _ipceng_is_frame(const void *data, size_t len)
+{
+	uint32_t magic;
+	if (len < sizeof(struct frame))
+		return false;
+	memcpy(&magic, data, sizeof(magic));
+	return magic == _IPCENG_FRAME_MAGIC;
+}
+
+// LZ77 codec of compressed frames, in the spirit of LZ4 block format: a
+// sequence is a token (literal length << 4 | match length - 4, 15 meaning
+// more length bytes follow, each adding up to 255), the literals, and a
+// 16-bit little endian match offset with its extra length bytes; the last
+// sequence has literals only
+#define _IPCENG_LZ_HASHBITS		12
+#define _IPCENG_LZ_MINMATCH		4
+// largest message which is compressed (and accepted decompressed)
+#define _IPCENG_LZ_MAXLEN		(16 * 1024 * 1024)
+
+static inline uint32_t _ipceng_lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t _ipceng_lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - _IPCENG_LZ_HASHBITS);
+}
+
+// length of the common prefix of a and b, up to max bytes; 8 bytes at a time
+static inline size_t _ipceng_lz_common(const uint8_t *a, const uint8_t *b, size_t max)
+{
+	size_t n = 0;
+	while (n + sizeof(uint64_t) <= max) {
+		uint64_t x, y;
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		// first differing byte is the lowest one in memory
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		if (x != y)
+			return n + (__builtin_ctzll(x ^ y) >> 3);
+#else
+		if (x != y)
+			return n + (__builtin_clzll(x ^ y) >> 3);
+#endif
+		n += sizeof(uint64_t);
+	}
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
+static inline size_t _ipceng_lz_putlen(uint8_t *dst, size_t op, size_t n)
+{
+	for (; n >= 255; n -= 255)
+		dst[op++] = 255;
+	dst[op++] = n;
+	return op;
+}
+
+// writing one sequence at dst + op; returns new op, 0 if dst (cap bytes) is full
+static size_t _ipceng_lz_emit(uint8_t *dst, size_t op, size_t cap, const uint8_t *lit,
+	size_t lit_len, size_t offset, size_t match_len)
+{
+	size_t ml = match_len ? match_len - _IPCENG_LZ_MINMATCH : 0;
+	if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + ml / 255 + 1 > cap)
+		return 0;
+	uint8_t *token = dst + op++;
+	*token = ((lit_len < 15) ? lit_len : 15) << 4 | ((ml < 15) ? ml : 15);
+	if (lit_len >= 15)
+		op = _ipceng_lz_putlen(dst, op, lit_len - 15);
+	memcpy(dst + op, lit, lit_len);
+	op += lit_len;
+	if (match_len) {
+		dst[op++] = offset & 0xff;
+		dst[op++] = offset >> 8;
+		if (ml >= 15)
+			op = _ipceng_lz_putlen(dst, op, ml - 15);
+	}
+	return op;
+}
+
+// compressing len bytes of src into dst (cap bytes); table is a match finder
+// of 1 << _IPCENG_LZ_HASHBITS entries, which needs no reset between calls;
+// returns compressed length, 0 if it does not fit in cap
+static size_t _ipceng_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap,
+	uint32_t *table)
+{
+	size_t ip = 0, anchor = 0, op = 0;
+	while (ip + _IPCENG_LZ_MINMATCH <= len) {
+		uint32_t v = _ipceng_lz_read32(src + ip);
+		uint32_t h = _ipceng_lz_hash(v);
+		size_t cand = table[h];
+		table[h] = ip;
+		// entries left by other messages are just bad candidates
+		if (cand >= ip || ip - cand > 0xffff || _ipceng_lz_read32(src + cand) != v) {
+			// skipping faster through data which does not compress
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		size_t match_len = _IPCENG_LZ_MINMATCH + _ipceng_lz_common(src + cand + _IPCENG_LZ_MINMATCH, \
+			src + ip + _IPCENG_LZ_MINMATCH, len - ip - _IPCENG_LZ_MINMATCH);
+		op = _ipceng_lz_emit(dst, op, cap, src + anchor, ip - anchor, ip - cand, match_len);
+		if (op == 0)
+			return 0;
+		ip += match_len;
+		anchor = ip;
+	}
+	return _ipceng_lz_emit(dst, op, cap, src + anchor, len - anchor, 0, 0);
+}
+
+// decompressing len bytes of src into dst (cap bytes); returns decompressed
+// length, -1 if src is malformed or does not fit in cap
+static ssize_t _ipceng_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+	size_t ip = 0, op = 0;
+	while (ip < len) {
+		uint8_t token = src[ip++], b;
+		size_t n = token >> 4;
+		if (n == 15) {
+			do {
+				if (ip >= len)
+					return -1;
+				b = src[ip++];
+				n += b;
+			} while (b == 255);
+		}
+		if (n > len - ip || n > cap - op)
+			return -1;
+		memcpy(dst + op, src + ip, n);
+		ip += n;
+		op += n;
+		if (ip == len)
+			break;
+
+		if (len - ip < 2)
+			return -1;
+		size_t offset = src[ip] | (size_t)src[ip + 1] << 8;
+		ip += 2;
+		n = token & 15;
+		if (n == 15) {
+			do {
+				if (ip >= len)
+					return -1;
+				b = src[ip++];
+				n += b;
+			} while (b == 255);
+		}
+		n += _IPCENG_LZ_MINMATCH;
+		if (offset == 0 || offset > op || n > cap - op)
+			return -1;
+		// a match closer than its length repeats itself, so it is copied forward
+		if (offset >= n) {
+			memcpy(dst + op, dst + op - offset, n);
+		} else {
+			size_t i;
+			for (i = 0; i < n; i++)
+				dst[op + i] = dst[op - offset + i];
+		}
+		op += n;
+	}
+	return op;
+}
+
+// engine concurrency: writers (adding/deleting qdoors, shms and channels)
+// are serialized by dispatch_lock; lookups take no lock, they retry if a
+// writer changed handle slots or hash indexes meanwhile (seq) and objects
+// removed by writers are freed only once no thread can still use them
+// (_ipceng_retire); a thread enters a read section on its first lookup in a
+// call and leaves it when the call sets its result (see ipceng_set_error),
+// unless the call is made by a user callback run from within a read section
+static uint64_t _ipceng_next_id = 0;
+static __thread struct ipceng_reader *_ipceng_rd;
+static __thread uint64_t _ipceng_rd_id;
+
+// record of the calling thread in eng, NULL if it has none yet
+static struct ipceng_reader *_ipceng_reader_find(struct ipceng *eng)
+{
+	struct ipceng_reader *r;
+	for (r = __atomic_load_n(&eng->readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+		if (r->owner == &_ipceng_rd)
+			break;
+	return r;
+}
+
+static struct ipceng_reader *_ipceng_reader_get(struct ipceng *eng)
+{
+	struct ipceng_reader *r = _ipceng_reader_find(eng);
+	if (r == NULL) {
+		// records are kept until the object is terminated, a thread started
+		// later at the same address takes over the one of an exited thread
+		if (posix_memalign((void **)&r, _IPCENG_CACHELINE, sizeof(struct ipceng_reader)) != 0)
+			return NULL;
+		r->epoch = 0;
+		r->depth = 0;
+		r->owner = &_ipceng_rd;
+		r->next = __atomic_load_n(&eng->readers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&eng->readers, &r->next, r, true, \
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	_ipceng_rd = r;
+	_ipceng_rd_id = eng->id;
+	return r;
+}
+
+static inline void _ipceng_read_enter(struct ipceng *eng)
+{
+	struct ipceng_reader *r = _ipceng_rd;
+	if (r == NULL || _ipceng_rd_id != eng->id) {
+		r = _ipceng_reader_get(eng);
+		if (r == NULL)
+			return;
+	}
+	if (r->epoch == 0) {
+		// pairs with the fence of _ipceng_reclaim: either the writer sees
+		// this epoch or this thread sees what the writer has unlinked
+		__atomic_store_n(&r->epoch, __atomic_load_n(&eng->epoch, __ATOMIC_RELAXED), \
+			__ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+// the cached record may be of another engine if a callback made calls on it,
+// so the one of eng is looked up then
+static inline void _ipceng_read_leave(struct ipceng *eng)
+{
+	struct ipceng_reader *r = (_ipceng_rd_id == eng->id) ? _ipceng_rd : _ipceng_reader_find(eng);
+	if (r != NULL && r->depth == 0)
+		__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// keeping the read section of eng across a user callback, which may make
+// calls (on eng or other engines) that would leave it otherwise; returns the
+// record to give to _ipceng_read_unhold, which keeps the section entered
+static inline struct ipceng_reader *_ipceng_read_hold(struct ipceng *eng)
+{
+	_ipceng_read_enter(eng);
+	struct ipceng_reader *r = (_ipceng_rd_id == eng->id) ? _ipceng_rd : NULL;
+	if (r != NULL)
+		r->depth++;
+	return r;
+}
+
+static inline void _ipceng_read_unhold(struct ipceng_reader *r)
+{
+	if (r != NULL)
+		r->depth--;
+}
+
+// handing ptr, already unlinked by the writer, over to be freed by free_fn
+// once threads which could have looked it up are done; it is never freed if
+// there is no memory to keep track of it
+static void _ipceng_retire(struct ipceng *eng, void *ptr, void (*free_fn)(struct ipceng *, void *))
+{
+	struct retired *rt = (struct retired *)malloc(sizeof(struct retired));
+	if (rt == NULL)
+		return;
+	rt->ptr = ptr;
+	rt->free_fn = free_fn;
+	rt->epoch = __atomic_add_fetch(&eng->epoch, 1, __ATOMIC_SEQ_CST);
+	list_add_tail(&rt->_list, &eng->retired);
+}
+
+static void _ipceng_retired_free(struct ipceng *eng, void *ptr)
+{
+	free(ptr);
+}
+
+// freeing retired objects which no read section can still see (all of them if
+// all, when the object is terminated); called by writers, whose own read
+// section is over by then
+static void _ipceng_reclaim(struct ipceng *eng, bool all)
+{
+	uint64_t oldest = UINT64_MAX;
+	if (!all) {
+		_ipceng_read_leave(eng);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		struct ipceng_reader *r;
+		for (r = __atomic_load_n(&eng->readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+			uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+			if (epoch != 0 && epoch < oldest)
+				oldest = epoch;
+		}
+	}
+	// retired in epoch order; freeing a qdoor may retire its mappings, which
+	// are then taken in the same pass if they can be
+	while (!list_empty(&eng->retired)) {
+		struct retired *rt = list_first_entry(&eng->retired, struct retired, _list);
+		if (rt->epoch > oldest)
+			break;
+		list_del(&rt->_list);
+		rt->free_fn(eng, rt->ptr);
+		free(rt);
+	}
+}
+
+// mapping of a closed shm, unmapped once it is reclaimed
+struct retiredmap
+{
+	void *ptr;
+	size_t size;
+};
+
+static void _ipceng_map_retired_free(struct ipceng *eng, void *ptr)
+{
+	struct retiredmap *rm = (struct retiredmap *)ptr;
+	munmap(rm->ptr, rm->size);
+	free(rm);
+}
+
+// closing sh like _ipceng_shm_unmap, but leaving its mapping to threads which
+// could still use it (see _ipceng_retire); it stays mapped if there is no
+// memory to keep track of it
+static void _ipceng_shm_retire_map(struct ipceng *eng, struct shm *sh)
+{
+	if (sh->state == IPC_STATE_CLOSED)
+		return;
+	struct retiredmap *rm = (struct retiredmap *)malloc(sizeof(struct retiredmap));
+	if (rm != NULL) {
+		rm->ptr = sh->ptr;
+		rm->size = sh->size;
+		_ipceng_retire(eng, rm, _ipceng_map_retired_free);
+	}
+	close(sh->shmd);
+	sh->state = IPC_STATE_CLOSED;
+}
+
+// sequence count of handle slots and hash indexes; writers are serialized
+static inline void _ipceng_seq_write_begin(struct ipceng *eng)
+{
+	__atomic_store_n(&eng->seq, eng->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void _ipceng_seq_write_end(struct ipceng *eng)
+{
+	__atomic_store_n(&eng->seq, eng->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int _ipceng_seq_read_begin(struct ipceng *eng)
+{
+	unsigned int seq;
+	while ((seq = __atomic_load_n(&eng->seq, __ATOMIC_ACQUIRE)) & 1)
+		_ipceng_cpu_relax();
+	return seq;
+}
+
+static inline bool _ipceng_seq_read_retry(struct ipceng *eng, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&eng->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// hash index helpers
+static unsigned int _ipceng_hash(const char *str)
+{
+	// 32-bit FNV-1a
+	unsigned int hash = 2166136261u;
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct hlist_head *_ipceng_htable_alloc(unsigned int hsize)
+{
+	struct hlist_head *htable = (struct hlist_head *)malloc(hsize * sizeof(struct hlist_head));
+	if (htable == NULL)
+		return NULL;
+	unsigned int i;
+	for (i = 0; i < hsize; i++)
+		INIT_HLIST_HEAD(&htable[i]);
+	return htable;
+}
+
+// adding hn into the index; the index is doubled when it becomes more loaded
+// than one entry per bucket (count is the number of entries after adding hn)
+static void _ipceng_htable_add(struct ipceng *eng, struct hlist_head **htable,
+	unsigned int *hsize, int count, struct hnode *hn)
+{
+	if (count > *hsize) {
+		unsigned int new_hsize = *hsize << 1;
+		struct hlist_head *new_htable = _ipceng_htable_alloc(new_hsize);
+		// if growing fails, old index is still valid (just more loaded)
+		if (new_htable != NULL) {
+			unsigned int i;
+			struct hlist_node *pos, *n;
+			for (i = 0; i < *hsize; i++) {
+				hlist_for_each_safe(pos, n, &(*htable)[i]) {
+					struct hnode *iter = hlist_entry(pos, struct hnode, node);
+					hlist_add_head_rcu(pos, &new_htable[iter->hash & (new_hsize - 1)]);
+				}
+			}
+			_ipceng_retire(eng, *htable, _ipceng_retired_free);
+			__atomic_store_n(htable, new_htable, __ATOMIC_RELEASE);
+			__atomic_store_n(hsize, new_hsize, __ATOMIC_RELEASE);
+		}
+	}
+	hlist_add_head_rcu(&hn->node, &(*htable)[hn->hash & (*hsize - 1)]);
+}
+
+static struct qdoor *_ipceng_qdoor_find(struct ipceng *eng, char *qdoor_name)
+{
+	unsigned int hash = _ipceng_hash(qdoor_name), seq;
+	struct qdoor *found;
+	_ipceng_read_enter(eng);
+	do {
+		seq = _ipceng_seq_read_begin(eng);
+		found = NULL;
+		// buckets are published before their number grows
+		unsigned int hsize = __atomic_load_n(&eng->qdoor_hsize, __ATOMIC_ACQUIRE);
+		struct hlist_head *htable = __atomic_load_n(&eng->qdoor_htable, __ATOMIC_ACQUIRE);
+		struct hlist_node *pos;
+		hlist_for_each_rcu(pos, &htable[hash & (hsize - 1)]) {
+			struct qdoor *iter = list_container_of(pos, struct qdoor, _hnode.node);
+			if (iter->_hnode.hash == hash && !strcmp(iter->name, qdoor_name)) {
+				found = iter;
+				break;
+			}
+		}
+	} while (_ipceng_seq_read_retry(eng, seq));
+	return found;
+}
+
+static struct chan *_ipceng_chan_find(struct ipceng *eng, char *chan_name)
+{
+	unsigned int hash = _ipceng_hash(chan_name), seq;
+	struct chan *found;
+	_ipceng_read_enter(eng);
+	do {
+		seq = _ipceng_seq_read_begin(eng);
+		found = NULL;
+		// buckets are published before their number grows
+		unsigned int hsize = __atomic_load_n(&eng->chan_hsize, __ATOMIC_ACQUIRE);
+		struct hlist_head *htable = __atomic_load_n(&eng->chan_htable, __ATOMIC_ACQUIRE);
+		struct hlist_node *pos;
+		hlist_for_each_rcu(pos, &htable[hash & (hsize - 1)]) {
+			struct chan *iter = list_container_of(pos, struct chan, _hnode.node);
+			if (iter->_hnode.hash == hash && !strcmp(iter->name, chan_name)) {
+				found = iter;
+				break;
+			}
+		}
+	} while (_ipceng_seq_read_retry(eng, seq));
+	return found;
+}
+
+static struct shm *_ipceng_shm_find(struct ipceng *eng, char *shm_name)
+{
+	unsigned int hash = _ipceng_hash(shm_name), seq;
+	struct shm *found;
+	_ipceng_read_enter(eng);
+	do {
+		seq = _ipceng_seq_read_begin(eng);
+		found = NULL;
+		// buckets are published before their number grows
+		unsigned int hsize = __atomic_load_n(&eng->shm_hsize, __ATOMIC_ACQUIRE);
+		struct hlist_head *htable = __atomic_load_n(&eng->shm_htable, __ATOMIC_ACQUIRE);
+		struct hlist_node *pos;
+		hlist_for_each_rcu(pos, &htable[hash & (hsize - 1)]) {
+			struct shm *iter = list_container_of(pos, struct shm, _hnode.node);
+			if (iter->_hnode.hash == hash && !strcmp(iter->nickname, shm_name)) {
+				found = iter;
+				break;
+			}
+		}
+	} while (_ipceng_seq_read_retry(eng, seq));
+	return found;
+}
+
+// handle slot helpers
+static int _ipceng_slot_alloc(struct ipceng *eng, struct ipceng_slot **slots,
+	unsigned int *nslots, unsigned int *free_slot, void *obj)
+{
+	if (*free_slot == 0) {
+		// no free slot, doubling the slots; old ones may still be read
+		unsigned int i, new_nslots = (*nslots) ? (*nslots << 1) : IPCENG_DEFAULT_HSIZE;
+		struct ipceng_slot *new_slots = (struct ipceng_slot *)malloc( \
+			new_nslots * sizeof(struct ipceng_slot));
+		if (new_slots == NULL)
+			return -1;
+		if (*slots != NULL) {
+			memcpy(new_slots, *slots, *nslots * sizeof(struct ipceng_slot));
+			_ipceng_retire(eng, *slots, _ipceng_retired_free);
+		}
+		for (i = *nslots; i < new_nslots; i++) {
+			new_slots[i].obj = NULL;
+			new_slots[i].gen = 0;
+			new_slots[i].next_free = (i + 1 < new_nslots) ? (i + 2) : 0;
+		}
+		__atomic_store_n(slots, new_slots, __ATOMIC_RELEASE);
+		*free_slot = *nslots + 1;
+		__atomic_store_n(nslots, new_nslots, __ATOMIC_RELEASE);
+	}
+	unsigned int idx = *free_slot - 1;
+	*free_slot = (*slots)[idx].next_free;
+	(*slots)[idx].obj = obj;
+	return idx;
+}
+
+static void _ipceng_slot_free(struct ipceng_slot *slots, unsigned int *free_slot,
+	unsigned int idx)
+{
+	slots[idx].obj = NULL;
+	slots[idx].gen++;
+	slots[idx].next_free = *free_slot;
+	*free_slot = idx + 1;
+}
+
+static inline uint64_t _ipceng_slot_handle(struct ipceng_slot *slots, unsigned int idx)
+{
+	return ((uint64_t)(idx + 1) << 32) | slots[idx].gen;
+}
+
+static inline void *_ipceng_slot_obj(struct ipceng *eng, struct ipceng_slot **slots,
+	unsigned int *nslots, uint64_t handle)
+{
+	unsigned int idx = (unsigned int)(handle >> 32) - 1, seq;
+	void *obj;
+	_ipceng_read_enter(eng);
+	do {
+		seq = _ipceng_seq_read_begin(eng);
+		// slots are published before their count grows
+		unsigned int n = __atomic_load_n(nslots, __ATOMIC_ACQUIRE);
+		struct ipceng_slot *cur = __atomic_load_n(slots, __ATOMIC_ACQUIRE);
+		obj = NULL;
+		if (idx < n && cur[idx].gen == (unsigned int)handle)
+			obj = cur[idx].obj;
+	} while (_ipceng_seq_read_retry(eng, seq));
+	return obj;
+}
+
+#define _ipceng_qdoor_from_handle(eng, qd) \
+	((struct qdoor *)_ipceng_slot_obj(eng, &(eng)->qdoor_slots, &(eng)->qdoor_nslots, qd))
+#define _ipceng_shm_from_handle(eng, sh) \
+	((struct shm *)_ipceng_slot_obj(eng, &(eng)->shm_slots, &(eng)->shm_nslots, sh))
+#define _ipceng_chan_from_handle(eng, ch) \
+	((struct chan *)_ipceng_slot_obj(eng, &(eng)->chan_slots, &(eng)->chan_nslots, ch))
+
+// adding recvq of qd into the engine epoll set (see ipceng_wait)
+static int _ipceng_qdoor_watch(struct ipceng *eng, struct qdoor *qd)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = _ipceng_slot_handle(eng->qdoor_slots, qd->slot);
+	return epoll_ctl(eng->epfd, EPOLL_CTL_ADD, qd->recvq.mqd, &ev);
+}
+
+// (re)arming qd in the dispatcher epoll set; each qdoor is handed to one
+// dispatcher thread at a time (EPOLLONESHOT), which keeps its messages in order
+static int _ipceng_qdoor_dispatch_arm(struct ipceng *eng, struct qdoor *qd, int op)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = _ipceng_slot_handle(eng->qdoor_slots, qd->slot);
+	return epoll_ctl(eng->dispatch_epfd, op, qd->recvq.mqd, &ev);
+}
+
+// main function implementation
+struct ipceng *ipceng_init(char *name)
+{
+	if (!name)
+		return NULL;
+
+	struct ipceng *new_eng = (struct ipceng *)malloc(sizeof(struct ipceng));
+	new_eng->qdoor_htable = _ipceng_htable_alloc(IPCENG_DEFAULT_HSIZE);
+	new_eng->shm_htable = _ipceng_htable_alloc(IPCENG_DEFAULT_HSIZE);
+	new_eng->chan_htable = _ipceng_htable_alloc(IPCENG_DEFAULT_HSIZE);
+	if (!new_eng->qdoor_htable || !new_eng->shm_htable || !new_eng->chan_htable) {
+		free(new_eng->qdoor_htable);
+		free(new_eng->shm_htable);
+		free(new_eng->chan_htable);
+		free(new_eng);
+		return NULL;
+	}
+	new_eng->epfd = epoll_create1(EPOLL_CLOEXEC);
+	new_eng->dispatch_epfd = epoll_create1(EPOLL_CLOEXEC);
+	new_eng->dispatch_evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	// dispatcher stop event is reported with the invalid handle
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = IPCENG_HANDLE_INVALID;
+	if (new_eng->epfd == -1 || new_eng->dispatch_epfd == -1 || new_eng->dispatch_evfd == -1 || \
+		epoll_ctl(new_eng->dispatch_epfd, EPOLL_CTL_ADD, new_eng->dispatch_evfd, &ev) != 0) {
+		if (new_eng->epfd != -1)
+			close(new_eng->epfd);
+		if (new_eng->dispatch_epfd != -1)
+			close(new_eng->dispatch_epfd);
+		if (new_eng->dispatch_evfd != -1)
+			close(new_eng->dispatch_evfd);
+		free(new_eng->qdoor_htable);
+		free(new_eng->shm_htable);
+		free(new_eng->chan_htable);
+		free(new_eng);
+		return NULL;
+	}
+	new_eng->dispatch_threads = NULL;
+	new_eng->dispatch_nthreads = 0;
+	pthread_rwlock_init(&new_eng->dispatch_lock, NULL);
+	new_eng->qdoor_hsize = IPCENG_DEFAULT_HSIZE;
+	new_eng->shm_hsize = IPCENG_DEFAULT_HSIZE;
+	new_eng->chan_hsize = IPCENG_DEFAULT_HSIZE;
+	new_eng->qdoor_slots = NULL;
+	new_eng->qdoor_nslots = 0;
+	new_eng->qdoor_free_slot = 0;
+	new_eng->shm_slots = NULL;
+	new_eng->shm_nslots = 0;
+	new_eng->shm_free_slot = 0;
+	new_eng->chan_slots = NULL;
+	new_eng->chan_nslots = 0;
+	new_eng->chan_free_slot = 0;
+	new_eng->name = strdup(name);
+	new_eng->has_log = true;
+	new_eng->has_trace = false;
+	new_eng->spin_count = IPCENG_DEFAULT_SPIN;
+	new_eng->coalesce_count = 0;
+	new_eng->handlers = NULL;
+	new_eng->handlers_size = 0;
+	new_eng->sched_cur = IPCENG_HANDLE_INVALID;
+	new_eng->sched_granted = false;
+	new_eng->mem.alloc = NULL;
+	new_eng->mem.free = NULL;
+	new_eng->mem.ctx = NULL;
+	new_eng->id = __atomic_add_fetch(&_ipceng_next_id, 1, __ATOMIC_RELAXED);
+	new_eng->seq = 0;
+	new_eng->epoch = 1;
+	new_eng->readers = NULL;
+	INIT_LIST_HEAD(&new_eng->retired);
+	INIT_LIST_HEAD(&new_eng->qdoor_list);
+	new_eng->qdoor_count = 0;
+	INIT_LIST_HEAD(&new_eng->shm_list);
+	new_eng->shm_count = 0;
+	INIT_LIST_HEAD(&new_eng->chan_list);
+	new_eng->chan_count = 0;
+	INIT_LIST_HEAD(&new_eng->_list);
+
+	return new_eng;
+}
+
+// generic messages of IPCENG_ERR_* codes, indexed by -code
+static char *_ipceng_errmsg_table[] = {
+	[-IPCENG_ERR_NOERROR] = "no error",
+	[-IPCENG_ERR_QDOORADD] = "failed to add qdoor",
+	[-IPCENG_ERR_QDOORDEL] = "failed to delete qdoor",
+	[-IPCENG_ERR_QDOOROPEN] = "failed to open qdoor",
+	[-IPCENG_ERR_QDOORPUSH] = "failed to push into qdoor",
+	[-IPCENG_ERR_QDOORPOP] = "failed to pop from qdoor",
+	[-IPCENG_ERR_SHMADD] = "failed to add shm",
+	[-IPCENG_ERR_SHMDEL] = "failed to delete shm",
+	[-IPCENG_ERR_SHMOPEN] = "failed to open shm",
+	[-IPCENG_ERR_SHMREAD] = "failed to read shm",
+	[-IPCENG_ERR_SHMWRITE] = "failed to write shm",
+	[-IPCENG_ERR_TERM] = "failed to terminate ipceng object",
+	[-IPCENG_ERR_QDOORGET] = "failed to get qdoor",
+	[-IPCENG_ERR_SHMGET] = "failed to get shm",
+	[-IPCENG_ERR_WAIT] = "failed to wait",
+	[-IPCENG_ERR_DISPATCH] = "failed to dispatch",
+	[-IPCENG_ERR_CHANADD] = "failed to add channel",
+	[-IPCENG_ERR_CHANGET] = "failed to get channel",
+	[-IPCENG_ERR_CHANPUSH] = "failed to push into channel",
+	[-IPCENG_ERR_CHANPOP] = "failed to pop from channel",
+	[-IPCENG_ERR_SHMWAIT] = "failed to wait on shm",
+	[-IPCENG_ERR_SHMWAKE] = "failed to wake shm waiters",
+	[-IPCENG_ERR_QDOORSPILL] = "failed to set qdoor spill pool",
+	[-IPCENG_ERR_MSGLOAN] = "failed to loan message",
+	[-IPCENG_ERR_MSGTAKE] = "failed to take message",
+	[-IPCENG_ERR_CALL] = "failed to call",
+	[-IPCENG_ERR_COALESCE] = "failed to set coalescing",
+	[-IPCENG_ERR_COMPRESS] = "failed to set compression",
+	[-IPCENG_ERR_TYPED] = "failed to handle typed message",
+	[-IPCENG_ERR_SCHED] = "failed to schedule",
+	[-IPCENG_ERR_CREDIT] = "failed to handle credits",
+	[-IPCENG_ERR_ALLOC] = "failed to allocate",
+	[-IPCENG_ERR_STATS] = "failed to get stats",
+	[-IPCENG_ERR_LATENCY] = "failed to handle latency",
+	[-IPCENG_ERR_TRACE] = "failed to dump trace",
+};
+
+// last error of the calling thread and the object it belongs to; messages are
+// static (literals, tables or strerror), so setting an error never allocates,
+// and successful calls are just three stores
+static __thread struct ipceng *_ipceng_err_eng;
+static __thread int _ipceng_err_code;
+static __thread const char *_ipceng_err_msg;
+
+void ipceng_set_error(struct ipceng *eng, int _errno, const char *_errmsg)
+{
+	_ipceng_err_eng = eng;
+	_ipceng_err_code = _errno;
+	_ipceng_err_msg = _errmsg;
+	// the call is done with whatever it has looked up
+	_ipceng_read_leave(eng);
+}
+
+// hot-path tracepoints (see ipceng_trace_dump), built in with IPCENG_TRACE
+// only; an operation of an engine with has_trace set is recorded as one
+// complete event into the trace ring of the calling thread, which keeps the
+// last _IPCENG_TRACE_EVENTS of them
+enum tracepoint
+{
+	TRACE_QDOOR_PUSH,
+	TRACE_QDOOR_POP,
+	TRACE_SHM_READ,
+	TRACE_SHM_WRITE,
+	TRACE_QDOOR_ADD,
+	TRACE_QDOOR_DEL
+};
+
+#ifdef IPCENG_TRACE
+#define _IPCENG_TRACE_EVENTS		4096				// a power of two
+#define _IPCENG_TRACE_NAMELEN		20
+
+static const char *_ipceng_trace_names[] = {
+	[TRACE_QDOOR_PUSH] = "qdoor_push",
+	[TRACE_QDOOR_POP] = "qdoor_pop",
+	[TRACE_SHM_READ] = "shm_read",
+	[TRACE_SHM_WRITE] = "shm_write",
+	[TRACE_QDOOR_ADD] = "qdoor_add",
+	[TRACE_QDOOR_DEL] = "qdoor_del",
+};
+
+// one traced operation; ts is its CLOCK_MONOTONIC start time, name is the
+// qdoor/shm name (truncated)
+struct traceev
+{
+	uint64_t eng_id;
+	uint64_t ts;
+	uint32_t dur;
+	uint16_t point;
+	int16_t ret;
+	uint32_t len;
+	char name[_IPCENG_TRACE_NAMELEN];
+};
+
+// trace ring of a thread; only its thread writes it, head is the number of
+// events written so far (event i is in ev[i % _IPCENG_TRACE_EVENTS]) and
+// events before start belong to a former owner; a ring whose thread exited is
+// released and taken over by the next new thread
+struct tracering
+{
+	struct tracering *next;
+	pid_t tid;
+	int released;
+	uint64_t start;
+	uint64_t head;
+	struct traceev ev[_IPCENG_TRACE_EVENTS];
+};
+
+static struct tracering *_ipceng_trace_rings;
+static __thread struct tracering *_ipceng_trace_ring;
+static pthread_key_t _ipceng_trace_key;
+static pthread_once_t _ipceng_trace_once = PTHREAD_ONCE_INIT;
+
+static void _ipceng_trace_release(void *ptr)
+{
+	__atomic_store_n(&((struct tracering *)ptr)->released, 1, __ATOMIC_RELEASE);
+}
+
+static void _ipceng_trace_key_create()
+{
+	pthread_key_create(&_ipceng_trace_key, _ipceng_trace_release);
+}
+
+static struct tracering *_ipceng_trace_ring_get()
+{
+	struct tracering *r;
+	pthread_once(&_ipceng_trace_once, _ipceng_trace_key_create);
+	for (r = __atomic_load_n(&_ipceng_trace_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		int released = 1;
+		if (__atomic_compare_exchange_n(&r->released, &released, 0, false, \
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+	if (r == NULL) {
+		// rings are kept until the process exits
+		r = (struct tracering *)calloc(1, sizeof(struct tracering));
+		if (r == NULL)
+			return NULL;
+		r->next = __atomic_load_n(&_ipceng_trace_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&_ipceng_trace_rings, &r->next, r, true, \
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	r->tid = syscall(SYS_gettid);
+	__atomic_store_n(&r->start, r->head, __ATOMIC_RELEASE);
+	pthread_setspecific(_ipceng_trace_key, r);
+	_ipceng_trace_ring = r;
+	return r;
+}
+
+static void _ipceng_trace_rec(struct ipceng *eng, uint16_t point, const char *name,
+	size_t len, int ret, uint64_t t0)
+{
+	uint64_t dur = _ipceng_now_ns() - t0;
+	struct tracering *r = _ipceng_trace_ring;
+	if (r == NULL && (r = _ipceng_trace_ring_get()) == NULL)
+		return;
+	struct traceev *ev = &r->ev[r->head & (_IPCENG_TRACE_EVENTS - 1)];
+	ev->eng_id = eng->id;
+	ev->ts = t0;
+	ev->dur = (dur > UINT32_MAX) ? UINT32_MAX : dur;
+	ev->point = point;
+	ev->ret = ret;
+	ev->len = (len > UINT32_MAX) ? UINT32_MAX : len;
+	size_t name_len = strnlen(name, _IPCENG_TRACE_NAMELEN - 1);
+	memcpy(ev->name, name, name_len);
+	ev->name[name_len] = '\0';
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#define _IPCENG_TRACE_BEGIN(eng) \
+	uint64_t _trace_t0 = (eng)->has_trace ? _ipceng_now_ns() : 0
+#define _IPCENG_TRACE_END(eng, point, name, len, ret) \
+	do { if (_trace_t0) _ipceng_trace_rec(eng, point, name, len, ret, _trace_t0); } while (0)
+#else
+#define _IPCENG_TRACE_BEGIN(eng)						do { } while (0)
+#define _IPCENG_TRACE_END(eng, point, name, len, ret)	do { } while (0)
+#endif
+
+int ipceng_term(struct ipceng *eng)
+{
+	ipceng_dispatch_stop(eng);
+	if (ipceng_qdoor_close_all(eng) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_TERM, \
+			"terminating ipceng object failed: terminating qdoors failed");
+		return -1;
+	}
+	// channels are shared with other engines, so they are only detached here
+	struct chan *ch, *ch_n;
+	list_for_each_entry_safe(ch, ch_n, &eng->chan_list, _list) {
+		_ipceng_shm_free(&eng->mem, ch->sh);
+		_ipceng_free_safe(&eng->mem, ch->name);
+		_ipceng_free_safe(&eng->mem, ch);
+	}
+	// no thread may use eng anymore, so whatever is retired goes now
+	_ipceng_reclaim(eng, true);
+	struct ipceng_reader *r, *r_n;
+	for (r = eng->readers; r != NULL; r = r_n) {
+		r_n = r->next;
+		free(r);
+	}
+	if (_ipceng_rd_id == eng->id)
+		_ipceng_rd = NULL;
+	close(eng->epfd);
+	close(eng->dispatch_epfd);
+	close(eng->dispatch_evfd);
+	pthread_rwlock_destroy(&eng->dispatch_lock);
+	free_safe(eng->qdoor_htable);
+	free_safe(eng->shm_htable);
+	free_safe(eng->chan_htable);
+	free_safe(eng->qdoor_slots);
+	free_safe(eng->shm_slots);
+	free_safe(eng->chan_slots);
+	free_safe(eng->handlers);
+	free_safe(eng->name);
+	if (_ipceng_err_eng == eng)
+		_ipceng_err_eng = NULL;
+	// eng is gone, so there is no error state left to update
+	free_safe(eng);
+	return 0;
+}
+
+int ipceng_set_spin(struct ipceng *eng, unsigned int spin_count)
+{
+	eng->spin_count = spin_count;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_set_allocator(struct ipceng *eng, ipceng_alloc_fn alloc, ipceng_free_fn free_fn, void *ctx)
+{
+	if ((alloc == NULL) != (free_fn == NULL)) {
+		ipceng_set_error(eng, IPCENG_ERR_ALLOC, \
+			"failed to set allocator: alloc and free hooks go together");
+		return -1;
+	}
+
+	// whatever is allocated is freed by the allocator it is allocated by
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	if (eng->qdoor_count || eng->shm_count || eng->chan_count || !list_empty(&eng->retired)) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_ALLOC, \
+			"failed to set allocator: engine has qdoors, shms or channels");
+		return -1;
+	}
+	eng->mem.alloc = alloc;
+	eng->mem.free = free_fn;
+	eng->mem.ctx = ctx;
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_log_enable(struct ipceng *eng)
+{
+	eng->has_log = true;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_log_disable(struct ipceng *eng)
+{
+	eng->has_log = false;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_errno(struct ipceng *eng)
+{
+	return (_ipceng_err_eng == eng) ? _ipceng_err_code : IPCENG_ERR_NOERROR;
+}
+
+char *ipceng_errmsg(struct ipceng *eng)
+{
+	if (_ipceng_err_eng != eng)
+		return _ipceng_errmsg_table[-IPCENG_ERR_NOERROR];
+	return (char *)(_ipceng_err_msg ? _ipceng_err_msg : ipceng_strerror(_ipceng_err_code));
+}
+
+const char *ipceng_strerror(int code)
+{
+	if (code > 0)
+		return strerror(code);
+	if (-code < (int)(sizeof(_ipceng_errmsg_table) / sizeof(_ipceng_errmsg_table[0])) && \
+		_ipceng_errmsg_table[-code])
+		return _ipceng_errmsg_table[-code];
+	return "unknown error";
+}
+
+// giving a handle slot to qd and adding it into eng list and hash index
+static int _ipceng_qdoor_register(struct ipceng *eng, struct qdoor *qd)
+{
+	_ipceng_seq_write_begin(eng);
+	int slot = _ipceng_slot_alloc(eng, &eng->qdoor_slots, &eng->qdoor_nslots, \
+		&eng->qdoor_free_slot, qd);
+	if (slot >= 0) {
+		qd->slot = slot;
+		list_add_tail_rcu(&qd->_list, &eng->qdoor_list);
+		eng->qdoor_count++;
+		qd->_hnode.hash = _ipceng_hash(qd->name);
+		_ipceng_htable_add(eng, &eng->qdoor_htable, &eng->qdoor_hsize, eng->qdoor_count, \
+			&qd->_hnode);
+	}
+	_ipceng_seq_write_end(eng);
+	return (slot >= 0) ? 0 : -1;
+}
+
+// removing qd from eng; readers may still see it, so it has to be retired
+// rather than freed (see _ipceng_retire)
+static void _ipceng_qdoor_unregister(struct ipceng *eng, struct qdoor *qd)
+{
+	_ipceng_seq_write_begin(eng);
+	_ipceng_slot_free(eng->qdoor_slots, &eng->qdoor_free_slot, qd->slot);
+	list_del_rcu(&qd->_list);
+	hlist_del_rcu(&qd->_hnode.node);
+	eng->qdoor_count--;
+	_ipceng_seq_write_end(eng);
+}
+
+static int _ipceng_qdoor_add(struct ipceng *eng,
+	char *qdoor_name,
+	int msg_maxcount,
+	int msg_maxsize,
+	int timeout_send,
+	int timeout_recv)
+{
+	// qdoor should not be added already
+	if (_ipceng_qdoor_find(eng, qdoor_name) != NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: qdoor has been added already");
+		return -1;
+	}
+	
+	// check if target_msgmaxcount is greater than linux setting (/proc)
+	int target_msgmaxcount = (msg_maxcount == -1) ? IPCENG_DAFAULT_MSGCOUNT : msg_maxcount;
+	char *buff;
+	if (_read_procfile_oneline("/proc/sys/fs/mqueue/msg_max", &buff) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: can't read /proc/sys/fs/mqueue/msg_max");
+		return -1;
+	}
+	if (target_msgmaxcount > atoi(buff)) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: msg_maxcount is greater than linux setting /proc/sys/fs/mqueue/msg_max");
+		free_safe(buff);
+		return -1;
+	}
+	free_safe(buff);
+
+	// check if target_msgmaxsize is greater than linux setting (/proc)
+	int target_msgmaxsize = (msg_maxsize == -1) ? IPCENG_DAFAULT_MSGSIZE : msg_maxsize;
+	if (_read_procfile_oneline("/proc/sys/fs/mqueue/msgsize_max", &buff) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: can't read /proc/sys/fs/mqueue/msgsize_max");
+		return -1;
+	}
+	if (target_msgmaxsize > atoi(buff)) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: msg_maxcount is greater than linux setting /proc/sys/fs/mqueue/msgsize_max");
+		free_safe(buff);
+		return -1;
+	}
+	free_safe(buff);
+
+	// creating new_qdoor object
+	struct qdoor *new_qdoor = (struct qdoor *)_ipceng_zalloc(&eng->mem, sizeof(struct qdoor));
+	if (new_qdoor == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+	int mqnames_len = strlen("/2.mq") + strlen(eng->name) + strlen(qdoor_name) + 1;
+	new_qdoor->mem = &eng->mem;
+	new_qdoor->name = _ipceng_strdup(&eng->mem, qdoor_name);
+	new_qdoor->sendq.name = (char *)_ipceng_alloc(&eng->mem, mqnames_len);
+	new_qdoor->recvq.name = (char *)_ipceng_alloc(&eng->mem, mqnames_len);
+	if (new_qdoor->name == NULL || new_qdoor->sendq.name == NULL || new_qdoor->recvq.name == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+	new_qdoor->type = QDOOR_TYPE_MQ;
+	INIT_LIST_HEAD(&new_qdoor->stash);
+	pthread_mutex_init(&new_qdoor->batch_lock, NULL);
+	new_qdoor->sendr = NULL;
+	new_qdoor->recvr = NULL;
+	new_qdoor->on_msg = NULL;
+	new_qdoor->on_msg_ctx = NULL;
+	// filling sendq
+	sprintf(new_qdoor->sendq.name, "/%s2%s.mq", eng->name, qdoor_name);
+	new_qdoor->sendq.timeout = timeout_send;
+	new_qdoor->sendq.oflags = (timeout_send > 0) ? (O_CREAT | O_WRONLY) : \
+		(O_CREAT | O_WRONLY | O_NONBLOCK);
+	new_qdoor->sendq.attr.mq_flags = 0;
+	new_qdoor->sendq.attr.mq_maxmsg = target_msgmaxcount;
+	new_qdoor->sendq.attr.mq_msgsize = target_msgmaxsize;
+	new_qdoor->sendq.attr.mq_curmsgs = 0;
+	new_qdoor->sendq.mqd = mq_open(new_qdoor->sendq.name, new_qdoor->sendq.oflags, \
+		0664, &new_qdoor->sendq.attr);
+	if (new_qdoor->sendq.mqd == (mqd_t)-1) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: unable to open sending mq");
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+	// filling recvq
+	sprintf(new_qdoor->recvq.name, "/%s2%s.mq", qdoor_name, eng->name);
+	new_qdoor->recvq.timeout = timeout_recv;
+	new_qdoor->recvq.oflags = (timeout_recv > 0) ? (O_CREAT | O_RDONLY) : \
+		(O_CREAT | O_RDONLY | O_NONBLOCK);
+	new_qdoor->recvq.attr.mq_flags = 0;
+	new_qdoor->recvq.attr.mq_maxmsg = target_msgmaxcount;
+	new_qdoor->recvq.attr.mq_msgsize = target_msgmaxsize;
+	new_qdoor->recvq.attr.mq_curmsgs = 0;
+	new_qdoor->recvq.mqd = mq_open(new_qdoor->recvq.name, new_qdoor->recvq.oflags, \
+		0664, &new_qdoor->recvq.attr);
+	if (new_qdoor->recvq.mqd == (mqd_t)-1) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: unable to open receiving mq");
+		// if can't open recvq, then should remove sendq as well
+		mq_unlink(new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+	new_qdoor->sendq.state = IPC_STATE_OPENED;
+	new_qdoor->recvq.state = IPC_STATE_OPENED;
+	// adding new_qdoor into eng and watching its recvq
+	int registered = _ipceng_qdoor_register(eng, new_qdoor);
+	if (registered != 0 || _ipceng_qdoor_watch(eng, new_qdoor) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, (registered != 0) ? \
+			"failed to add qdoor: unable to allocate handle slot" : \
+			"failed to add qdoor: unable to watch receiving mq");
+		if (registered == 0)
+			_ipceng_qdoor_unregister(eng, new_qdoor);
+		mq_close(new_qdoor->sendq.mqd);
+		mq_close(new_qdoor->recvq.mqd);
+		mq_unlink(new_qdoor->sendq.name);
+		mq_unlink(new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+void _ipceng_qdoor_del_by_entry(struct ipceng *eng, struct qdoor *qd);
+
+// mapping the credit counters of the receiving direction of a just added
+// qdoor, so that it counts what it consumes as soon as the peer sets a window
+// (see ipceng_qdoor_set_credit); the qdoor is deleted again on failure
+static int _ipceng_qdoor_add_credit(struct ipceng *eng, char *qdoor_name)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (_ipceng_qdoor_map_credit(eng, qd, false) != 0) {
+		_ipceng_qdoor_del_by_entry(eng, qd);
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: unable to map credit counters");
+		return -1;
+	}
+	return 0;
+}
+
+static char *_ipceng_ring_errmsg[] = {
+	[SHM_STAGE_OPEN] = "failed to add qdoor: unable to open ring shm",
+	[SHM_STAGE_TRUNCATE] = "failed to add qdoor: unable to resize ring shm",
+	[SHM_STAGE_MMAP] = "failed to add qdoor: unable to map ring shm",
+};
+
+static int _ipceng_qdoor_add_ring(struct ipceng *eng,
+	char *qdoor_name,
+	long ring_size,
+	int timeout_send,
+	int timeout_recv)
+{
+	// qdoor should not be added already
+	if (_ipceng_qdoor_find(eng, qdoor_name) != NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: qdoor has been added already");
+		return -1;
+	}
+
+	// ring size is rounded up to a power of two
+	uint64_t target_size = IPCENG_RING_MINSIZE;
+	if (ring_size == -1)
+		ring_size = IPCENG_DEFAULT_RINGSIZE;
+	if (ring_size <= 0 || ring_size > IPCENG_RING_MAXSIZE) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, \
+			"failed to add qdoor: ring_size is out of range");
+		return -1;
+	}
+	while (target_size < ring_size)
+		target_size <<= 1;
+
+	struct qdoor *new_qdoor = (struct qdoor *)_ipceng_zalloc(&eng->mem, sizeof(struct qdoor));
+	if (new_qdoor == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+	int ringnames_len = strlen("/2.ring") + strlen(eng->name) + strlen(qdoor_name) + 1;
+	new_qdoor->mem = &eng->mem;
+	new_qdoor->name = _ipceng_strdup(&eng->mem, qdoor_name);
+	new_qdoor->sendq.name = (char *)_ipceng_alloc(&eng->mem, ringnames_len);
+	new_qdoor->recvq.name = (char *)_ipceng_alloc(&eng->mem, ringnames_len);
+	if (new_qdoor->name == NULL || new_qdoor->sendq.name == NULL || new_qdoor->recvq.name == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+	new_qdoor->type = QDOOR_TYPE_RING;
+	INIT_LIST_HEAD(&new_qdoor->stash);
+	pthread_mutex_init(&new_qdoor->batch_lock, NULL);
+	sprintf(new_qdoor->sendq.name, "/%s2%s.ring", eng->name, qdoor_name);
+	new_qdoor->sendq.timeout = timeout_send;
+	new_qdoor->sendq.attr.mq_msgsize = target_size / 2 - sizeof(struct ringrec);
+	sprintf(new_qdoor->recvq.name, "/%s2%s.ring", qdoor_name, eng->name);
+	new_qdoor->recvq.timeout = timeout_recv;
+	new_qdoor->recvq.attr.mq_msgsize = new_qdoor->sendq.attr.mq_msgsize;
+	new_qdoor->sendr = _ipceng_shm_new(&eng->mem, new_qdoor->sendq.name, new_qdoor->name, \
+		sizeof(struct ringhdr) + target_size);
+	new_qdoor->recvr = _ipceng_shm_new(&eng->mem, new_qdoor->recvq.name, new_qdoor->name, \
+		sizeof(struct ringhdr) + target_size);
+
+	if (!new_qdoor->sendr || !new_qdoor->recvr) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		if (new_qdoor->sendr)
+			_ipceng_shm_free(&eng->mem, new_qdoor->sendr);
+		if (new_qdoor->recvr)
+			_ipceng_shm_free(&eng->mem, new_qdoor->recvr);
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+
+	// mapping both rings through the shm machinery
+	enum shmstage stage = _ipceng_shm_map(new_qdoor->sendr);
+	if (stage == SHM_STAGE_DONE)
+		stage = _ipceng_shm_map(new_qdoor->recvr);
+	if (stage != SHM_STAGE_DONE || _ipceng_ring_init(new_qdoor->sendr, target_size) != 0 || \
+		_ipceng_ring_init(new_qdoor->recvr, target_size) != 0 || \
+		_ipceng_qdoor_register(eng, new_qdoor) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORADD, (stage != SHM_STAGE_DONE) ? \
+			_ipceng_ring_errmsg[stage] : \
+			"failed to add qdoor: ring size mismatch or out of handle slots");
+		_ipceng_shm_free(&eng->mem, new_qdoor->sendr);
+		_ipceng_shm_free(&eng->mem, new_qdoor->recvr);
+		_ipceng_free_safe(&eng->mem, new_qdoor->sendq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->recvq.name);
+		_ipceng_free_safe(&eng->mem, new_qdoor->name);
+		_ipceng_free_safe(&eng->mem, new_qdoor);
+		return -1;
+	}
+	new_qdoor->sendq.state = IPC_STATE_OPENED;
+	new_qdoor->recvq.state = IPC_STATE_OPENED;
+	new_qdoor->sendr_tail = __atomic_load_n(&((struct ringhdr *)new_qdoor->sendr->ptr)->tail, \
+		__ATOMIC_ACQUIRE);
+	new_qdoor->recvr_head = __atomic_load_n(&((struct ringhdr *)new_qdoor->recvr->ptr)->head, \
+		__ATOMIC_ACQUIRE);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_add_ring(struct ipceng *eng,
+	char *qdoor_name,
+	long ring_size,
+	int timeout_send,
+	int timeout_recv)
+{
+	_IPCENG_TRACE_BEGIN(eng);
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	int ret = _ipceng_qdoor_add_ring(eng, qdoor_name, ring_size, timeout_send, timeout_recv);
+	if (ret == 0)
+		ret = _ipceng_qdoor_add_credit(eng, qdoor_name);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	_IPCENG_TRACE_END(eng, TRACE_QDOOR_ADD, qdoor_name, 0, ret);
+	return ret;
+}
+
+int ipceng_qdoor_add(struct ipceng *eng,
+	char *qdoor_name,
+	int msg_maxcount,
+	int msg_maxsize,
+	int timeout_send,
+	int timeout_recv)
+{
+	_IPCENG_TRACE_BEGIN(eng);
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	int ret = _ipceng_qdoor_add(eng, qdoor_name, msg_maxcount, msg_maxsize, \
+		timeout_send, timeout_recv);
+	if (ret == 0)
+		ret = _ipceng_qdoor_add_credit(eng, qdoor_name);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	_IPCENG_TRACE_END(eng, TRACE_QDOOR_ADD, qdoor_name, 0, ret);
+	return ret;
+}
+
+static int _ipceng_qdoor_flush_batch(struct ipceng *eng, struct qdoor *qd,
+	const struct timespec *deadline);
+
+void _ipceng_qdoor_close_by_entry(struct ipceng *eng, struct qdoor *qd)
+{
+	// coalesced messages are sent if the peer has room for them, dropped
+	// otherwise; received ones not popped yet are dropped
+	if (qd->batch) {
+		struct timespec expired = {0, 0};
+		pthread_mutex_lock(&qd->batch_lock);
+		if (qd->sendq.state == IPC_STATE_OPENED)
+			_ipceng_qdoor_flush_batch(eng, qd, &expired);
+		qd->batch_len = sizeof(struct frame);
+		qd->batch_count = 0;
+		pthread_mutex_unlock(&qd->batch_lock);
+	}
+	qd->unbatch_len = 0;
+	// spill pools are mapped again by open (own pool) or by the next spilled
+	// message received (peer pool), credit counters by open; mappings are
+	// retired, as other threads may still be pushing/popping
+	_ipceng_qdoor_drop_views(qd);
+	if (qd->sendp)
+		_ipceng_shm_retire_map(eng, qd->sendp);
+	if (qd->recvp)
+		_ipceng_shm_retire_map(eng, qd->recvp);
+	if (qd->sendc)
+		_ipceng_shm_retire_map(eng, qd->sendc);
+	if (qd->recvc)
+		_ipceng_shm_retire_map(eng, qd->recvc);
+
+	if (qd->type == QDOOR_TYPE_RING) {
+		_ipceng_shm_retire_map(eng, qd->sendr);
+		_ipceng_shm_retire_map(eng, qd->recvr);
+		qd->sendq.state = IPC_STATE_CLOSED;
+		qd->recvq.state = IPC_STATE_CLOSED;
+		return;
+	}
+
 	if (qd->sendq.state != IPC_STATE_CLOSED) {
 		mq_close(qd->sendq.mqd);
 		qd->sendq.state = IPC_STATE_CLOSED;
 	}
-	if (qd->recvq.state != IPC_STATE_CLOSED) {
-		mq_close(qd->recvq.mqd);
-		qd->recvq.state = IPC_STATE_CLOSED;
+	if (qd->recvq.state != IPC_STATE_CLOSED) {
+		epoll_ctl(eng->epfd, EPOLL_CTL_DEL, qd->recvq.mqd, NULL);
+		if (qd->on_msg)
+			epoll_ctl(eng->dispatch_epfd, EPOLL_CTL_DEL, qd->recvq.mqd, NULL);
+		mq_close(qd->recvq.mqd);
+		qd->recvq.state = IPC_STATE_CLOSED;
+	}
+}
+
+// closing and freeing a retired qdoor
+static void _ipceng_qdoor_free(struct ipceng *eng, void *ptr)
+{
+	struct qdoor *qd = (struct qdoor *)ptr;
+	_ipceng_qdoor_close_by_entry(eng, qd);
+	if (qd->type == QDOOR_TYPE_RING) {
+		_ipceng_shm_free(qd->mem, qd->sendr);
+		_ipceng_shm_free(qd->mem, qd->recvr);
+	}
+	if (qd->sendp)
+		_ipceng_shm_free(qd->mem, qd->sendp);
+	if (qd->recvp)
+		_ipceng_shm_free(qd->mem, qd->recvp);
+	if (qd->sendc)
+		_ipceng_shm_free(qd->mem, qd->sendc);
+	if (qd->recvc)
+		_ipceng_shm_free(qd->mem, qd->recvc);
+	unsigned int i;
+	for (i = 0; i < qd->calls_size; i++)
+		_ipceng_dealloc(qd->mem, qd->calls[i].resp);
+	_ipceng_free_safe(qd->mem, qd->calls);
+	_ipceng_free_safe(qd->mem, qd->batch);
+	_ipceng_free_safe(qd->mem, qd->unbatch);
+	_ipceng_free_safe(qd->mem, qd->lz_buff);
+	_ipceng_free_safe(qd->mem, qd->lz_table);
+	_ipceng_free_safe(qd->mem, qd->unlz);
+	_ipceng_free_safe(qd->mem, qd->lat);
+	_ipceng_free_safe(qd->mem, qd->lent_buff);
+	_ipceng_free_safe(qd->mem, qd->rx_buff);
+	_ipceng_bufpool_free(qd->mem, qd->pool);
+	pthread_mutex_destroy(&qd->batch_lock);
+	_ipceng_free_safe(qd->mem, qd->sendq.name);
+	_ipceng_free_safe(qd->mem, qd->recvq.name);
+	_ipceng_free_safe(qd->mem, qd->name);
+	_ipceng_free_safe(qd->mem, qd);
+}
+
+// removing qd from eng and unlinking its queues; it stays open for threads
+// still using it until it is freed (see _ipceng_retire)
+void _ipceng_qdoor_del_by_entry(struct ipceng *eng, struct qdoor *qd)
+{
+	_IPCENG_TRACE_BEGIN(eng);
+	_ipceng_qdoor_unregister(eng, qd);
+	if (qd->type == QDOOR_TYPE_MQ && qd->recvq.state != IPC_STATE_CLOSED) {
+		epoll_ctl(eng->epfd, EPOLL_CTL_DEL, qd->recvq.mqd, NULL);
+		if (qd->on_msg)
+			epoll_ctl(eng->dispatch_epfd, EPOLL_CTL_DEL, qd->recvq.mqd, NULL);
+	}
+	if (qd->type == QDOOR_TYPE_RING) {
+		shm_unlink(qd->sendq.name);
+		shm_unlink(qd->recvq.name);
+	} else {
+		mq_unlink(qd->sendq.name);
+		mq_unlink(qd->recvq.name);
+	}
+	if (qd->sendp)
+		shm_unlink(qd->sendp->name);
+	if (qd->sendc)
+		shm_unlink(qd->sendc->name);
+	if (qd->recvc)
+		shm_unlink(qd->recvc->name);
+	if (qd->batch)
+		__atomic_sub_fetch(&eng->coalesce_count, 1, __ATOMIC_RELAXED);
+	_IPCENG_TRACE_END(eng, TRACE_QDOOR_DEL, qd->name, 0, 0);
+	_ipceng_retire(eng, qd, _ipceng_qdoor_free);
+}
+
+int ipceng_qdoor_del(struct ipceng *eng, char *qdoor_name)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd != NULL)
+		_ipceng_qdoor_del_by_entry(eng, qd);
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_del_all(struct ipceng *eng)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *iter, *iter_n;
+	list_for_each_entry_safe(iter, iter_n, &eng->qdoor_list, _list) {
+		_ipceng_qdoor_del_by_entry(eng, iter);
+	}
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static int _ipceng_qdoor_open(struct ipceng *eng, char *qdoor_name)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, "failed to open qdoor: qdoor not found");
+		return -1;
+	}
+
+	if (qd->sendp && qd->sendp->state != IPC_STATE_OPENED && \
+		_ipceng_shm_map(qd->sendp) != SHM_STAGE_DONE) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+			"failed to open qdoor: unable to map spill pool");
+		return -1;
+	}
+	if (_ipceng_qdoor_map_credit(eng, qd, false) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+			"failed to open qdoor: unable to map credit counters");
+		return -1;
+	}
+
+	if (qd->type == QDOOR_TYPE_RING) {
+		if (qd->sendr->state != IPC_STATE_OPENED && _ipceng_shm_map(qd->sendr) != SHM_STAGE_DONE) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+				"failed to open qdoor: unable to map sending ring");
+			return -1;
+		}
+		if (qd->recvr->state != IPC_STATE_OPENED && _ipceng_shm_map(qd->recvr) != SHM_STAGE_DONE) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+				"failed to open qdoor: unable to map receiving ring");
+			_ipceng_qdoor_close_by_entry(eng, qd);
+			return -1;
+		}
+		qd->sendq.state = IPC_STATE_OPENED;
+		qd->recvq.state = IPC_STATE_OPENED;
+		ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+		return 0;
+	}
+
+	if (qd->sendq.state != IPC_STATE_OPENED) {
+		qd->sendq.mqd = mq_open(qd->sendq.name, qd->sendq.oflags, \
+			0664, &qd->sendq.attr);
+		if (qd->sendq.mqd == (mqd_t)-1) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+				"failed to open qdoor: unable to open sending mq");
+			return -1;
+		}
+		qd->sendq.state = IPC_STATE_OPENED;
+	}
+	if (qd->recvq.state != IPC_STATE_OPENED) {
+		qd->recvq.mqd = mq_open(qd->recvq.name, qd->recvq.oflags, \
+			0664, &qd->recvq.attr);
+		if (qd->recvq.mqd == (mqd_t)-1) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+				"failed to open qdoor: unable to open receiving mq");
+			// should close sendq if recvq opening is failed as well
+			mq_close(qd->sendq.mqd);
+			qd->sendq.state = IPC_STATE_CLOSED;
+			return -1;
+		}
+		qd->recvq.state = IPC_STATE_OPENED;
+		if (_ipceng_qdoor_watch(eng, qd) != 0 || (qd->on_msg && \
+			_ipceng_qdoor_dispatch_arm(eng, qd, EPOLL_CTL_ADD) != 0)) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOOROPEN, \
+				"failed to open qdoor: unable to watch receiving mq");
+			_ipceng_qdoor_close_by_entry(eng, qd);
+			return -1;
+		}
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_open(struct ipceng *eng, char *qdoor_name)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	int ret = _ipceng_qdoor_open(eng, qdoor_name);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	return ret;
+}
+
+int ipceng_qdoor_close(struct ipceng *eng, char *qdoor_name)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd != NULL)
+		_ipceng_qdoor_close_by_entry(eng, qd);
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_close_all(struct ipceng *eng)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *iter;
+	list_for_each_entry(iter, &eng->qdoor_list, _list) {
+		_ipceng_qdoor_close_by_entry(eng, iter);
+	}
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// absolute deadline of an operation with timeout seconds; NULL if it should
+// not wait at all
+static inline struct timespec *_ipceng_deadline(int timeout, struct timespec *tm)
+{
+	if (timeout <= 0)
+		return NULL;
+	clock_gettime(CLOCK_REALTIME, tm);
+	tm->tv_sec += timeout;
+	return tm;
+}
+
+// absolute deadline of an operation with timeout_ms milliseconds; a negative
+// timeout is taken as (practically) no deadline
+static inline struct timespec *_ipceng_deadline_ms(int timeout_ms, struct timespec *tm)
+{
+	clock_gettime(CLOCK_REALTIME, tm);
+	if (timeout_ms < 0) {
+		tm->tv_sec += INT_MAX;
+		return tm;
+	}
+	tm->tv_sec += timeout_ms / 1000;
+	tm->tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (tm->tv_nsec >= 1000000000L) {
+		tm->tv_sec++;
+		tm->tv_nsec -= 1000000000L;
+	}
+	return tm;
+}
+
+// deadline of a mq operation; NULL if mq has no timeout (O_NONBLOCK mq)
+static inline struct timespec *_ipceng_mq_deadline(struct mqwrap *mq, struct timespec *tm)
+{
+	return _ipceng_deadline(mq->timeout, tm);
+}
+
+static inline int _ipceng_mq_send(struct mqwrap *mq, const void *data, size_t len,
+	int prio, const struct timespec *deadline)
+{
+	if (deadline)
+		return mq_timedsend(mq->mqd, data, len, prio, deadline);
+	return mq_send(mq->mqd, data, len, prio);
+}
+
+static inline ssize_t _ipceng_mq_recv(struct mqwrap *mq, void *buff, size_t cap,
+	int *prio, const struct timespec *deadline)
+{
+	if (deadline)
+		return mq_timedreceive(mq->mqd, buff, cap, (unsigned int *)prio, deadline);
+	return mq_receive(mq->mqd, buff, cap, (unsigned int *)prio);
+}
+
+// transport level send/receive of a qdoor; errno is set on failure
+static inline int _ipceng_qdoor_xmit(struct ipceng *eng, struct qdoor *qd, const void *data,
+	size_t len, int prio, const struct timespec *deadline)
+{
+	int ret;
+	if (qd->type == QDOOR_TYPE_RING)
+		ret = _ipceng_ring_send(qd, data, len, prio, deadline, eng->spin_count);
+	else
+		ret = _ipceng_mq_send(&qd->sendq, data, len, prio, deadline);
+	if (ret == 0 && qd->credit_window && qd->sendc && qd->sendc->state == IPC_STATE_OPENED)
+		__atomic_add_fetch(&((struct credithdr *)qd->sendc->ptr)->sent, 1, __ATOMIC_RELAXED);
+	return ret;
+}
+
+static inline ssize_t _ipceng_qdoor_xrecv(struct ipceng *eng, struct qdoor *qd, void *buff,
+	size_t cap, int *prio, const struct timespec *deadline)
+{
+	if (qd->type == QDOOR_TYPE_RING)
+		return _ipceng_ring_recv(qd, buff, cap, prio, deadline, eng->spin_count);
+	return _ipceng_mq_recv(&qd->recvq, buff, cap, prio, deadline);
+}
+
+// microseconds left until the batch of qd is due
+static inline long long _ipceng_qdoor_batch_left(struct qdoor *qd)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)(qd->batch_due.tv_sec - now.tv_sec) * 1000000 + \
+		(qd->batch_due.tv_nsec - now.tv_nsec) / 1000;
+}
+
+// sending the messages coalesced in qd as one FRAME_KIND_BATCH message; they
+// are kept on failure, for a later flush; batch_lock is held by the caller
+static int _ipceng_qdoor_flush_batch(struct ipceng *eng, struct qdoor *qd,
+	const struct timespec *deadline)
+{
+	if (qd->batch_count == 0)
+		return 0;
+	struct frame fr = {_IPCENG_FRAME_MAGIC, FRAME_KIND_BATCH, qd->stamp ? FRAME_FLAG_STAMP : 0, 0, \
+		qd->batch_len - sizeof(fr), qd->batch_count};
+	memcpy(qd->batch, &fr, sizeof(fr));
+	if (_ipceng_qdoor_xmit(eng, qd, qd->batch, qd->batch_len, qd->batch_prio, deadline) != 0)
+		return -1;
+	qd->batch_len = sizeof(fr);
+	qd->batch_count = 0;
+	return 0;
+}
+
+// _ipceng_qdoor_flush_batch taking batch_lock
+static int _ipceng_qdoor_flush_sync(struct ipceng *eng, struct qdoor *qd,
+	const struct timespec *deadline)
+{
+	if (qd->batch == NULL)
+		return 0;
+	pthread_mutex_lock(&qd->batch_lock);
+	int ret = _ipceng_qdoor_flush_batch(eng, qd, deadline);
+	pthread_mutex_unlock(&qd->batch_lock);
+	return ret;
+}
+
+// coalescing one small message into the batch of qd; the batch is sent first
+// if the message does not fit in it or has another priority; batch_lock is
+// held by the caller
+static int _ipceng_qdoor_batch_msg(struct ipceng *eng, struct qdoor *qd, const void *data,
+	size_t len, int prio, uint8_t flags, const struct timespec *deadline)
+{
+	uint32_t rec_len = len | ((flags & FRAME_FLAG_TYPED) ? _IPCENG_BATCH_TYPED : 0);
+	size_t rec_hdr = sizeof(rec_len) + _ipceng_stamp_len(qd);
+	if (qd->batch_count > 0 && (prio != qd->batch_prio || \
+		qd->batch_len + rec_hdr + len > qd->coalesce_bytes) && \
+		_ipceng_qdoor_flush_batch(eng, qd, deadline) != 0)
+		return -1;
+	if (qd->batch_count == 0) {
+		qd->batch_prio = prio;
+		if (qd->coalesce_usecs) {
+			clock_gettime(CLOCK_MONOTONIC, &qd->batch_due);
+			qd->batch_due.tv_sec += qd->coalesce_usecs / 1000000;
+			qd->batch_due.tv_nsec += (qd->coalesce_usecs % 1000000) * 1000L;
+			if (qd->batch_due.tv_nsec >= 1000000000L) {
+				qd->batch_due.tv_sec++;
+				qd->batch_due.tv_nsec -= 1000000000L;
+			}
+		}
+	}
+	memcpy(qd->batch + qd->batch_len, &rec_len, sizeof(rec_len));
+	if (qd->stamp) {
+		uint64_t stamp = _ipceng_now_ns();
+		memcpy(qd->batch + qd->batch_len + sizeof(rec_len), &stamp, sizeof(stamp));
+	}
+	memcpy(qd->batch + qd->batch_len + rec_hdr, data, len);
+	qd->batch_len += rec_hdr + len;
+	qd->batch_count++;
+
+	// the message is taken already, so a failed flush is just retried later
+	if ((qd->coalesce_msgs && qd->batch_count >= qd->coalesce_msgs) || \
+		qd->batch_len + rec_hdr >= qd->coalesce_bytes || \
+		(qd->coalesce_usecs && _ipceng_qdoor_batch_left(qd) <= 0))
+		_ipceng_qdoor_flush_batch(eng, qd, deadline);
+	return 0;
+}
+
+// handing a filled slot of the pool of qd to the peer
+static inline int _ipceng_qdoor_xmit_slot(struct ipceng *eng, struct qdoor *qd, int slot,
+	size_t len, int prio, uint8_t flags, const struct timespec *deadline)
+{
+	struct frame fr = {_IPCENG_FRAME_MAGIC, FRAME_KIND_SPILL, flags, 0, len, slot};
+	char wire[sizeof(fr) + sizeof(uint64_t)];
+	// coalesced messages go first, to keep the order
+	if (_ipceng_qdoor_flush_sync(eng, qd, deadline) != 0)
+		return -1;
+	memcpy(wire, &fr, sizeof(fr));
+	if (!(flags & FRAME_FLAG_STAMP))
+		return _ipceng_qdoor_xmit(eng, qd, wire, sizeof(fr), prio, deadline);
+	uint64_t stamp = _ipceng_now_ns();
+	memcpy(wire + sizeof(fr), &stamp, sizeof(stamp));
+	return _ipceng_qdoor_xmit(eng, qd, wire, sizeof(wire), prio, deadline);
+}
+
+// sending a frame of kind with len bytes of data as payload through qd
+static int _ipceng_qdoor_xmit_frame(struct ipceng *eng, struct qdoor *qd, uint8_t kind,
+	uint8_t flags, uint32_t aux, const void *data, size_t len, int prio,
+	const struct timespec *deadline)
+{
+	struct frame fr = {_IPCENG_FRAME_MAGIC, kind, flags, 0, len, aux};
+	size_t hdr_len = sizeof(fr) + ((flags & FRAME_FLAG_STAMP) ? sizeof(uint64_t) : 0);
+	char stack_buff[256];
+	char *framed = stack_buff;
+	if (_ipceng_qdoor_flush_sync(eng, qd, deadline) != 0)
+		return -1;
+	if (hdr_len + len > sizeof(stack_buff)) {
+		framed = (char *)_ipceng_alloc(qd->mem, hdr_len + len);
+		if (framed == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	memcpy(framed, &fr, sizeof(fr));
+	if (flags & FRAME_FLAG_STAMP) {
+		uint64_t stamp = _ipceng_now_ns();
+		memcpy(framed + sizeof(fr), &stamp, sizeof(stamp));
+	}
+	memcpy(framed + hdr_len, data, len);
+	int ret = _ipceng_qdoor_xmit(eng, qd, framed, hdr_len + len, prio, deadline);
+	if (framed != stack_buff) {
+		int err = errno;
+		_ipceng_dealloc(qd->mem, framed);
+		errno = err;
+	}
+	return ret;
+}
+
+// sending one user message through qd; it is spilled into the pool if it is
+// above the spill threshold and framed if it could be mistaken for a frame or
+// has flags (FRAME_FLAG_TYPED, FRAME_FLAG_STAMP) to carry
+static int _ipceng_qdoor_xmit_msg(struct ipceng *eng, struct qdoor *qd, const void *data,
+	size_t len, int prio, uint8_t flags, const struct timespec *deadline)
+{
+	if (qd->stamp)
+		flags |= FRAME_FLAG_STAMP;
+	if (qd->batch) {
+		pthread_mutex_lock(&qd->batch_lock);
+		int ret;
+		if (qd->batch && sizeof(struct frame) + sizeof(uint32_t) + _ipceng_stamp_len(qd) + len <= \
+			qd->coalesce_bytes && \
+			!(qd->sendp && len > qd->spill_threshold)) {
+			ret = _ipceng_qdoor_batch_msg(eng, qd, data, len, prio, flags, deadline);
+			pthread_mutex_unlock(&qd->batch_lock);
+			return ret;
+		}
+		ret = qd->batch ? _ipceng_qdoor_flush_batch(eng, qd, deadline) : 0;
+		pthread_mutex_unlock(&qd->batch_lock);
+		if (ret != 0)
+			return -1;
+	}
+	if (qd->sendp && len > qd->spill_threshold) {
+		struct poolhdr *hdr = (struct poolhdr *)qd->sendp->ptr;
+		if (qd->sendp->state != IPC_STATE_OPENED || len > hdr->slot_size) {
+			errno = (qd->sendp->state != IPC_STATE_OPENED) ? EBADF : EMSGSIZE;
+			return -1;
+		}
+		int slot = _ipceng_pool_alloc(qd, deadline, eng->spin_count);
+		if (slot < 0)
+			return -1;
+		memcpy(_ipceng_pool_slot(hdr, slot), data, len);
+		if (_ipceng_qdoor_xmit_slot(eng, qd, slot, len, prio, flags, deadline) != 0) {
+			int err = errno;
+			_ipceng_pool_free(qd->sendp, slot);
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+	size_t lz_hdr = sizeof(struct frame) + _ipceng_stamp_len(qd);
+	if (qd->lz_threshold && len > qd->lz_threshold && len > lz_hdr && len <= _IPCENG_LZ_MAXLEN) {
+		// kept only if it is smaller and fits in one qdoor message
+		struct frame fr = {_IPCENG_FRAME_MAGIC, FRAME_KIND_RAW, FRAME_FLAG_LZ | flags, 0, len, 0};
+		size_t lz_len = _ipceng_lz_compress((const uint8_t *)data, len, qd->lz_buff + lz_hdr, \
+			((len < (size_t)qd->sendq.attr.mq_msgsize) ? len : qd->sendq.attr.mq_msgsize) - lz_hdr, \
+			qd->lz_table);
+		if (lz_len > 0) {
+			memcpy(qd->lz_buff, &fr, sizeof(fr));
+			if (qd->stamp) {
+				uint64_t stamp = _ipceng_now_ns();
+				memcpy(qd->lz_buff + sizeof(fr), &stamp, sizeof(stamp));
+			}
+			return _ipceng_qdoor_xmit(eng, qd, qd->lz_buff, lz_hdr + lz_len, prio, deadline);
+		}
+	}
+	if (flags == 0 && !_ipceng_is_frame(data, len))
+		return _ipceng_qdoor_xmit(eng, qd, data, len, prio, deadline);
+	return _ipceng_qdoor_xmit_frame(eng, qd, FRAME_KIND_RAW, flags, 0, data, len, prio, deadline);
+}
+
+// attaching the spill pool of the peer of qd
+static int _ipceng_qdoor_attach_pool(struct ipceng *eng, struct qdoor *qd)
+{
+	if (qd->recvp == NULL) {
+		int poolname_len = strlen("/2.pool") + strlen(eng->name) + strlen(qd->name) + 1;
+		char poolname[poolname_len];
+		sprintf(poolname, "/%s2%s.pool", qd->name, eng->name);
+		qd->recvp = _ipceng_shm_new(qd->mem, poolname, qd->name, 0);
+		if (qd->recvp == NULL)
+			return -1;
+		qd->recvp->oflag = O_RDWR;
+	}
+	if (qd->recvp->state != IPC_STATE_OPENED) {
+		qd->recvp->size = 0;
+		if (_ipceng_shm_map(qd->recvp) != SHM_STAGE_DONE)
+			return -1;
+		if (__atomic_load_n(&((struct poolhdr *)qd->recvp->ptr)->magic, __ATOMIC_ACQUIRE) != \
+			_IPCENG_POOL_MAGIC || qd->recvp->size < _ipceng_pool_size( \
+			((struct poolhdr *)qd->recvp->ptr)->slot_size, \
+			((struct poolhdr *)qd->recvp->ptr)->slot_count)) {
+			_ipceng_shm_unmap(qd->recvp);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// next message of the received batch of qd as a view; -1 if there is none
+static int _ipceng_qdoor_unbatch(struct qdoor *qd, struct msgview *view)
+{
+	uint32_t rec_len;
+	size_t rec_hdr = sizeof(rec_len) + (qd->unbatch_stamp ? sizeof(uint64_t) : 0);
+	if (qd->unbatch_off + rec_hdr > qd->unbatch_len)
+		return -1;
+	memcpy(&rec_len, qd->unbatch + qd->unbatch_off, sizeof(rec_len));
+	view->flags = (rec_len & _IPCENG_BATCH_TYPED) ? FRAME_FLAG_TYPED : 0;
+	rec_len &= ~_IPCENG_BATCH_TYPED;
+	if (rec_len > qd->unbatch_len - qd->unbatch_off - rec_hdr) {
+		// malformed; the rest of the batch is dropped
+		qd->unbatch_len = 0;
+		return -1;
+	}
+	view->stamp = 0;
+	if (qd->unbatch_stamp)
+		memcpy(&view->stamp, qd->unbatch + qd->unbatch_off + sizeof(rec_len), sizeof(view->stamp));
+	view->data = qd->unbatch + qd->unbatch_off + rec_hdr;
+	view->len = rec_len;
+	view->prio = qd->unbatch_prio;
+	view->slot = -1;
+	view->owned = NULL;
+	view->kind = 0;
+	view->call_id = 0;
+	qd->unbatch_off += rec_hdr + rec_len;
+	return 0;
+}
+
+// decoding a message of len bytes received into buff
+static int _ipceng_qdoor_decode(struct ipceng *eng, struct qdoor *qd, void *buff,
+	size_t len, int prio, struct msgview *view)
+{
+	struct frame fr;
+	view->data = buff;
+	view->len = len;
+	view->prio = prio;
+	view->slot = -1;
+	view->owned = NULL;
+	view->kind = 0;
+	view->flags = 0;
+	view->call_id = 0;
+	view->stamp = 0;
+	if (!_ipceng_is_frame(buff, len))
+		return 0;
+
+	memcpy(&fr, buff, sizeof(fr));
+	size_t hdr_len = sizeof(fr);
+	if (fr.kind == FRAME_KIND_RAW || fr.kind == FRAME_KIND_SPILL) {
+		view->flags = fr.flags & FRAME_FLAG_TYPED;
+		if (fr.flags & FRAME_FLAG_STAMP) {
+			if (len < sizeof(fr) + sizeof(view->stamp)) {
+				errno = EBADMSG;
+				return -1;
+			}
+			memcpy(&view->stamp, (char *)buff + sizeof(fr), sizeof(view->stamp));
+			hdr_len += sizeof(view->stamp);
+		}
+	}
+	if (fr.kind == FRAME_KIND_RAW && (fr.flags & FRAME_FLAG_LZ)) {
+		if (fr.len > _IPCENG_LZ_MAXLEN) {
+			errno = EBADMSG;
+			return -1;
+		}
+		if (qd->unlz_cap < fr.len) {
+			// nothing is kept in it between messages
+			_ipceng_dealloc(qd->mem, qd->unlz);
+			qd->unlz_cap = 0;
+			qd->unlz = (uint8_t *)_ipceng_alloc(qd->mem, fr.len);
+			if (qd->unlz == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+			qd->unlz_cap = fr.len;
+		}
+		if (_ipceng_lz_decompress((uint8_t *)buff + hdr_len, len - hdr_len, qd->unlz, \
+			fr.len) != fr.len) {
+			errno = EBADMSG;
+			return -1;
+		}
+		view->data = qd->unlz;
+		view->len = fr.len;
+		return 0;
+	}
+	if ((fr.kind == FRAME_KIND_RAW || fr.kind == FRAME_KIND_REQUEST || \
+		fr.kind == FRAME_KIND_REPLY) && fr.len <= len - hdr_len) {
+		view->data = (char *)buff + hdr_len;
+		view->len = fr.len;
+		if (fr.kind != FRAME_KIND_RAW) {
+			view->kind = fr.kind;
+			view->call_id = fr.aux;
+		}
+		return 0;
+	}
+	if (fr.kind == FRAME_KIND_SPILL) {
+		if (_ipceng_qdoor_attach_pool(eng, qd) != 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		struct poolhdr *hdr = (struct poolhdr *)qd->recvp->ptr;
+		if (fr.aux < hdr->slot_count && fr.len <= hdr->slot_size) {
+			view->data = _ipceng_pool_slot(hdr, fr.aux);
+			view->len = fr.len;
+			view->slot = fr.aux;
+			return 0;
+		}
+	}
+	if (fr.kind == FRAME_KIND_BATCH && fr.len <= len - sizeof(fr)) {
+		// the batch is moved out of buff, which may be overwritten by the
+		// caller before the batch is fully unpacked
+		if (qd->unbatch == NULL) {
+			qd->unbatch = (char *)_ipceng_alloc(qd->mem, qd->recvq.attr.mq_msgsize);
+			if (qd->unbatch == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		memcpy(qd->unbatch, (char *)buff + sizeof(fr), fr.len);
+		qd->unbatch_len = fr.len;
+		qd->unbatch_off = 0;
+		qd->unbatch_prio = prio;
+		qd->unbatch_stamp = (fr.flags & FRAME_FLAG_STAMP) != 0;
+		if (_ipceng_qdoor_unbatch(qd, view) == 0)
+			return 0;
+	}
+	errno = EBADMSG;
+	return -1;
+}
+
+// receiving one message of qd from the transport into buff (cap bytes) as a
+// view, unless a received batch is being unpacked; an O_NONBLOCK mq is polled
+// until deadline, if there is one
+static int _ipceng_qdoor_recv_wire(struct ipceng *eng, struct qdoor *qd, void *buff,
+	size_t cap, const struct timespec *deadline, struct msgview *view)
+{
+	if (_ipceng_qdoor_unbatch(qd, view) == 0)
+		return 0;
+	int prio = 0;
+	while (1) {
+		ssize_t len = _ipceng_qdoor_xrecv(eng, qd, buff, cap, &prio, deadline);
+		if (len >= 0) {
+			_ipceng_credit_consumed(qd);
+			return _ipceng_qdoor_decode(eng, qd, buff, len, prio, view);
+		}
+		if (errno != EAGAIN || qd->type != QDOOR_TYPE_MQ || deadline == NULL)
+			return -1;
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		long long ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000 + \
+			(deadline->tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		struct pollfd pfd = {qd->recvq.mqd, POLLIN, 0};
+		if (poll(&pfd, 1, (ms > INT_MAX) ? INT_MAX : (int)ms) < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+static int _ipceng_call_complete(struct ipceng *eng, struct qdoor *qd, struct msgview *view);
+
+// receive buffer of calls and taken messages of qd, allocated on first use
+static inline char *_ipceng_qdoor_rx_buff(struct qdoor *qd)
+{
+	if (qd->rx_buff == NULL)
+		qd->rx_buff = (char *)_ipceng_alloc(qd->mem, qd->recvq.attr.mq_msgsize);
+	return qd->rx_buff;
+}
+
+// receiving one message of qd into buff (cap bytes) as a view; stashed
+// messages are returned first and call replies are consumed on the way
+static int _ipceng_qdoor_recv_view(struct ipceng *eng, struct qdoor *qd, void *buff,
+	size_t cap, const struct timespec *deadline, struct msgview *view)
+{
+	if (!list_empty(&qd->stash)) {
+		struct stashmsg *sm = list_first_entry(&qd->stash, struct stashmsg, _list);
+		list_del(&sm->_list);
+		*view = sm->view;
+		_ipceng_dealloc(qd->mem, sm);
+		// stashed while waiting for a reply, not recorded yet
+		if (qd->stamp)
+			_ipceng_lat_record(qd->lat, view->stamp);
+		view->stamp = 0;
+		return 0;
+	}
+	while (1) {
+		// counted once, as they come in; stashed ones are not counted again
+		_IPCENG_TRACE_BEGIN(eng);
+		int ret = _ipceng_qdoor_recv_wire(eng, qd, buff, cap, deadline, view);
+		_IPCENG_TRACE_END(eng, TRACE_QDOOR_POP, qd->name, ret ? 0 : view->len, ret);
+		if (ret != 0 || view->kind != FRAME_KIND_REPLY)
+			_ipceng_stat_io(&qd->stats.rx, ret, ret ? 0 : view->len, false);
+		if (ret != 0)
+			return -1;
+		if (qd->stamp)
+			_ipceng_lat_record(qd->lat, view->stamp);
+		view->stamp = 0;
+		if (view->kind != FRAME_KIND_REPLY)
+			return 0;
+		_ipceng_call_complete(eng, qd, view);
+	}
+}
+
+// copying a view into buff (cap bytes) and releasing it; a message which does
+// not fit is stashed for the next pop
+static ssize_t _ipceng_qdoor_view_copy(struct qdoor *qd, struct msgview *view, void *buff,
+	size_t cap)
+{
+	if (view->len > cap) {
+		if (_ipceng_qdoor_stash(qd, view, true) != 0)
+			_ipceng_qdoor_view_release(qd, view);
+		errno = EMSGSIZE;
+		return -1;
+	}
+	size_t len = view->len;
+	if (view->data != buff)
+		memmove(buff, view->data, len);
+	_ipceng_qdoor_view_release(qd, view);
+	return len;
+}
+
+// sending len bytes of data into qd as one message
+static int _ipceng_qdoor_send_entry(struct ipceng *eng, struct qdoor *qd, const void *data,
+	size_t len, int prio, uint8_t flags)
+{
+	// check for prio range
+	if (!(prio >= IPCENG_PRIO_MIN && prio <= IPCENG_PRIO_MAX)) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, \
+			"failed to push into qdoor: out of range priority");
+		return -1;
+	}
+
+	struct timespec tm;
+	_IPCENG_TRACE_BEGIN(eng);
+	int ret = _ipceng_qdoor_xmit_msg(eng, qd, data, len, prio, flags, _ipceng_mq_deadline(&qd->sendq, &tm));
+	_IPCENG_TRACE_END(eng, TRACE_QDOOR_PUSH, qd->name, len, ret);
+	_ipceng_stat_io(&qd->stats.tx, ret, len, false);
+	if (ret != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static inline int _ipceng_qdoor_push_entry(struct ipceng *eng, struct qdoor *qd, char *msg, int prio)
+{
+	return _ipceng_qdoor_send_entry(eng, qd, msg, strlen(msg)+1, prio, 0);
+}
+
+int ipceng_qdoor_push(struct ipceng *eng, char *qdoor_name, char *msg, int prio)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, "failed to push into qdoor: qdoor not found");
+		return -1;
+	}
+
+	return _ipceng_qdoor_push_entry(eng, qd, msg, prio);
+}
+
+int ipceng_qdoor_push_h(struct ipceng *eng, ipceng_qdoor_t qd, char *msg, int prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, "failed to push into qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	return _ipceng_qdoor_push_entry(eng, entry, msg, prio);
+}
+
+// receiving one message of qd into buff (cap bytes); returns received length
+static ssize_t _ipceng_qdoor_recv_entry(struct ipceng *eng, struct qdoor *qd, void *buff,
+	size_t cap, int *prio, uint32_t *call_id)
+{
+	if (cap < qd->recvq.attr.mq_msgsize) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, \
+			"failed to pop from qdoor: buffer is smaller than qdoor message size");
+		return -1;
+	}
+
+	struct timespec tm;
+	struct msgview view;
+	ssize_t len = -1;
+	if (_ipceng_qdoor_recv_view(eng, qd, buff, cap, _ipceng_mq_deadline(&qd->recvq, &tm), \
+		&view) == 0) {
+		if (prio)
+			*prio = view.prio;
+		if (call_id)
+			*call_id = (view.kind == FRAME_KIND_REQUEST) ? view.call_id : 0;
+		len = _ipceng_qdoor_view_copy(qd, &view, buff, cap);
+	}
+	if (len < 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return len;
+}
+
+int ipceng_qdoor_push_bin(struct ipceng *eng, ipceng_qdoor_t qd, const void *data, size_t len, int prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, "failed to push into qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	return _ipceng_qdoor_send_entry(eng, entry, data, len, prio, 0);
+}
+
+static int _ipceng_qdoor_pop_entry(struct ipceng *eng, struct qdoor *qd, char **buff, int *prio)
+{
+	*buff = _ipceng_buf_get(qd);
+	if (*buff == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+	struct timespec tm;
+	struct msgview view;
+	if (_ipceng_qdoor_recv_view(eng, qd, *buff, qd->recvq.attr.mq_msgsize, \
+		_ipceng_mq_deadline(&qd->recvq, &tm), &view) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		_ipceng_buf_put(qd, *buff);
+		*buff = NULL;
+		return -1;
+	}
+	if (prio)
+		*prio = view.prio;
+	// spilled messages are copied out of the pool once, into a buffer of their size
+	if (view.len >= qd->recvq.attr.mq_msgsize) {
+		char *big = (char *)_ipceng_alloc(qd->mem, view.len + 1);
+		if (big == NULL) {
+			if (_ipceng_qdoor_stash(qd, &view, true) != 0)
+				_ipceng_qdoor_view_release(qd, &view);
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			_ipceng_buf_put(qd, *buff);
+			*buff = NULL;
+			return -1;
+		}
+		_ipceng_buf_put(qd, *buff);
+		*buff = big;
+	}
+	// messages are handed out as strings as well
+	(*buff)[view.len] = 0;
+	_ipceng_qdoor_view_copy(qd, &view, *buff, view.len);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_pop(struct ipceng *eng, char *qdoor_name, char **buff, int *prio)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: qdoor not found");
+		return -1;
+	}
+
+	return _ipceng_qdoor_pop_entry(eng, qd, buff, prio);
+}
+
+int ipceng_qdoor_pop_h(struct ipceng *eng, ipceng_qdoor_t qd, char **buff, int *prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	return _ipceng_qdoor_pop_entry(eng, entry, buff, prio);
+}
+
+int ipceng_qdoor_set_pool(struct ipceng *eng, ipceng_qdoor_t qd, unsigned int blocks)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_ALLOC, "failed to set buffer pool: invalid qdoor handle");
+		return -1;
+	}
+	if (entry->pool && __atomic_load_n(&entry->pool->used, __ATOMIC_RELAXED) > 0) {
+		ipceng_set_error(eng, IPCENG_ERR_ALLOC, \
+			"failed to set buffer pool: buffers of the pool are not released yet");
+		return -1;
+	}
+
+	struct bufpool *pool = NULL;
+	if (blocks > 0) {
+		pool = _ipceng_bufpool_new(entry->mem, entry->recvq.attr.mq_msgsize + 1, blocks);
+		if (pool == NULL) {
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+	}
+	_ipceng_bufpool_free(entry->mem, entry->pool);
+	entry->pool = pool;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_buf_release(struct ipceng *eng, ipceng_qdoor_t qd, void *buff)
+{
+	if (qd == IPCENG_HANDLE_INVALID) {
+		_ipceng_dealloc(&eng->mem, buff);
+		ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+		return 0;
+	}
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_ALLOC, "failed to release buffer: invalid qdoor handle");
+		return -1;
+	}
+
+	if (buff != NULL)
+		_ipceng_buf_put(entry, buff);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_pop_into(struct ipceng *eng, ipceng_qdoor_t qd, void *buff, size_t cap,
+	size_t *len, int *prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	ssize_t ret = _ipceng_qdoor_recv_entry(eng, entry, buff, cap, prio, NULL);
+	if (ret < 0)
+		return -1;
+	if (len)
+		*len = ret;
+	return 0;
+}
+
+int ipceng_qdoor_pushv(struct ipceng *eng, ipceng_qdoor_t qd, struct ipceng_msgv *msgv, int count)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, "failed to push into qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	// one deadline for the whole batch
+	struct timespec tm;
+	struct timespec *deadline = _ipceng_mq_deadline(&entry->sendq, &tm);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (!(msgv[i].prio >= IPCENG_PRIO_MIN && msgv[i].prio <= IPCENG_PRIO_MAX)) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, \
+				"failed to push into qdoor: out of range priority");
+			break;
+		}
+		_IPCENG_TRACE_BEGIN(eng);
+		int ret = _ipceng_qdoor_xmit_msg(eng, entry, msgv[i].buff, msgv[i].len, msgv[i].prio, 0, \
+			deadline);
+		_IPCENG_TRACE_END(eng, TRACE_QDOOR_PUSH, entry->name, msgv[i].len, ret);
+		_ipceng_stat_io(&entry->stats.tx, ret, msgv[i].len, false);
+		if (ret != 0) {
+			ipceng_set_error(eng, errno, strerror(errno));
+			break;
+		}
+	}
+	if (i == 0 && count > 0)
+		return -1;
+
+	if (i == count)
+		ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return i;
+}
+
+int ipceng_qdoor_popv(struct ipceng *eng, ipceng_qdoor_t qd, struct ipceng_msgv *msgv, int count)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	// waiting (up to qdoor timeout) just for the first message; the rest of
+	// the batch is whatever is already pending, so an expired deadline is
+	// used for them (O_NONBLOCK qdoors never wait anyway)
+	struct timespec tm, expired = {0, 0};
+	struct timespec *deadline = _ipceng_mq_deadline(&entry->recvq, &tm);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (msgv[i].cap < entry->recvq.attr.mq_msgsize) {
+			ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, \
+				"failed to pop from qdoor: buffer is smaller than qdoor message size");
+			break;
+		}
+		struct msgview view;
+		ssize_t len = -1;
+		if (_ipceng_qdoor_recv_view(eng, entry, msgv[i].buff, msgv[i].cap, deadline, &view) == 0) {
+			msgv[i].prio = view.prio;
+			len = _ipceng_qdoor_view_copy(entry, &view, msgv[i].buff, msgv[i].cap);
+		}
+		if (len < 0) {
+			ipceng_set_error(eng, errno, strerror(errno));
+			break;
+		}
+		msgv[i].len = len;
+		if (deadline)
+			deadline = &expired;
+	}
+	if (i == 0 && count > 0)
+		return -1;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return i;
+}
+
+int ipceng_qdoor_pop_view(struct ipceng *eng, ipceng_qdoor_t qd, const void **data,
+	size_t *len, int *prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	// previous view is released implicitly
+	if (entry->lent.data)
+		_ipceng_qdoor_view_release(entry, &entry->lent);
+	if (entry->lent_buff == NULL) {
+		entry->lent_buff = (char *)_ipceng_alloc(entry->mem, entry->recvq.attr.mq_msgsize);
+		if (entry->lent_buff == NULL) {
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+	}
+	struct timespec tm;
+	if (_ipceng_qdoor_recv_view(eng, entry, entry->lent_buff, entry->recvq.attr.mq_msgsize, \
+		_ipceng_mq_deadline(&entry->recvq, &tm), &entry->lent) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	*data = entry->lent.data;
+	if (len)
+		*len = entry->lent.len;
+	if (prio)
+		*prio = entry->lent.prio;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_release(struct ipceng *eng, ipceng_qdoor_t qd)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to release message: invalid qdoor handle");
+		return -1;
+	}
+	if (entry->lent.data)
+		_ipceng_qdoor_view_release(entry, &entry->lent);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static int _ipceng_qdoor_set_spill(struct ipceng *eng, struct qdoor *entry, size_t threshold,
+	long slot_size, long slot_count)
+{
+	if (entry->sendp != NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORSPILL, "failed to set spill: spill is set already");
+		return -1;
+	}
+	if (slot_size == -1)
+		slot_size = IPCENG_DEFAULT_SPILL_SLOTSIZE;
+	if (slot_count == -1)
+		slot_count = IPCENG_DEFAULT_SPILL_SLOTS;
+	if (slot_size <= 0 || slot_count <= 0 || slot_count > UINT32_MAX) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORSPILL, "failed to set spill: invalid pool geometry");
+		return -1;
+	}
+	slot_size = _IPCENG_ALIGN64(slot_size);
+
+	// pool is always created from scratch, as only this side uses it for sending
+	int poolname_len = strlen("/2.pool") + strlen(eng->name) + strlen(entry->name) + 1;
+	char poolname[poolname_len];
+	sprintf(poolname, "/%s2%s.pool", eng->name, entry->name);
+	shm_unlink(poolname);
+	struct shm *pool = _ipceng_shm_new(entry->mem, poolname, entry->name, _ipceng_pool_size(slot_size, slot_count));
+	if (pool == NULL || _ipceng_shm_map(pool) != SHM_STAGE_DONE) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORSPILL, "failed to set spill: unable to map pool shm");
+		if (pool)
+			_ipceng_shm_free(entry->mem, pool);
+		return -1;
+	}
+	struct poolhdr *hdr = (struct poolhdr *)pool->ptr;
+	hdr->slot_count = slot_count;
+	hdr->slot_size = slot_size;
+	__atomic_store_n(&hdr->magic, _IPCENG_POOL_MAGIC, __ATOMIC_RELEASE);
+
+	// messages above the max message size of the qdoor always spill
+	entry->spill_threshold = (threshold < entry->sendq.attr.mq_msgsize) ? \
+		threshold : entry->sendq.attr.mq_msgsize;
+	entry->spill_hint = 0;
+	entry->sendp = pool;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_set_spill(struct ipceng *eng, ipceng_qdoor_t qd, size_t threshold,
+	long slot_size, long slot_count)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORSPILL, "failed to set spill: invalid qdoor handle");
+		return -1;
+	}
+
+	return _ipceng_qdoor_set_spill(eng, entry, threshold, slot_size, slot_count);
+}
+
+int ipceng_qdoor_set_coalesce(struct ipceng *eng, ipceng_qdoor_t qd, size_t bytes,
+	unsigned int msgs, unsigned int usecs)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_COALESCE, "failed to set coalescing: invalid qdoor handle");
+		return -1;
+	}
+	if (bytes > (size_t)entry->sendq.attr.mq_msgsize)
+		bytes = entry->sendq.attr.mq_msgsize;
+	if (bytes != 0 && bytes <= sizeof(struct frame) + sizeof(uint32_t)) {
+		ipceng_set_error(eng, IPCENG_ERR_COALESCE, \
+			"failed to set coalescing: batch size is too small");
+		return -1;
+	}
+
+	// messages coalesced so far go out with the old settings
+	struct timespec tm;
+	pthread_mutex_lock(&entry->batch_lock);
+	if (entry->batch && _ipceng_qdoor_flush_batch(eng, entry, \
+		_ipceng_mq_deadline(&entry->sendq, &tm)) != 0) {
+		pthread_mutex_unlock(&entry->batch_lock);
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	if (bytes == 0) {
+		if (entry->batch)
+			__atomic_sub_fetch(&eng->coalesce_count, 1, __ATOMIC_RELAXED);
+		_ipceng_free_safe(entry->mem, entry->batch);
+	} else {
+		// the batch is empty after the flush, so it is just replaced
+		char *batch = (char *)_ipceng_alloc(entry->mem, bytes);
+		if (batch == NULL) {
+			pthread_mutex_unlock(&entry->batch_lock);
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+		if (entry->batch == NULL)
+			__atomic_add_fetch(&eng->coalesce_count, 1, __ATOMIC_RELAXED);
+		_ipceng_dealloc(entry->mem, entry->batch);
+		entry->batch = batch;
+		entry->batch_len = sizeof(struct frame);
+	}
+	entry->coalesce_bytes = bytes;
+	entry->coalesce_msgs = msgs;
+	entry->coalesce_usecs = usecs;
+	pthread_mutex_unlock(&entry->batch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_set_compress(struct ipceng *eng, ipceng_qdoor_t qd, size_t threshold)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_COMPRESS, "failed to set compression: invalid qdoor handle");
+		return -1;
+	}
+
+	if (threshold == 0) {
+		_ipceng_free_safe(entry->mem, entry->lz_buff);
+		_ipceng_free_safe(entry->mem, entry->lz_table);
+	} else if (entry->lz_buff == NULL) {
+		entry->lz_buff = (uint8_t *)_ipceng_alloc(entry->mem, entry->sendq.attr.mq_msgsize);
+		entry->lz_table = (uint32_t *)_ipceng_zalloc(entry->mem, \
+			(1 << _IPCENG_LZ_HASHBITS) * sizeof(uint32_t));
+		if (entry->lz_buff == NULL || entry->lz_table == NULL) {
+			_ipceng_free_safe(entry->mem, entry->lz_buff);
+			_ipceng_free_safe(entry->mem, entry->lz_table);
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+	}
+	// a compressed message takes at least a frame header
+	entry->lz_threshold = (threshold && threshold < sizeof(struct frame)) ? \
+		sizeof(struct frame) : threshold;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_flush(struct ipceng *eng, ipceng_qdoor_t qd)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_COALESCE, "failed to flush qdoor: invalid qdoor handle");
+		return -1;
+	}
+
+	struct timespec tm;
+	if (_ipceng_qdoor_flush_sync(eng, entry, _ipceng_mq_deadline(&entry->sendq, &tm)) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// flushing coalesced batches which are due, without waiting for room in the
+// peers; returns timeout_ms, shortened to when the next batch is due; a batch
+// locked by a pushing thread is left to it and looked at again in a while
+static int _ipceng_flush_due(struct ipceng *eng, int timeout_ms)
+{
+	struct timespec expired = {0, 0};
+	struct qdoor *qd;
+	_ipceng_read_enter(eng);
+	list_for_each_entry_rcu(qd, &eng->qdoor_list, _list) {
+		if (qd->batch == NULL)
+			continue;
+		if (pthread_mutex_trylock(&qd->batch_lock) != 0) {
+			if (timeout_ms < 0 || timeout_ms > 1)
+				timeout_ms = 1;
+			continue;
+		}
+		if (qd->batch == NULL || qd->batch_count == 0 || qd->coalesce_usecs == 0) {
+			pthread_mutex_unlock(&qd->batch_lock);
+			continue;
+		}
+		long long left = _ipceng_qdoor_batch_left(qd);
+		if (left <= 0 && _ipceng_qdoor_flush_batch(eng, qd, &expired) == 0) {
+			pthread_mutex_unlock(&qd->batch_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&qd->batch_lock);
+		// peer is full; trying again in a while
+		if (left <= 0)
+			left = 1000;
+		int left_ms = (left + 999) / 1000;
+		if (timeout_ms < 0 || left_ms < timeout_ms)
+			timeout_ms = left_ms;
+	}
+	return timeout_ms;
+}
+
+void *ipceng_msg_loan(struct ipceng *eng, ipceng_qdoor_t qd, size_t size)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGLOAN, "failed to loan message: invalid qdoor handle");
+		return NULL;
+	}
+	// a qdoor without spill gets a default pool which only loans use
+	if (entry->sendp == NULL && _ipceng_qdoor_set_spill(eng, entry, SIZE_MAX, -1, -1) != 0)
+		return NULL;
+	struct poolhdr *hdr = (struct poolhdr *)entry->sendp->ptr;
+	if (entry->sendp->state != IPC_STATE_OPENED || size > hdr->slot_size) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGLOAN, (entry->sendp->state != IPC_STATE_OPENED) ? \
+			"failed to loan message: qdoor is closed" : \
+			"failed to loan message: size is larger than pool slots");
+		return NULL;
+	}
+
+	struct timespec tm;
+	int slot = _ipceng_pool_alloc(entry, _ipceng_mq_deadline(&entry->sendq, &tm), eng->spin_count);
+	if (slot < 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return NULL;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return _ipceng_pool_slot(hdr, slot);
+}
+
+int ipceng_msg_publish(struct ipceng *eng, ipceng_qdoor_t qd, void *msg, size_t len, int prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	int slot = (entry == NULL) ? -1 : _ipceng_pool_index(entry->sendp, msg);
+	if (slot < 0) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGLOAN, \
+			"failed to publish message: invalid qdoor handle or message is not loaned");
+		return -1;
+	}
+	if (!(prio >= IPCENG_PRIO_MIN && prio <= IPCENG_PRIO_MAX) || \
+		len > ((struct poolhdr *)entry->sendp->ptr)->slot_size) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGLOAN, \
+			"failed to publish message: out of range priority or length");
+		return -1;
+	}
+
+	// on failure the message stays loaned, to be published again or discarded
+	struct timespec tm;
+	int ret = _ipceng_qdoor_xmit_slot(eng, entry, slot, len, prio, \
+		entry->stamp ? FRAME_FLAG_STAMP : 0, _ipceng_mq_deadline(&entry->sendq, &tm));
+	_ipceng_stat_io(&entry->stats.tx, ret, len, false);
+	if (ret != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_msg_discard(struct ipceng *eng, ipceng_qdoor_t qd, void *msg)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	int slot = (entry == NULL) ? -1 : _ipceng_pool_index(entry->sendp, msg);
+	if (slot < 0) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGLOAN, \
+			"failed to discard message: invalid qdoor handle or message is not loaned");
+		return -1;
+	}
+	_ipceng_pool_free(entry->sendp, slot);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_msg_take(struct ipceng *eng, ipceng_qdoor_t qd, const void **msg, size_t *len, int *prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGTAKE, "failed to take message: invalid qdoor handle");
+		return -1;
+	}
+	char *rx_buff = _ipceng_qdoor_rx_buff(entry);
+	if (rx_buff == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+
+	struct timespec tm;
+	struct msgview view;
+	if (_ipceng_qdoor_recv_view(eng, entry, rx_buff, entry->recvq.attr.mq_msgsize, \
+		_ipceng_mq_deadline(&entry->recvq, &tm), &view) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	// messages not sent through the pool are copied out (stashed ones already
+	// are), so that any number of taken messages can be kept at the same time
+	if (view.slot < 0 && view.owned == NULL) {
+		void *copy = _ipceng_alloc(entry->mem, view.len ? view.len : 1);
+		if (copy == NULL) {
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+		memcpy(copy, view.data, view.len);
+		view.data = copy;
+	}
+	*msg = view.data;
+	if (len)
+		*len = view.len;
+	if (prio)
+		*prio = view.prio;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_msg_release(struct ipceng *eng, ipceng_qdoor_t qd, const void *msg)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_MSGTAKE, "failed to release message: invalid qdoor handle");
+		return -1;
+	}
+
+	int slot = _ipceng_pool_index(entry->recvp, msg);
+	if (slot >= 0)
+		_ipceng_pool_free(entry->recvp, slot);
+	else
+		_ipceng_dealloc(entry->mem, (void *)msg);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// pending call table of a qdoor; it is kept at most half full, so a free id
+// is always found a few ids after the last one
+static struct pendcall *_ipceng_call_find(struct qdoor *qd, uint32_t id)
+{
+	if (id == 0 || qd->calls == NULL)
+		return NULL;
+	struct pendcall *pc = &qd->calls[id & (qd->calls_size - 1)];
+	return (pc->id == id) ? pc : NULL;
+}
+
+static struct pendcall *_ipceng_call_new(struct qdoor *qd)
+{
+	if ((qd->calls_count + 1) * 2 > qd->calls_size) {
+		unsigned int i, new_size = qd->calls_size ? qd->calls_size * 2 : 16;
+		struct pendcall *new_calls = (struct pendcall *)_ipceng_zalloc(qd->mem, \
+			new_size * sizeof(struct pendcall));
+		if (new_calls == NULL)
+			return NULL;
+		// ids in different entries of the old table are in different
+		// entries of the new one as well
+		for (i = 0; i < qd->calls_size; i++)
+			if (qd->calls[i].id)
+				new_calls[qd->calls[i].id & (new_size - 1)] = qd->calls[i];
+		_ipceng_dealloc(qd->mem, qd->calls);
+		qd->calls = new_calls;
+		qd->calls_size = new_size;
+	}
+
+	uint32_t id;
+	do
+		id = ++qd->next_call_id;
+	while (id == 0 || qd->calls[id & (qd->calls_size - 1)].id != 0);
+	struct pendcall *pc = &qd->calls[id & (qd->calls_size - 1)];
+	memset(pc, 0, sizeof(struct pendcall));
+	pc->id = id;
+	qd->calls_count++;
+	return pc;
+}
+
+static inline void _ipceng_call_free(struct qdoor *qd, struct pendcall *pc)
+{
+	_ipceng_free_safe(qd->mem, pc->resp);
+	pc->id = 0;
+	qd->calls_count--;
+}
+
+// handing a received reply to its pending call and releasing it; returns 1 if
+// a call is completed, 0 if the reply is dropped (call unknown, e.g. timed out)
+static int _ipceng_call_complete(struct ipceng *eng, struct qdoor *qd, struct msgview *view)
+{
+	int ret = 0;
+	struct pendcall *pc = _ipceng_call_find(qd, view->call_id);
+	if (pc != NULL && pc->cb == NULL && !pc->done) {
+		// ipceng_call: the reply is kept until it returns
+		pc->resp = _ipceng_alloc(qd->mem, view->len ? view->len : 1);
+		if (pc->resp != NULL) {
+			memcpy(pc->resp, view->data, view->len);
+			pc->resp_len = view->len;
+		}
+		pc->done = true;
+		ret = 1;
+	} else if (pc != NULL && pc->cb != NULL) {
+		// the entry is freed before the callback, which may make new calls
+		ipceng_reply_cb cb = pc->cb;
+		void *ctx = pc->ctx;
+		_ipceng_call_free(qd, pc);
+		struct ipceng_reader *hold = _ipceng_read_hold(eng);
+		cb(eng, _ipceng_slot_handle(eng->qdoor_slots, qd->slot), view->call_id, view->data, \
+			view->len, ctx);
+		_ipceng_read_unhold(hold);
+		ret = 1;
+	}
+	_ipceng_qdoor_view_release(qd, view);
+	return ret;
+}
+
+// receiving one message of qd while waiting for replies; replies are handed
+// to their calls, anything else is stashed for the regular pop functions
+static int _ipceng_call_recv_one(struct ipceng *eng, struct qdoor *qd,
+	const struct timespec *deadline)
+{
+	struct msgview view;
+	if (_ipceng_qdoor_recv_wire(eng, qd, qd->rx_buff, qd->recvq.attr.mq_msgsize, \
+		deadline, &view) != 0)
+		return -1;
+	if (view.kind == FRAME_KIND_REPLY)
+		return _ipceng_call_complete(eng, qd, &view);
+	if (_ipceng_qdoor_stash(qd, &view, false) != 0) {
+		int err = errno;
+		_ipceng_qdoor_view_release(qd, &view);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int ipceng_call(struct ipceng *eng, ipceng_qdoor_t qd, const void *req, size_t len,
+	void **resp, size_t *resp_len, int timeout_ms)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, "failed to call: invalid qdoor handle");
+		return -1;
+	}
+	// the dispatcher receives from such a qdoor, messages kept by the call
+	// would race with it
+	if (entry->on_msg) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, "failed to call: qdoor has a message callback");
+		return -1;
+	}
+	struct pendcall *pc = (_ipceng_qdoor_rx_buff(entry) != NULL) ? _ipceng_call_new(entry) : NULL;
+	if (pc == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+
+	uint32_t id = pc->id;
+	struct timespec tm;
+	struct timespec *deadline = _ipceng_deadline_ms(timeout_ms, &tm);
+	int err = 0;
+	if (_ipceng_qdoor_xmit_frame(eng, entry, FRAME_KIND_REQUEST, 0, id, req, len, 0, deadline) != 0)
+		err = errno;
+	// the table may grow while waiting, so the call is looked up by id
+	while (err == 0 && !_ipceng_call_find(entry, id)->done)
+		if (_ipceng_call_recv_one(eng, entry, deadline) < 0)
+			err = errno;
+	pc = _ipceng_call_find(entry, id);
+	if (err == 0 && pc->resp == NULL)
+		err = ENOMEM;
+	if (err != 0) {
+		_ipceng_call_free(entry, pc);
+		ipceng_set_error(eng, err, strerror(err));
+		return -1;
+	}
+
+	if (resp) {
+		*resp = pc->resp;
+		pc->resp = NULL;
+	}
+	if (resp_len)
+		*resp_len = pc->resp_len;
+	_ipceng_call_free(entry, pc);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+uint32_t ipceng_call_async(struct ipceng *eng, ipceng_qdoor_t qd, const void *req, size_t len,
+	ipceng_reply_cb cb, void *ctx)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || cb == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, \
+			"failed to call: invalid qdoor handle or no reply callback");
+		return 0;
+	}
+	struct pendcall *pc = _ipceng_call_new(entry);
+	if (pc == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return 0;
+	}
+	pc->cb = cb;
+	pc->ctx = ctx;
+
+	struct timespec tm;
+	if (_ipceng_qdoor_xmit_frame(eng, entry, FRAME_KIND_REQUEST, 0, pc->id, req, len, 0, \
+		_ipceng_mq_deadline(&entry->sendq, &tm)) != 0) {
+		int err = errno;
+		_ipceng_call_free(entry, pc);
+		ipceng_set_error(eng, err, strerror(err));
+		return 0;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return pc->id;
+}
+
+int ipceng_call_poll(struct ipceng *eng, ipceng_qdoor_t qd, int timeout_ms)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, "failed to poll calls: invalid qdoor handle");
+		return -1;
+	}
+	if (entry->on_msg) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, "failed to poll calls: qdoor has a message callback");
+		return -1;
+	}
+	if (_ipceng_qdoor_rx_buff(entry) == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+
+	// waiting (up to timeout_ms) for the first reply, then taking whatever
+	// else is already pending
+	struct timespec tm, expired = {0, 0};
+	struct timespec *deadline = _ipceng_deadline_ms(timeout_ms, &tm);
+	int ret, completed = 0;
+	while ((ret = _ipceng_call_recv_one(eng, entry, deadline)) >= 0) {
+		completed += ret;
+		if (completed > 0)
+			deadline = &expired;
+	}
+	if (errno != ETIMEDOUT && errno != EAGAIN) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return completed;
+}
+
+int ipceng_call_recv(struct ipceng *eng, ipceng_qdoor_t qd, void *buff, size_t cap,
+	size_t *len, uint32_t *call_id)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, "failed to receive call: invalid qdoor handle");
+		return -1;
+	}
+
+	ssize_t ret = _ipceng_qdoor_recv_entry(eng, entry, buff, cap, NULL, call_id);
+	if (ret < 0)
+		return -1;
+	if (len)
+		*len = ret;
+	return 0;
+}
+
+int ipceng_call_reply(struct ipceng *eng, ipceng_qdoor_t qd, uint32_t call_id,
+	const void *resp, size_t len)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || call_id == 0) {
+		ipceng_set_error(eng, IPCENG_ERR_CALL, \
+			"failed to reply to call: invalid qdoor handle or call id");
+		return -1;
+	}
+
+	struct timespec tm;
+	if (_ipceng_qdoor_xmit_frame(eng, entry, FRAME_KIND_REPLY, 0, call_id, resp, len, 0, \
+		_ipceng_mq_deadline(&entry->sendq, &tm)) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+size_t ipceng_qdoor_msgsize(struct ipceng *eng, ipceng_qdoor_t qd)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	size_t size = entry ? entry->recvq.attr.mq_msgsize : 0;
+	// no error state is set, but the lookup is done
+	_ipceng_read_leave(eng);
+	return size;
+}
+
+ipceng_qdoor_t ipceng_qdoor_get(struct ipceng *eng, char *qdoor_name)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, qdoor_name);
+	if (qd == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_QDOORGET, "failed to get qdoor: qdoor not found");
+		return IPCENG_HANDLE_INVALID;
+	}
+
+	ipceng_qdoor_t handle = _ipceng_slot_handle(eng->qdoor_slots, qd->slot);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return handle;
+}
+
+int ipceng_wait(struct ipceng *eng, int timeout_ms, ipceng_qdoor_t *ready, int max)
+{
+	struct epoll_event evs[IPCENG_WAIT_MAXEVENTS];
+	if (max > IPCENG_WAIT_MAXEVENTS)
+		max = IPCENG_WAIT_MAXEVENTS;
+	if (max <= 0) {
+		ipceng_set_error(eng, IPCENG_ERR_WAIT, "failed to wait: no room for ready qdoors");
+		return -1;
+	}
+
+	int i, n;
+	while (1) {
+		int wait_ms = timeout_ms;
+		if (__atomic_load_n(&eng->coalesce_count, __ATOMIC_RELAXED) > 0)
+			wait_ms = _ipceng_flush_due(eng, timeout_ms);
+		_ipceng_read_leave(eng);
+		n = epoll_wait(eng->epfd, evs, max, wait_ms);
+		if (n != 0 || wait_ms == timeout_ms)
+			break;
+		// woken up just to flush a due batch; waiting for the rest of timeout_ms
+		if (timeout_ms > 0)
+			timeout_ms = (timeout_ms > wait_ms) ? timeout_ms - wait_ms : 0;
+	}
+	if (n < 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		ready[i] = evs[i].data.u64;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return n;
+}
+
+int ipceng_epoll_fd(struct ipceng *eng)
+{
+	return eng->epfd;
+}
+
+// checking the header of a received typed message and copying it out, as the
+// message may be unaligned; returns its payload, NULL if it is not typed or
+// the header is malformed
+static const void *_ipceng_msghdr_parse(const struct msgview *view, struct ipceng_msghdr *hdr)
+{
+	if (!(view->flags & FRAME_FLAG_TYPED) || view->len < sizeof(struct ipceng_msghdr))
+		return NULL;
+	memcpy(hdr, view->data, sizeof(struct ipceng_msghdr));
+	if (hdr->version == 0 || hdr->hdr_len < sizeof(struct ipceng_msghdr) || \
+		hdr->hdr_len > view->len || hdr->len != view->len - hdr->hdr_len)
+		return NULL;
+	return (const char *)view->data + hdr->hdr_len;
+}
+
+// handing a received message to the handler of its type, or to the
+// IPCENG_TYPE_DEFAULT one if fallback is set; returns false if nobody took it
+static bool _ipceng_route(struct ipceng *eng, ipceng_qdoor_t qd, const struct msgview *view,
+	bool fallback)
+{
+	struct ipceng_msghdr hdr;
+	const void *payload = _ipceng_msghdr_parse(view, &hdr);
+	// the size is published after the table it belongs to; the table and the
+	// message stay valid while the handler runs, as the read section is held
+	_ipceng_read_enter(eng);
+	unsigned int size = __atomic_load_n(&eng->handlers_size, __ATOMIC_ACQUIRE);
+	struct ipceng_handler *handlers = __atomic_load_n(&eng->handlers, __ATOMIC_ACQUIRE);
+	struct ipceng_handler *h;
+	if (payload != NULL && hdr.type < size && handlers[hdr.type].fn) {
+		h = &handlers[hdr.type];
+	} else {
+		if (!fallback || size == 0 || handlers[IPCENG_TYPE_DEFAULT].fn == NULL)
+			return false;
+		if (payload == NULL) {
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.len = view->len;
+			payload = view->data;
+		}
+		h = &handlers[IPCENG_TYPE_DEFAULT];
+	}
+	struct ipceng_reader *hold = _ipceng_read_hold(eng);
+	h->fn(eng, qd, &hdr, payload, h->ctx);
+	_ipceng_read_unhold(hold);
+	return true;
+}
+
+int ipceng_qdoor_push_typed(struct ipceng *eng, ipceng_qdoor_t qd, uint32_t type, uint16_t flags,
+	const void *data, size_t len, int prio)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || type == IPCENG_TYPE_DEFAULT || type > IPCENG_TYPE_MAX) {
+		ipceng_set_error(eng, IPCENG_ERR_TYPED, \
+			"failed to push typed message: invalid qdoor handle or type id");
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	struct ipceng_msghdr hdr = {IPCENG_MSGHDR_VERSION, sizeof(hdr), flags, type, len, \
+		++entry->typed_seq, (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec};
+	char stack_buff[256];
+	char *msg = stack_buff;
+	if (sizeof(hdr) + len > sizeof(stack_buff)) {
+		msg = (char *)_ipceng_alloc(entry->mem, sizeof(hdr) + len);
+		if (msg == NULL) {
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+	}
+	memcpy(msg, &hdr, sizeof(hdr));
+	memcpy(msg + sizeof(hdr), data, len);
+	int ret = _ipceng_qdoor_send_entry(eng, entry, msg, sizeof(hdr) + len, prio, FRAME_FLAG_TYPED);
+	if (msg != stack_buff)
+		_ipceng_dealloc(entry->mem, msg);
+	return ret;
+}
+
+int ipceng_qdoor_pop_typed(struct ipceng *eng, ipceng_qdoor_t qd, struct ipceng_msghdr *hdr,
+	void *buff, size_t cap)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_TYPED, "failed to pop typed message: invalid qdoor handle");
+		return -1;
+	}
+	if (cap < entry->recvq.attr.mq_msgsize) {
+		ipceng_set_error(eng, IPCENG_ERR_TYPED, \
+			"failed to pop typed message: buffer is smaller than qdoor message size");
+		return -1;
+	}
+
+	struct timespec tm;
+	struct msgview view;
+	if (_ipceng_qdoor_recv_view(eng, entry, buff, cap, _ipceng_mq_deadline(&entry->recvq, &tm), \
+		&view) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	const void *payload = _ipceng_msghdr_parse(&view, hdr);
+	if (payload == NULL && (view.flags & FRAME_FLAG_TYPED)) {
+		_ipceng_qdoor_view_release(entry, &view);
+		ipceng_set_error(eng, EBADMSG, strerror(EBADMSG));
+		return -1;
+	}
+	if (payload == NULL) {
+		memset(hdr, 0, sizeof(struct ipceng_msghdr));
+		hdr->len = view.len;
+		payload = view.data;
+	}
+	// a spilled message which does not fit is kept whole for the next pop
+	if (hdr->len > cap) {
+		if (_ipceng_qdoor_stash(entry, &view, true) != 0)
+			_ipceng_qdoor_view_release(entry, &view);
+		ipceng_set_error(eng, EMSGSIZE, strerror(EMSGSIZE));
+		return -1;
+	}
+	memmove(buff, payload, hdr->len);
+	_ipceng_qdoor_view_release(entry, &view);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_register_handler(struct ipceng *eng, uint32_t type_id, ipceng_handler_fn fn, void *ctx)
+{
+	if (type_id > IPCENG_TYPE_MAX) {
+		ipceng_set_error(eng, IPCENG_ERR_TYPED, "failed to register handler: invalid type id");
+		return -1;
+	}
+
+	// the table is read without locking (see _ipceng_route), so it is replaced
+	// rather than resized in place
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	if (type_id >= eng->handlers_size) {
+		if (fn == NULL) {
+			pthread_rwlock_unlock(&eng->dispatch_lock);
+			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+			return 0;
+		}
+		unsigned int new_size = eng->handlers_size ? eng->handlers_size : 16;
+		while (new_size <= type_id)
+			new_size *= 2;
+		struct ipceng_handler *handlers = (struct ipceng_handler *)malloc( \
+			new_size * sizeof(struct ipceng_handler));
+		if (handlers == NULL) {
+			pthread_rwlock_unlock(&eng->dispatch_lock);
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
+		}
+		if (eng->handlers_size)
+			memcpy(handlers, eng->handlers, eng->handlers_size * sizeof(struct ipceng_handler));
+		memset(handlers + eng->handlers_size, 0, \
+			(new_size - eng->handlers_size) * sizeof(struct ipceng_handler));
+		if (eng->handlers)
+			_ipceng_retire(eng, eng->handlers, _ipceng_retired_free);
+		__atomic_store_n(&eng->handlers, handlers, __ATOMIC_RELEASE);
+		__atomic_store_n(&eng->handlers_size, new_size, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&eng->handlers[type_id].ctx, ctx, __ATOMIC_RELAXED);
+	__atomic_store_n(&eng->handlers[type_id].fn, fn, __ATOMIC_RELEASE);
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_dispatch(struct ipceng *eng, ipceng_qdoor_t qd, int max)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_TYPED, "failed to dispatch qdoor: invalid qdoor handle");
+		return -1;
+	}
+	char *rx_buff = _ipceng_qdoor_rx_buff(entry);
+	if (rx_buff == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+
+	// waiting just for the first message, like ipceng_qdoor_popv
+	struct timespec tm, expired = {0, 0};
+	struct timespec *deadline = _ipceng_mq_deadline(&entry->recvq, &tm);
+	int i;
+	for (i = 0; i < max; i++) {
+		struct msgview view;
+		if (_ipceng_qdoor_recv_view(eng, entry, rx_buff, entry->recvq.attr.mq_msgsize, deadline, \
+			&view) != 0)
+			break;
+		_ipceng_route(eng, qd, &view, true);
+		_ipceng_qdoor_view_release(entry, &view);
+		if (deadline)
+			deadline = &expired;
+	}
+	if (i == 0 && max > 0 && errno != EAGAIN && errno != ETIMEDOUT) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return i;
+}
+
+int ipceng_qdoor_set_weight(struct ipceng *eng, ipceng_qdoor_t qd, unsigned int weight)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || weight == 0) {
+		ipceng_set_error(eng, IPCENG_ERR_SCHED, "failed to set weight: invalid qdoor handle or weight");
+		return -1;
+	}
+	entry->weight = weight;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// scheduler lookahead: the next message of qd is received (without waiting)
+// and put back at the front of its stash, where its priority and length can
+// be seen; returns false if there is none
+static bool _ipceng_sched_fetch(struct ipceng *eng, struct qdoor *qd)
+{
+	struct timespec expired = {0, 0};
+	struct msgview view;
+	if (!list_empty(&qd->stash))
+		return true;
+	if (qd->recvq.state != IPC_STATE_OPENED || _ipceng_qdoor_rx_buff(qd) == NULL)
+		return false;
+	if (_ipceng_qdoor_recv_view(eng, qd, qd->rx_buff, qd->recvq.attr.mq_msgsize, &expired, \
+		&view) != 0)
+		return false;
+	if (_ipceng_qdoor_stash(qd, &view, true) != 0) {
+		_ipceng_qdoor_view_release(qd, &view);
+		return false;
+	}
+	return true;
+}
+
+static inline struct stashmsg *_ipceng_sched_head(struct qdoor *qd)
+{
+	return list_empty(&qd->stash) ? NULL : list_first_entry(&qd->stash, struct stashmsg, _list);
+}
+
+static inline struct qdoor *_ipceng_sched_next(struct ipceng *eng, struct qdoor *qd)
+{
+	struct list_head *next = qd->_list.next;
+	if (next == &eng->qdoor_list)
+		next = next->next;
+	return list_entry(next, struct qdoor, _list);
+}
+
+// choosing the qdoor to pop from: the highest priority among the heads of all
+// weighted qdoors first, then deficit round robin among qdoors with that
+// priority; NULL if no weighted qdoor has a message; qdoors without a weight
+// are never looked ahead, so they stay free for other threads
+static struct qdoor *_ipceng_sched_pick(struct ipceng *eng)
+{
+	// ready mqs are told by the epoll set, rings and unpacked batches have to
+	// be checked one by one
+	struct epoll_event evs[IPCENG_WAIT_MAXEVENTS];
+	int i, n = epoll_wait(eng->epfd, evs, IPCENG_WAIT_MAXEVENTS, 0);
+	for (i = 0; i < n; i++) {
+		struct qdoor *qd = _ipceng_qdoor_from_handle(eng, evs[i].data.u64);
+		if (qd != NULL && qd->weight)
+			_ipceng_sched_fetch(eng, qd);
+	}
+
+	struct qdoor *qd;
+	int best = -1;
+	_ipceng_read_enter(eng);
+	list_for_each_entry_rcu(qd, &eng->qdoor_list, _list) {
+		if (qd->weight == 0)
+			continue;
+		if (list_empty(&qd->stash) && (qd->type == QDOOR_TYPE_RING || \
+			qd->unbatch_off < qd->unbatch_len))
+			_ipceng_sched_fetch(eng, qd);
+		struct stashmsg *head = _ipceng_sched_head(qd);
+		if (head == NULL)
+			qd->deficit = 0;
+		else if (head->view.prio > best)
+			best = head->view.prio;
+	}
+	if (best < 0)
+		return NULL;
+
+	// the current qdoor gets its quantum once per visit and is served while
+	// its deficit covers its head; every lap grants all of them, so it ends
+	qd = _ipceng_qdoor_from_handle(eng, eng->sched_cur);
+	if (qd == NULL) {
+		qd = list_first_entry(&eng->qdoor_list, struct qdoor, _list);
+		eng->sched_granted = false;
+	}
+	while (1) {
+		struct stashmsg *head = qd->weight ? _ipceng_sched_head(qd) : NULL;
+		if (head != NULL && head->view.prio == best) {
+			if (!eng->sched_granted) {
+				qd->deficit += (size_t)qd->weight * IPCENG_SCHED_QUANTUM;
+				eng->sched_granted = true;
+			}
+			if (qd->deficit >= head->view.len) {
+				qd->deficit -= head->view.len;
+				eng->sched_cur = _ipceng_slot_handle(eng->qdoor_slots, qd->slot);
+				return qd;
+			}
+		}
+		qd = _ipceng_sched_next(eng, qd);
+		eng->sched_cur = _ipceng_slot_handle(eng->qdoor_slots, qd->slot);
+		eng->sched_granted = false;
+	}
+}
+
+int ipceng_sched_pop(struct ipceng *eng, ipceng_qdoor_t *qd, void *buff, size_t cap,
+	size_t *len, int *prio, int timeout_ms)
+{
+	struct timespec tm, now;
+	_ipceng_deadline_ms(timeout_ms, &tm);
+	struct qdoor *entry;
+	while ((entry = _ipceng_sched_pick(eng)) == NULL) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		long long ms = (long long)(tm.tv_sec - now.tv_sec) * 1000 + (tm.tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0) {
+			ipceng_set_error(eng, EAGAIN, strerror(EAGAIN));
+			return -1;
+		}
+		// rings are not in the epoll set, so they are checked every millisecond
+		struct epoll_event ev;
+		_ipceng_read_leave(eng);
+		if (epoll_wait(eng->epfd, &ev, 1, (ms > 1) ? 1 : (int)ms) < 0 && errno != EINTR) {
+			ipceng_set_error(eng, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (qd)
+		*qd = _ipceng_slot_handle(eng->qdoor_slots, entry->slot);
+	struct msgview view;
+	_ipceng_qdoor_recv_view(eng, entry, buff, cap, NULL, &view);
+	if (prio)
+		*prio = view.prio;
+	ssize_t ret = _ipceng_qdoor_view_copy(entry, &view, buff, cap);
+	if (ret < 0) {
+		// not served after all
+		entry->deficit += view.len;
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	if (len)
+		*len = ret;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// messages the peer of qd can hold: the max count of its mq, or as many
+// empty records as fit in its ring
+static unsigned int _ipceng_qdoor_capacity(struct qdoor *qd)
+{
+	if (qd->type == QDOOR_TYPE_RING)
+		return (qd->sendr->size - sizeof(struct ringhdr)) / sizeof(struct ringrec);
+	struct mq_attr attr;
+	if (qd->sendq.state == IPC_STATE_OPENED && mq_getattr(qd->sendq.mqd, &attr) == 0)
+		return attr.mq_maxmsg;
+	return qd->sendq.attr.mq_maxmsg;
+}
+
+int ipceng_qdoor_set_credit(struct ipceng *eng, ipceng_qdoor_t qd, unsigned int window)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_CREDIT, "failed to set credit window: invalid qdoor handle");
+		return -1;
+	}
+	if (window > 0 && _ipceng_qdoor_map_credit(eng, entry, true) != 0) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_CREDIT, "failed to set credit window: unable to map counters");
+		return -1;
+	}
+	// a window beyond what the peer can hold would never run out
+	unsigned int capacity = _ipceng_qdoor_capacity(entry);
+	if (window > capacity)
+		window = capacity;
+	entry->credit_window = window;
+	if (entry->sendc && entry->sendc->state == IPC_STATE_OPENED)
+		__atomic_store_n(&((struct credithdr *)entry->sendc->ptr)->window, window, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// calling the credit callback of qd with the credits just read, once per
+// change of the consumed count seen by any caller
+static void _ipceng_credit_report(struct ipceng *eng, ipceng_qdoor_t qd, struct qdoor *entry,
+	unsigned int credits)
+{
+	uint64_t consumed = __atomic_load_n(&((struct credithdr *)entry->sendc->ptr)->consumed, \
+		__ATOMIC_ACQUIRE);
+	bool granted = __atomic_exchange_n(&entry->peer_consumed, consumed, __ATOMIC_RELAXED) != consumed;
+	ipceng_credit_cb on_credit = entry->on_credit;
+	void *on_credit_ctx = entry->on_credit_ctx;
+	if (granted && on_credit && credits > 0)
+		on_credit(eng, qd, credits, on_credit_ctx);
+}
+
+int ipceng_qdoor_credits(struct ipceng *eng, ipceng_qdoor_t qd)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || entry->credit_window == 0 || entry->sendc->state != IPC_STATE_OPENED) {
+		ipceng_set_error(eng, IPCENG_ERR_CREDIT, \
+			"failed to get credits: invalid qdoor handle, credit window not set or qdoor closed");
+		return -1;
+	}
+
+	// only the shared counters are read, nothing is received
+	unsigned int credits = _ipceng_credit_left(entry);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	_ipceng_credit_report(eng, qd, entry, credits);
+	return credits;
+}
+
+int ipceng_qdoor_wait_credit(struct ipceng *eng, ipceng_qdoor_t qd, unsigned int min, int timeout_ms)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || entry->credit_window == 0 || entry->sendc->state != IPC_STATE_OPENED) {
+		ipceng_set_error(eng, IPCENG_ERR_CREDIT, \
+			"failed to wait for credits: invalid qdoor handle, credit window not set or qdoor closed");
+		return -1;
+	}
+	if (min > entry->credit_window) {
+		ipceng_set_error(eng, EINVAL, "failed to wait for credits: min is greater than the window");
+		return -1;
+	}
+
+	// sleeping on the wait point the peer notifies as it consumes
+	struct timespec tm;
+	struct timespec *deadline = _ipceng_deadline_ms(timeout_ms, &tm);
+	struct credithdr *hdr = (struct credithdr *)entry->sendc->ptr;
+	struct backoff bo = _ipceng_backoff_init(&hdr->consumed_wait, eng->spin_count);
+	unsigned int credits;
+	while ((credits = _ipceng_credit_left(entry)) < min) {
+		if (_ipceng_backoff(&bo, deadline) != 0) {
+			ipceng_set_error(eng, EAGAIN, strerror(EAGAIN));
+			return -1;
+		}
+	}
+	_ipceng_backoff_done(&bo);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	_ipceng_credit_report(eng, qd, entry, credits);
+	return credits;
+}
+
+int ipceng_qdoor_on_credit(struct ipceng *eng, ipceng_qdoor_t qd, ipceng_credit_cb cb, void *ctx)
+{
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CREDIT, "failed to set credit callback: invalid qdoor handle");
+		return -1;
+	}
+	entry->on_credit = cb;
+	entry->on_credit_ctx = ctx;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_qdoor_on_message(struct ipceng *eng, ipceng_qdoor_t qd, ipceng_msg_cb cb, void *ctx)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to set qdoor callback: invalid qdoor handle");
+		return -1;
+	}
+	if (entry->type != QDOOR_TYPE_MQ) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to set qdoor callback: qdoor has no mq");
+		return -1;
+	}
+
+	int ret = 0;
+	if (entry->recvq.state == IPC_STATE_OPENED) {
+		if (cb && !entry->on_msg)
+			ret = _ipceng_qdoor_dispatch_arm(eng, entry, EPOLL_CTL_ADD);
+		else if (!cb && entry->on_msg)
+			ret = epoll_ctl(eng->dispatch_epfd, EPOLL_CTL_DEL, entry->recvq.mqd, NULL);
+	}
+	if (ret != 0) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	entry->on_msg = cb;
+	entry->on_msg_ctx = ctx;
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+// dispatcher thread: waits for ready qdoors with callbacks and drains them
+static void *_ipceng_dispatch_worker(void *arg)
+{
+	struct ipceng *eng = (struct ipceng *)arg;
+	struct timespec expired = {0, 0};
+	struct epoll_event ev;
+	char *buff = NULL;
+	size_t cap = 0;
+
+	while (1) {
+		// no read section is kept while waiting (see _ipceng_reclaim)
+		_ipceng_read_leave(eng);
+		int n = epoll_wait(eng->dispatch_epfd, &ev, 1, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || ev.data.u64 == IPCENG_HANDLE_INVALID)
+			break;
+
+		pthread_rwlock_rdlock(&eng->dispatch_lock);
+		struct qdoor *qd = _ipceng_qdoor_from_handle(eng, ev.data.u64);
+		if (qd == NULL || qd->on_msg == NULL || qd->recvq.state != IPC_STATE_OPENED) {
+			pthread_rwlock_unlock(&eng->dispatch_lock);
+			continue;
+		}
+		if (cap < qd->recvq.attr.mq_msgsize) {
+			char *new_buff = (char *)realloc(buff, qd->recvq.attr.mq_msgsize);
+			if (new_buff == NULL) {
+				_ipceng_qdoor_dispatch_arm(eng, qd, EPOLL_CTL_MOD);
+				pthread_rwlock_unlock(&eng->dispatch_lock);
+				continue;
+			}
+			buff = new_buff;
+			cap = qd->recvq.attr.mq_msgsize;
+		}
+		// draining a batch of pending messages without waiting for more; the
+		// callback gets the receive buffer itself, valid until it returns;
+		// callbacks run without dispatch_lock, so they may add/delete qdoors
+		// and set callbacks, while the read section keeps qd and its mappings
+		// alive
+		struct ipceng_reader *hold = _ipceng_read_hold(eng);
+		int i, prio;
+		bool gone = false;
+		for (i = 0; i < IPCENG_DISPATCH_BATCH && !gone; i++) {
+			struct msgview view;
+			// messages kept by a pop with a short buffer or by calls made
+			// before the callback was set go first, they are recorded already
+			bool stashed = !list_empty(&qd->stash);
+			if (stashed) {
+				_ipceng_qdoor_recv_view(eng, qd, buff, cap, NULL, &view);
+			} else {
+				ssize_t len = _ipceng_mq_recv(&qd->recvq, buff, cap, &prio, \
+					(qd->recvq.timeout > 0) ? &expired : NULL);
+				if (len < 0)
+					break;
+				_ipceng_credit_consumed(qd);
+				if (_ipceng_qdoor_decode(eng, qd, buff, len, prio, &view) != 0)
+					continue;
+				if (view.kind == FRAME_KIND_REPLY) {
+					_ipceng_call_complete(eng, qd, &view);
+					continue;
+				}
+			}
+			// a batch is handed over as a whole, as one entry of the drain batch
+			do {
+				if (!stashed) {
+					_ipceng_stat_io(&qd->stats.rx, 0, view.len, false);
+					if (qd->stamp)
+						_ipceng_lat_record(qd->lat, view.stamp);
+				}
+				stashed = false;
+				ipceng_msg_cb on_msg = qd->on_msg;
+				void *on_msg_ctx = qd->on_msg_ctx;
+				pthread_rwlock_unlock(&eng->dispatch_lock);
+				if (!_ipceng_route(eng, ev.data.u64, &view, false))
+					on_msg(eng, ev.data.u64, view.data, view.len, view.prio, on_msg_ctx);
+				pthread_rwlock_rdlock(&eng->dispatch_lock);
+				_ipceng_qdoor_view_release(qd, &view);
+				// the callback may have closed/deleted qd or removed its
+				// callback; the rest of a batch is dropped then
+				gone = _ipceng_qdoor_from_handle(eng, ev.data.u64) != qd || \
+					qd->on_msg == NULL || qd->recvq.state != IPC_STATE_OPENED;
+			} while (!gone && _ipceng_qdoor_unbatch(qd, &view) == 0);
+		}
+		if (!gone)
+			_ipceng_qdoor_dispatch_arm(eng, qd, EPOLL_CTL_MOD);
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		_ipceng_read_unhold(hold);
+	}
+	_ipceng_read_leave(eng);
+
+	free(buff);
+	return NULL;
+}
+
+int ipceng_dispatch_start(struct ipceng *eng, int nthreads)
+{
+	if (eng->dispatch_nthreads > 0) {
+		ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to start dispatcher: already started");
+		return -1;
+	}
+	if (nthreads <= 0)
+		nthreads = IPCENG_DEFAULT_DISPATCH_THREADS;
+
+	eng->dispatch_threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+	if (eng->dispatch_threads == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to start dispatcher: out of memory");
+		return -1;
+	}
+	for (eng->dispatch_nthreads = 0; eng->dispatch_nthreads < nthreads; eng->dispatch_nthreads++) {
+		if (pthread_create(&eng->dispatch_threads[eng->dispatch_nthreads], NULL, \
+			_ipceng_dispatch_worker, eng) != 0) {
+			ipceng_dispatch_stop(eng);
+			ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to start dispatcher: pthread_create error");
+			return -1;
+		}
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_dispatch_stop(struct ipceng *eng)
+{
+	if (eng->dispatch_nthreads > 0) {
+		// stop event stays readable (level-triggered) until every thread exits
+		uint64_t one = 1;
+		int i;
+		if (write(eng->dispatch_evfd, &one, sizeof(one)) != sizeof(one)) {
+			ipceng_set_error(eng, IPCENG_ERR_DISPATCH, "failed to stop dispatcher: eventfd error");
+			return -1;
+		}
+		for (i = 0; i < eng->dispatch_nthreads; i++)
+			pthread_join(eng->dispatch_threads[i], NULL);
+		if (read(eng->dispatch_evfd, &one, sizeof(one)) != sizeof(one)) {
+			// nothing to do; the event is consumed by now anyway
+		}
+	}
+	free_safe(eng->dispatch_threads);
+	eng->dispatch_nthreads = 0;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_get_qdoor_count(struct ipceng *eng)
+{
+	return eng->qdoor_count;
+}
+
+// functions of shared memory part
+static char *_ipceng_shm_add_errmsg[] = {
+	[SHM_STAGE_OPEN] = "failed to add shm: shm_open error",
+	[SHM_STAGE_TRUNCATE] = "failed to add shm: ftruncate error",
+	[SHM_STAGE_MMAP] = "failed to add shm: mmap error",
+};
+
+static char *_ipceng_shm_open_errmsg[] = {
+	[SHM_STAGE_OPEN] = "failed to open shm: shm_open error",
+	[SHM_STAGE_TRUNCATE] = "failed to open shm: ftruncate error",
+	[SHM_STAGE_MMAP] = "failed to open shm: mmap error",
+};
+
+static int _ipceng_shm_add(struct ipceng *eng, char *shm_name, size_t size)
+{
+	// shm should not be added before
+	if (_ipceng_shm_find(eng, shm_name) != NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMADD, \
+			"failed to add shm: shm has been added already");
+		return -1;
+	}
+
+	// creating shm object
+	int shmname_len = strlen("/.shm") + strlen(shm_name) + 1;
+	char shmname[shmname_len];
+	sprintf(shmname, "/%s.shm", shm_name);
+	struct shm *new_shm = _ipceng_shm_new(&eng->mem, shmname, shm_name, size);
+	if (new_shm == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMADD, "failed to add shm: out of memory");
+		return -1;
+	}
+	// opening shm, setting its size with ftruncate and memory mapping opened
+	// shm page for later close/open support
+	enum shmstage stage = _ipceng_shm_map(new_shm);
+	if (stage != SHM_STAGE_DONE) {
+		_ipceng_shm_free(&eng->mem, new_shm);
+		ipceng_set_error(eng, IPCENG_ERR_SHMADD, _ipceng_shm_add_errmsg[stage]);
+		return -1;
+	}
+	// reserving a handle slot and adding new_shm into eng
+	_ipceng_seq_write_begin(eng);
+	int slot = _ipceng_slot_alloc(eng, &eng->shm_slots, &eng->shm_nslots, \
+		&eng->shm_free_slot, new_shm);
+	if (slot >= 0) {
+		new_shm->slot = slot;
+		list_add_tail_rcu(&new_shm->_list, &eng->shm_list);
+		eng->shm_count++;
+		new_shm->_hnode.hash = _ipceng_hash(new_shm->nickname);
+		_ipceng_htable_add(eng, &eng->shm_htable, &eng->shm_hsize, eng->shm_count, \
+			&new_shm->_hnode);
+	}
+	_ipceng_seq_write_end(eng);
+	if (slot < 0) {
+		_ipceng_shm_free(&eng->mem, new_shm);
+		ipceng_set_error(eng, IPCENG_ERR_SHMADD, "failed to add shm: unable to allocate handle slot");
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static void _ipceng_shm_retired_free(struct ipceng *eng, void *ptr)
+{
+	_ipceng_shm_free(&eng->mem, (struct shm *)ptr);
+}
+
+int ipceng_shm_add(struct ipceng *eng, char *shm_name, size_t size)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	int ret = _ipceng_shm_add(eng, shm_name, size);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	return ret;
+}
+
+int ipceng_shm_del(struct ipceng *eng, char *shm_name)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh != NULL) {
+		_ipceng_seq_write_begin(eng);
+		_ipceng_slot_free(eng->shm_slots, &eng->shm_free_slot, sh->slot);
+		list_del_rcu(&sh->_list);
+		hlist_del_rcu(&sh->_hnode.node);
+		eng->shm_count--;
+		_ipceng_seq_write_end(eng);
+		_ipceng_retire(eng, sh, _ipceng_shm_retired_free);
+	}
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_shm_open(struct ipceng *eng, char *shm_name)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh == NULL) {
+		pthread_rwlock_unlock(&eng->dispatch_lock);
+		ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, "failed to open shm: no shm found");
+		return -1;
+	}
+
+	if (sh->state != IPC_STATE_OPENED) {
+		enum shmstage stage = _ipceng_shm_map(sh);
+		if (stage != SHM_STAGE_DONE) {
+			pthread_rwlock_unlock(&eng->dispatch_lock);
+			ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, _ipceng_shm_open_errmsg[stage]);
+			return -1;
+		}
+	}
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_shm_close(struct ipceng *eng, char *shm_name)
+{
+	// readers may still be copying from the mapping, so it is retired
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh != NULL)
+		_ipceng_shm_retire_map(eng, sh);
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static int _ipceng_shm_read_into_entry(struct ipceng *eng, struct shm *sh, void *buff, size_t addr, size_t size)
+{
+	if (sh->state != IPC_STATE_OPENED) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMREAD, \
+			"failed to read from shm: shm is not opened");
+		_ipceng_stat_add(&sh->stats.rx.errors, 1, true);
+		return -1;
+	}
+	size_t last_offset = addr + size + 1;
+	if (last_offset > sh->size) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMREAD, \
+			"failed to read from shm: (addr,size) pair is out of range");
+		_ipceng_stat_add(&sh->stats.rx.errors, 1, true);
+		return -1;
+	}
+	// now everything is ok, should read the bytes
+	_IPCENG_TRACE_BEGIN(eng);
+	memcpy(buff, sh->ptr + addr, size);
+	_IPCENG_TRACE_END(eng, TRACE_SHM_READ, sh->nickname, size, 0);
+	_ipceng_stat_add(&sh->stats.rx.msgs, 1, true);
+	_ipceng_stat_add(&sh->stats.rx.bytes, size, true);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+static int _ipceng_shm_read_entry(struct ipceng *eng, struct shm *sh, char **buff, size_t addr, size_t size)
+{
+	*buff = (char *)_ipceng_alloc(&eng->mem, size);
+	if (*buff == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+	if (_ipceng_shm_read_into_entry(eng, sh, *buff, addr, size) != 0) {
+		_ipceng_free_safe(&eng->mem, *buff);
+		return -1;
+	}
+	return 0;
+}
+
+int ipceng_shm_read(struct ipceng *eng, char *shm_name, char **buff, size_t addr, size_t size)
+{
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMREAD, "failed to read from shm: no shm found");
+		return -1;
+	}
+
+	return _ipceng_shm_read_entry(eng, sh, buff, addr, size);
+}
+
+int ipceng_shm_read_h(struct ipceng *eng, ipceng_shm_t shm, char **buff, size_t addr, size_t size)
+{
+	struct shm *sh = _ipceng_shm_from_handle(eng, shm);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMREAD, "failed to read from shm: invalid shm handle");
+		return -1;
+	}
+
+	return _ipceng_shm_read_entry(eng, sh, buff, addr, size);
+}
+
+int ipceng_shm_read_into(struct ipceng *eng, ipceng_shm_t shm, void *buff, size_t addr, size_t size)
+{
+	struct shm *sh = _ipceng_shm_from_handle(eng, shm);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMREAD, "failed to read from shm: invalid shm handle");
+		return -1;
+	}
+
+	return _ipceng_shm_read_into_entry(eng, sh, buff, addr, size);
+}
+
+static int _ipceng_shm_write_entry(struct ipceng *eng, struct shm *sh, char *data, size_t addr, size_t size)
+{
+	if (sh->state != IPC_STATE_OPENED) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, \
+			"failed to read from shm: shm is not opened");
+		_ipceng_stat_add(&sh->stats.tx.errors, 1, true);
+		return -1;
+	}
+	size_t last_offset = addr + size + 1;
+	if (last_offset > sh->size) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, \
+			"failed to read from shm: (addr,size) pair is out of range");
+		_ipceng_stat_add(&sh->stats.tx.errors, 1, true);
+		return -1;
+	}
+	// now everything is ok, should read the bytes
+	_IPCENG_TRACE_BEGIN(eng);
+	memcpy(sh->ptr + addr, data, size);
+	_IPCENG_TRACE_END(eng, TRACE_SHM_WRITE, sh->nickname, size, 0);
+	_ipceng_stat_add(&sh->stats.tx.msgs, 1, true);
+	_ipceng_stat_add(&sh->stats.tx.bytes, size, true);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_shm_write(struct ipceng *eng, char *shm_name, char *data, size_t addr, size_t size)
+{
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, "failed to read from shm: no shm found");
+		return -1;
+	}
+
+	return _ipceng_shm_write_entry(eng, sh, data, addr, size);
+}
+
+int ipceng_shm_write_h(struct ipceng *eng, ipceng_shm_t shm, char *data, size_t addr, size_t size)
+{
+	struct shm *sh = _ipceng_shm_from_handle(eng, shm);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, "failed to write into shm: invalid shm handle");
+		return -1;
 	}
+
+	return _ipceng_shm_write_entry(eng, sh, data, addr, size);
 }
 
-int ipceng_qdoor_close(struct ipceng *eng, char *qdoor_name)
+ipceng_shm_t ipceng_shm_get(struct ipceng *eng, char *shm_name)
 {
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			_ipceng_qdoor_close_by_entry(iter);
+	struct shm *sh = _ipceng_shm_find(eng, shm_name);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMGET, "failed to get shm: no shm found");
+		return IPCENG_HANDLE_INVALID;
+	}
+
+	ipceng_shm_t handle = _ipceng_slot_handle(eng->shm_slots, sh->slot);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return handle;
+}
+
+// futex word at offset of an opened shm; NULL if offset is not valid
+static uint32_t *_ipceng_shm_word(struct shm *sh, size_t offset)
+{
+	if (sh == NULL || sh->state != IPC_STATE_OPENED || offset % sizeof(uint32_t) != 0 || \
+		offset + sizeof(uint32_t) > sh->size)
+		return NULL;
+	return (uint32_t *)((char *)sh->ptr + offset);
+}
+
+int ipceng_shm_wait(struct ipceng *eng, ipceng_shm_t shm, size_t offset, uint32_t expected,
+	int timeout_ms)
+{
+	uint32_t *word = _ipceng_shm_word(_ipceng_shm_from_handle(eng, shm), offset);
+	if (word == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWAIT, \
+			"failed to wait on shm: invalid shm handle, closed shm or bad offset");
+		return -1;
+	}
+
+	// spinning first, as the writer is usually just about to store
+	unsigned int i;
+	for (i = 0; i < eng->spin_count; i++) {
+		if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != expected) {
 			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
 			return 0;
 		}
+		_ipceng_cpu_relax();
 	}
-	
+
+	struct timespec tm, *deadline = NULL;
+	if (timeout_ms >= 0)
+		deadline = _ipceng_deadline_ms(timeout_ms, &tm);
+	while (_ipceng_futex_wait(word, expected, deadline) != 0) {
+		// EAGAIN: the word is not expected anymore
+		if (errno == EAGAIN)
+			break;
+		if (errno != EINTR) {
+			ipceng_set_error(eng, errno, strerror(errno));
+			return -1;
+		}
+	}
+
 	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
 	return 0;
 }
 
-int ipceng_qdoor_close_all(struct ipceng *eng)
+int ipceng_shm_wake(struct ipceng *eng, ipceng_shm_t shm, size_t offset, int count)
 {
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		_ipceng_qdoor_close_by_entry(iter);
+	uint32_t *word = _ipceng_shm_word(_ipceng_shm_from_handle(eng, shm), offset);
+	if (word == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_SHMWAKE, \
+			"failed to wake shm waiters: invalid shm handle, closed shm or bad offset");
+		return -1;
 	}
-	
+
+	int woken = _ipceng_futex_wake(word, (count > 0) ? count : INT_MAX);
+	if (woken < 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+
 	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-	return 0;
+	return woken;
 }
 
-int ipceng_qdoor_push(struct ipceng *eng, char *qdoor_name, char *msg, int prio)
+int ipceng_get_shm_count(struct ipceng *eng)
 {
-	// check for prio range
-	if (!(prio >= IPCENG_PRIO_MIN && prio <= IPCENG_PRIO_MAX)) {
-		ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, \
-			"failed to push into qdoor: out of range priority");
+	return eng->shm_count;
+}
+
+// functions of channel part
+static char *_ipceng_chan_errmsg[] = {
+	[SHM_STAGE_OPEN] = "failed to add channel: unable to open channel shm",
+	[SHM_STAGE_TRUNCATE] = "failed to add channel: unable to resize channel shm",
+	[SHM_STAGE_MMAP] = "failed to add channel: unable to map channel shm",
+};
+
+static int _ipceng_chan_add(struct ipceng *eng,
+	char *chan_name,
+	int type,
+	long cell_count,
+	long cell_size,
+	int timeout_send,
+	int timeout_recv)
+{
+	// channel should not be added already
+	if (_ipceng_chan_find(eng, chan_name) != NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, \
+			"failed to add channel: channel has been added already");
+		return -1;
+	}
+	if (type != IPCENG_CHAN_MPSC && type != IPCENG_CHAN_MPMC && type != IPCENG_CHAN_BCAST) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, "failed to add channel: unknown channel type");
 		return -1;
 	}
 
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			if (iter->sendq.timeout > 0) {
-				// sending message with timeout
-				struct timespec tm;
-				clock_gettime(CLOCK_REALTIME, &tm);
-				tm.tv_sec += iter->sendq.timeout;
-				if (mq_timedsend(iter->sendq.mqd, msg, strlen(msg)+1, prio, &tm) == 0) {
-					ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-					return 0;
-				} else {
-					ipceng_set_error(eng, errno, strerror(errno));
-					return -1;
-				}
-			} else {
-				// sending message without timeout
-				if (mq_send(iter->sendq.mqd, msg, strlen(msg)+1, prio) == 0) {
-					ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-					return 0;
-				} else {
-					ipceng_set_error(eng, errno, strerror(errno));
-					return -1;
-				}
-			}
-		}
+	// number of cells is rounded up to a power of two
+	uint64_t target_count = 2;
+	if (cell_count == -1)
+		cell_count = IPCENG_DEFAULT_CHAN_CELLS;
+	if (cell_count <= 0 || cell_count > IPCENG_CHAN_MAXCELLS) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, "failed to add channel: invalid cell count");
+		return -1;
+	}
+	while (target_count < cell_count)
+		target_count <<= 1;
+	if (cell_size == -1)
+		cell_size = IPCENG_DAFAULT_MSGSIZE;
+	if (cell_size <= 0 || cell_size > UINT32_MAX) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, "failed to add channel: invalid cell size");
+		return -1;
 	}
 
-	ipceng_set_error(eng, IPCENG_ERR_QDOORPUSH, "failed to push into qdoor: qdoor not found");
-	return -1;
+	struct chan *new_chan = (struct chan *)_ipceng_alloc(&eng->mem, sizeof(struct chan));
+	if (new_chan == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		return -1;
+	}
+	new_chan->name = _ipceng_strdup(&eng->mem, chan_name);
+	if (new_chan->name == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		_ipceng_free_safe(&eng->mem, new_chan);
+		return -1;
+	}
+	new_chan->type = type;
+	new_chan->timeout_send = timeout_send;
+	new_chan->timeout_recv = timeout_recv;
+	new_chan->msgsize = cell_size;
+	int channame_len = strlen("/.chan") + strlen(chan_name) + 1;
+	char channame[channame_len];
+	sprintf(channame, "/%s.chan", chan_name);
+	new_chan->sh = _ipceng_shm_new(&eng->mem, channame, chan_name, sizeof(struct chanhdr) + \
+		target_count * (sizeof(struct chancell) + _IPCENG_ALIGN8(cell_size)));
+	if (new_chan->sh == NULL) {
+		ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+		_ipceng_free_safe(&eng->mem, new_chan->name);
+		_ipceng_free_safe(&eng->mem, new_chan);
+		return -1;
+	}
+
+	// mapping the queue and initializing it (or joining it)
+	enum shmstage stage = _ipceng_shm_map(new_chan->sh);
+	if (stage != SHM_STAGE_DONE || \
+		_ipceng_chan_init(new_chan->sh, type, target_count, cell_size) != 0) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, (stage != SHM_STAGE_DONE) ? \
+			_ipceng_chan_errmsg[stage] : \
+			"failed to add channel: channel geometry mismatch");
+		_ipceng_shm_free(&eng->mem, new_chan->sh);
+		_ipceng_free_safe(&eng->mem, new_chan->name);
+		_ipceng_free_safe(&eng->mem, new_chan);
+		return -1;
+	}
+	// readers of a broadcast channel get messages published from now on
+	new_chan->cursor = __atomic_load_n(&((struct chanhdr *)new_chan->sh->ptr)->enqueue_pos, \
+		__ATOMIC_ACQUIRE);
+	new_chan->lost = 0;
+	// adding new_chan into eng
+	_ipceng_seq_write_begin(eng);
+	int slot = _ipceng_slot_alloc(eng, &eng->chan_slots, &eng->chan_nslots, \
+		&eng->chan_free_slot, new_chan);
+	if (slot >= 0) {
+		new_chan->slot = slot;
+		list_add_tail_rcu(&new_chan->_list, &eng->chan_list);
+		eng->chan_count++;
+		new_chan->_hnode.hash = _ipceng_hash(new_chan->name);
+		_ipceng_htable_add(eng, &eng->chan_htable, &eng->chan_hsize, eng->chan_count, \
+			&new_chan->_hnode);
+	}
+	_ipceng_seq_write_end(eng);
+	if (slot < 0) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANADD, "failed to add channel: out of handle slots");
+		_ipceng_shm_free(&eng->mem, new_chan->sh);
+		_ipceng_free_safe(&eng->mem, new_chan->name);
+		_ipceng_free_safe(&eng->mem, new_chan);
+		return -1;
+	}
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
 }
 
-int ipceng_qdoor_pop(struct ipceng *eng, char *qdoor_name, char **buff, int *prio)
+int ipceng_chan_add(struct ipceng *eng,
+	char *chan_name,
+	int type,
+	long cell_count,
+	long cell_size,
+	int timeout_send,
+	int timeout_recv)
 {
-	struct qdoor *iter;
-	list_for_each_entry(iter, &eng->qdoor_list, _list) {
-		if (!strcmp(iter->name, qdoor_name)) {
-			if (iter->recvq.timeout > 0) {
-				// receiving message with timeout
-				struct timespec tm;
-				clock_gettime(CLOCK_REALTIME, &tm);
-				tm.tv_sec += iter->recvq.timeout;
-				*buff = (char *)calloc(iter->recvq.attr.mq_msgsize, 1);
-				if (mq_timedreceive(iter->recvq.mqd, *buff, iter->recvq.attr.mq_msgsize, prio, &tm) >= 0) {
-					ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-					return 0;
-				} else {
-					free_safe(*buff);
-					ipceng_set_error(eng, errno, strerror(errno));
-					return -1;
-				}
-			} else {
-				// receiving message without timeout
-				*buff = (char *)calloc(iter->recvq.attr.mq_msgsize, 1);
-				if (mq_receive(iter->recvq.mqd, *buff, iter->recvq.attr.mq_msgsize, prio) >= 0) {
-					ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-					return 0;
-				} else {
-					free_safe(*buff);
-					ipceng_set_error(eng, errno, strerror(errno));
-					return -1;
-				}
-			}
-		}
-	}
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	int ret = _ipceng_chan_add(eng, chan_name, type, cell_count, cell_size, \
+		timeout_send, timeout_recv);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+	return ret;
+}
 
-	ipceng_set_error(eng, IPCENG_ERR_QDOORPOP, "failed to pop from qdoor: qdoor not found");
-	return -1;
+static void _ipceng_chan_free(struct ipceng *eng, void *ptr)
+{
+	struct chan *ch = (struct chan *)ptr;
+	_ipceng_shm_free(&eng->mem, ch->sh);
+	_ipceng_free_safe(&eng->mem, ch->name);
+	_ipceng_free_safe(&eng->mem, ch);
 }
 
-int ipceng_get_qdoor_count(struct ipceng *eng)
+static void _ipceng_chan_del_by_entry(struct ipceng *eng, struct chan *ch)
 {
-	return eng->qdoor_count;
+	_ipceng_seq_write_begin(eng);
+	_ipceng_slot_free(eng->chan_slots, &eng->chan_free_slot, ch->slot);
+	list_del_rcu(&ch->_list);
+	hlist_del_rcu(&ch->_hnode.node);
+	eng->chan_count--;
+	_ipceng_seq_write_end(eng);
+	shm_unlink(ch->sh->name);
+	_ipceng_retire(eng, ch, _ipceng_chan_free);
 }
 
-// functions of shared memory part
-int ipceng_shm_add(struct ipceng *eng, char *shm_name, size_t size)
+int ipceng_chan_del(struct ipceng *eng, char *chan_name)
 {
-	// shm should not be added before
-	struct shm *iter;
-	list_for_each_entry(iter, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			ipceng_set_error(eng, IPCENG_ERR_SHMADD, \
-				"failed to add shm: shm has been added already");
-			return -1;
-		}
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct chan *ch = _ipceng_chan_find(eng, chan_name);
+	if (ch != NULL)
+		_ipceng_chan_del_by_entry(eng, ch);
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_chan_del_all(struct ipceng *eng)
+{
+	pthread_rwlock_wrlock(&eng->dispatch_lock);
+	struct chan *iter, *iter_n;
+	list_for_each_entry_safe(iter, iter_n, &eng->chan_list, _list) {
+		_ipceng_chan_del_by_entry(eng, iter);
 	}
+	_ipceng_reclaim(eng, false);
+	pthread_rwlock_unlock(&eng->dispatch_lock);
 
-	// creating shm object
-	struct shm *new_shm = (struct shm *)malloc(sizeof(struct shm));
-	int shmname_len = strlen("/.shm") + strlen(shm_name) + 1;
-	new_shm->name = (char *)malloc(shmname_len);
-	sprintf(new_shm->name, "/%s.shm", shm_name);
-	new_shm->nickname = strdup(shm_name);
-	// opening shm and setting its size with ftruncate
-	new_shm->oflag = O_CREAT | O_RDWR;
-	new_shm->mode = 0664;
-	new_shm->shmd = shm_open(new_shm->name, new_shm->oflag, new_shm->mode);
-	if (new_shm->shmd == -1) {
-		free_safe(new_shm->nickname);
-		free_safe(new_shm->name);
-		free_safe(new_shm);
-		ipceng_set_error(eng, IPCENG_ERR_SHMADD, "failed to add shm: shm_open error");
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+ipceng_chan_t ipceng_chan_get(struct ipceng *eng, char *chan_name)
+{
+	struct chan *ch = _ipceng_chan_find(eng, chan_name);
+	if (ch == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANGET, "failed to get channel: channel not found");
+		return IPCENG_HANDLE_INVALID;
+	}
+
+	ipceng_chan_t handle = _ipceng_slot_handle(eng->chan_slots, ch->slot);
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return handle;
+}
+
+int ipceng_chan_push(struct ipceng *eng, ipceng_chan_t ch, const void *data, size_t len, int prio)
+{
+	struct chan *entry = _ipceng_chan_from_handle(eng, ch);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANPUSH, "failed to push into channel: invalid channel handle");
 		return -1;
 	}
-	new_shm->size = size;
-	if (ftruncate(new_shm->shmd, new_shm->size) != 0) {
-		close(new_shm->shmd);
-		free_safe(new_shm->nickname);
-		free_safe(new_shm->name);
-		free_safe(new_shm);
-		ipceng_set_error(eng, IPCENG_ERR_SHMADD, "failed to add shm: ftruncate error");
+	if (!(prio >= IPCENG_PRIO_MIN && prio <= IPCENG_PRIO_MAX)) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANPUSH, \
+			"failed to push into channel: out of range priority");
 		return -1;
 	}
-	// memory mapping opened shm page for later close/open support
-	new_shm->ptr = mmap(NULL, new_shm->size, PROT_READ | PROT_WRITE, \
-		MAP_SHARED, new_shm->shmd, 0);
-	if (new_shm->ptr == MAP_FAILED) {
-		close(new_shm->shmd);
-		free_safe(new_shm->nickname);
-		free_safe(new_shm->name);
-		free_safe(new_shm);
-		ipceng_set_error(eng, IPCENG_ERR_SHMADD, "failed to add shm: mmap error");
+
+	struct timespec tm;
+	if (_ipceng_chan_send(entry, data, len, prio, _ipceng_deadline(entry->timeout_send, &tm), \
+		eng->spin_count) != 0) {
+		ipceng_set_error(eng, errno, strerror(errno));
 		return -1;
 	}
-	new_shm->state = IPC_STATE_OPENED;
-	// adding new_shm into eng
-	list_add_tail(&new_shm->_list, &eng->shm_list);
-	eng->shm_count++;
 
 	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
 	return 0;
 }
 
-int ipceng_shm_del(struct ipceng *eng, char *shm_name)
+int ipceng_chan_pop(struct ipceng *eng, ipceng_chan_t ch, void *buff, size_t cap,
+	size_t *len, int *prio)
+{
+	struct ipceng_msgv msgv = {buff, 0, cap, 0};
+	if (ipceng_chan_popv(eng, ch, &msgv, 1) != 1)
+		return -1;
+	if (len)
+		*len = msgv.len;
+	if (prio)
+		*prio = msgv.prio;
+	return 0;
+}
+
+int ipceng_chan_popv(struct ipceng *eng, ipceng_chan_t ch, struct ipceng_msgv *msgv, int count)
 {
-	struct shm *iter, *iter_n;
-	list_for_each_entry_safe(iter, iter_n, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			munmap(iter->ptr, iter->size);
-			close(iter->shmd);
-			list_del(&iter->_list);
-			free_safe(iter->nickname);
-			free_safe(iter->name);
-			free_safe(iter);
-			eng->shm_count--;
+	struct chan *entry = _ipceng_chan_from_handle(eng, ch);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_CHANPOP, "failed to pop from channel: invalid channel handle");
+		return -1;
+	}
+
+	// same as ipceng_qdoor_popv: waiting just for the first message
+	struct timespec tm;
+	struct timespec *deadline = _ipceng_deadline(entry->timeout_recv, &tm);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (msgv[i].cap < entry->msgsize) {
+			ipceng_set_error(eng, IPCENG_ERR_CHANPOP, \
+				"failed to pop from channel: buffer is smaller than channel message size");
+			break;
+		}
+		ssize_t len = _ipceng_chan_recv(entry, msgv[i].buff, &msgv[i].prio, deadline, \
+			eng->spin_count);
+		if (len < 0) {
+			ipceng_set_error(eng, errno, strerror(errno));
 			break;
 		}
+		msgv[i].len = len;
+		deadline = NULL;
+	}
+	if (i == 0 && count > 0)
+		return -1;
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return i;
+}
+
+size_t ipceng_chan_msgsize(struct ipceng *eng, ipceng_chan_t ch)
+{
+	struct chan *entry = _ipceng_chan_from_handle(eng, ch);
+	size_t size = entry ? entry->msgsize : 0;
+	// no error state is set, but the lookup is done
+	_ipceng_read_leave(eng);
+	return size;
+}
+
+uint64_t ipceng_chan_lost(struct ipceng *eng, ipceng_chan_t ch)
+{
+	struct chan *entry = _ipceng_chan_from_handle(eng, ch);
+	uint64_t lost = entry ? entry->lost : 0;
+	_ipceng_read_leave(eng);
+	return lost;
+}
+
+int ipceng_get_chan_count(struct ipceng *eng)
+{
+	return eng->chan_count;
+}
+
+// filling out with the counters of st
+static void _ipceng_stats_fill(struct ipceng_stats *out, const char *name, int kind,
+	struct iostats *st)
+{
+	memset(out, 0, sizeof(struct ipceng_stats));
+	strncpy(out->name, name, IPCENG_STATS_NAMELEN - 1);
+	out->kind = kind;
+	out->tx_msgs = __atomic_load_n(&st->tx.msgs, __ATOMIC_RELAXED);
+	out->tx_bytes = __atomic_load_n(&st->tx.bytes, __ATOMIC_RELAXED);
+	out->tx_again = __atomic_load_n(&st->tx.again, __ATOMIC_RELAXED);
+	out->tx_timeout = __atomic_load_n(&st->tx.timeout, __ATOMIC_RELAXED);
+	out->tx_errors = __atomic_load_n(&st->tx.errors, __ATOMIC_RELAXED);
+	out->rx_msgs = __atomic_load_n(&st->rx.msgs, __ATOMIC_RELAXED);
+	out->rx_bytes = __atomic_load_n(&st->rx.bytes, __ATOMIC_RELAXED);
+	out->rx_again = __atomic_load_n(&st->rx.again, __ATOMIC_RELAXED);
+	out->rx_timeout = __atomic_load_n(&st->rx.timeout, __ATOMIC_RELAXED);
+	out->rx_errors = __atomic_load_n(&st->rx.errors, __ATOMIC_RELAXED);
+}
+
+// raising *max to depth, if it is higher
+static inline long _ipceng_stats_max(long *max, long depth)
+{
+	long cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while (depth > cur && !__atomic_compare_exchange_n(max, &cur, depth, true, \
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return (depth > cur) ? depth : cur;
+}
+
+// bytes waiting in the ring of sh
+static inline long _ipceng_ring_depth(struct shm *sh)
+{
+	struct ringhdr *hdr = (struct ringhdr *)sh->ptr;
+	uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+	return (long)(__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) - tail);
+}
+
+static void _ipceng_qdoor_stats(struct qdoor *qd, struct ipceng_stats *out)
+{
+	_ipceng_stats_fill(out, qd->name, IPCENG_STATS_QDOOR, &qd->stats);
+	if (qd->type == QDOOR_TYPE_RING) {
+		if (qd->recvq.state == IPC_STATE_OPENED)
+			out->depth = _ipceng_ring_depth(qd->recvr);
+		if (qd->sendq.state == IPC_STATE_OPENED)
+			out->peer_depth = _ipceng_ring_depth(qd->sendr);
+		out->capacity = ((struct ringhdr *)qd->recvr->ptr)->size;
+	} else {
+		struct mq_attr attr;
+		if (qd->recvq.state == IPC_STATE_OPENED && mq_getattr(qd->recvq.mqd, &attr) == 0)
+			out->depth = attr.mq_curmsgs;
+		if (qd->sendq.state == IPC_STATE_OPENED && mq_getattr(qd->sendq.mqd, &attr) == 0)
+			out->peer_depth = attr.mq_curmsgs;
+		out->capacity = qd->recvq.attr.mq_maxmsg;
+	}
+	out->depth_sampled_max = _ipceng_stats_max(&qd->stats.depth_sampled_max, out->depth);
+	out->peer_depth_sampled_max = _ipceng_stats_max(&qd->stats.peer_depth_sampled_max, \
+		out->peer_depth);
+}
+
+static void _ipceng_shm_stats(struct shm *sh, struct ipceng_stats *out)
+{
+	_ipceng_stats_fill(out, sh->nickname, IPCENG_STATS_SHM, &sh->stats);
+	out->capacity = sh->size;
+}
+
+int ipceng_stats_get(struct ipceng *eng, char *name, struct ipceng_stats *stats)
+{
+	struct qdoor *qd = _ipceng_qdoor_find(eng, name);
+	if (qd != NULL) {
+		_ipceng_qdoor_stats(qd, stats);
+		ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+		return 0;
+	}
+	struct shm *sh = _ipceng_shm_find(eng, name);
+	if (sh == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_STATS, "failed to get stats: no qdoor or shm found");
+		return -1;
 	}
 
+	_ipceng_shm_stats(sh, stats);
 	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
 	return 0;
 }
 
-int ipceng_shm_open(struct ipceng *eng, char *shm_name)
+int ipceng_stats_snapshot(struct ipceng *eng, struct ipceng_stats *stats, int max)
 {
-	struct shm *iter;
-	list_for_each_entry(iter, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			if (iter->state != IPC_STATE_OPENED) {
-				iter->shmd = shm_open(iter->name, iter->oflag, iter->mode);
-				if (iter->shmd == -1) {
-					ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, \
-						"failed to open shm: shm_open error");
-					return -1;
-				}
-				if (ftruncate(iter->shmd, iter->size) != 0) {
-					ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, \
-						"failed to open shm: ftruncate error");
-					close(iter->shmd);
-					return -1;
-				}
-				iter->ptr = mmap(NULL, iter->size, PROT_READ | PROT_WRITE, \
-					MAP_SHARED, iter->shmd, 0);
-				if (iter->ptr == MAP_FAILED) {
-					ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, \
-						"failed to open shm: mmap error");
-					close(iter->shmd);
-					return -1;
-				}
-				iter->state = IPC_STATE_OPENED;
-			}
-			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-			return 0;
-		}
+	int n = 0;
+	struct qdoor *qd;
+	struct shm *sh;
+	pthread_rwlock_rdlock(&eng->dispatch_lock);
+	list_for_each_entry(qd, &eng->qdoor_list, _list) {
+		if (n < max)
+			_ipceng_qdoor_stats(qd, &stats[n]);
+		n++;
+	}
+	list_for_each_entry(sh, &eng->shm_list, _list) {
+		if (n < max)
+			_ipceng_shm_stats(sh, &stats[n]);
+		n++;
 	}
+	pthread_rwlock_unlock(&eng->dispatch_lock);
 
-	ipceng_set_error(eng, IPCENG_ERR_SHMOPEN, "failed to open shm: no shm found");
-	return -1;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return n;
 }
 
-int ipceng_shm_close(struct ipceng *eng, char *shm_name)
+int ipceng_qdoor_set_latency(struct ipceng *eng, ipceng_qdoor_t qd, bool enable)
 {
-	struct shm *iter;
-	list_for_each_entry(iter, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			if (iter->state != IPC_STATE_CLOSED) {
-				close(iter->shmd);
-				munmap(iter->ptr, iter->size);
-				iter->state = IPC_STATE_CLOSED;
-			}
-			break;
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_LATENCY, "failed to set latency: invalid qdoor handle");
+		return -1;
+	}
+
+	// coalesced messages are stamped (or not) as a whole batch
+	struct timespec tm;
+	pthread_mutex_lock(&entry->batch_lock);
+	if (entry->batch && _ipceng_qdoor_flush_batch(eng, entry, \
+		_ipceng_mq_deadline(&entry->sendq, &tm)) != 0) {
+		pthread_mutex_unlock(&entry->batch_lock);
+		ipceng_set_error(eng, errno, strerror(errno));
+		return -1;
+	}
+	if (enable && entry->lat == NULL) {
+		entry->lat = (struct lathist *)_ipceng_zalloc(entry->mem, sizeof(struct lathist));
+		if (entry->lat == NULL) {
+			pthread_mutex_unlock(&entry->batch_lock);
+			ipceng_set_error(eng, ENOMEM, strerror(ENOMEM));
+			return -1;
 		}
 	}
+	entry->stamp = enable;
+	pthread_mutex_unlock(&entry->batch_lock);
 
 	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
 	return 0;
 }
 
-int ipceng_shm_read(struct ipceng *eng, char *shm_name, char **buff, size_t addr, size_t size)
+int ipceng_latency_get(struct ipceng *eng, ipceng_qdoor_t qd, struct ipceng_latency *lat)
 {
-	struct shm *iter;
-	list_for_each_entry(iter, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			if (iter->state != IPC_STATE_OPENED) {
-				ipceng_set_error(eng, IPCENG_ERR_SHMREAD, \
-					"failed to read from shm: shm is not opened");
-				return -1;
-			}
-			size_t last_offset = addr + size + 1;
-			if (last_offset > iter->size) {
-				ipceng_set_error(eng, IPCENG_ERR_SHMREAD, \
-					"failed to read from shm: (addr,size) pair is out of range");
-				return -1;
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || entry->lat == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_LATENCY, \
+			"failed to get latency: invalid qdoor handle or latency not enabled");
+		return -1;
+	}
+
+	// buckets are read once, so ranks always fall into one of them
+	struct lathist *h = entry->lat;
+	uint64_t counts[_IPCENG_LAT_BUCKETS];
+	uint64_t total = 0;
+	unsigned int i;
+	for (i = 0; i < _IPCENG_LAT_BUCKETS; i++) {
+		counts[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+	memset(lat, 0, sizeof(struct ipceng_latency));
+	lat->count = total;
+	lat->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	if (total > 0) {
+		// ranks of p50, p99 and p999, in 1/1000s
+		uint64_t *out[] = {&lat->p50, &lat->p99, &lat->p999};
+		uint64_t ranks[] = {(total * 500 + 999) / 1000, (total * 990 + 999) / 1000, \
+			(total * 999 + 999) / 1000};
+		uint64_t seen = 0;
+		int k = 0;
+		for (i = 0; i < _IPCENG_LAT_BUCKETS && k < 3; i++) {
+			seen += counts[i];
+			while (k < 3 && seen >= ranks[k]) {
+				uint64_t value = _ipceng_lat_value(i);
+				*out[k++] = (value < lat->max) ? value : lat->max;
 			}
-			// now everything is ok, should read the bytes
-			*buff = (char *)malloc(size);
-			memcpy(*buff, iter->ptr + addr, size);
-			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-			return 0;
 		}
 	}
 
-	ipceng_set_error(eng, IPCENG_ERR_SHMREAD, "failed to read from shm: no shm found");
-	return -1;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
 }
 
-int ipceng_shm_write(struct ipceng *eng, char *shm_name, char *data, size_t addr, size_t size)
+int ipceng_latency_reset(struct ipceng *eng, ipceng_qdoor_t qd)
 {
-	struct shm *iter;
-	list_for_each_entry(iter, &eng->shm_list, _list) {
-		if (!strcmp(iter->nickname, shm_name)) {
-			if (iter->state != IPC_STATE_OPENED) {
-				ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, \
-					"failed to read from shm: shm is not opened");
-				return -1;
-			}
-			size_t last_offset = addr + size + 1;
-			if (last_offset > iter->size) {
-				ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, \
-					"failed to read from shm: (addr,size) pair is out of range");
-				return -1;
-			}
-			// now everything is ok, should read the bytes
-			memcpy(iter->ptr + addr, data, size);
-			ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
-			return 0;
-		}
+	struct qdoor *entry = _ipceng_qdoor_from_handle(eng, qd);
+	if (entry == NULL || entry->lat == NULL) {
+		ipceng_set_error(eng, IPCENG_ERR_LATENCY, \
+			"failed to reset latency: invalid qdoor handle or latency not enabled");
+		return -1;
 	}
 
-	ipceng_set_error(eng, IPCENG_ERR_SHMWRITE, "failed to read from shm: no shm found");
-	return -1;
+	unsigned int i;
+	for (i = 0; i < _IPCENG_LAT_BUCKETS; i++)
+		__atomic_store_n(&entry->lat->buckets[i], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->lat->max, 0, __ATOMIC_RELAXED);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
 }
 
-int ipceng_get_shm_count(struct ipceng *eng)
+#ifdef IPCENG_TRACE
+// writing s as a json string; names are not expected to need escaping, so
+// anything which would is replaced
+static void _ipceng_trace_putname(FILE *fp, const char *s)
 {
-	return eng->shm_count;
+	fputc('"', fp);
+	for (; *s; s++)
+		fputc((*s == '"' || *s == '\\' || (unsigned char)*s < 0x20) ? '_' : *s, fp);
+	fputc('"', fp);
+}
+#endif
+
+int ipceng_trace_enable(struct ipceng *eng)
+{
+	eng->has_trace = true;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_trace_disable(struct ipceng *eng)
+{
+	eng->has_trace = false;
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return 0;
+}
+
+int ipceng_trace_dump(struct ipceng *eng, FILE *fp)
+{
+#ifdef IPCENG_TRACE
+	struct traceev *evs = (struct traceev *)malloc(_IPCENG_TRACE_EVENTS * sizeof(struct traceev));
+	if (fp == NULL || evs == NULL) {
+		free(evs);
+		ipceng_set_error(eng, IPCENG_ERR_TRACE, "failed to dump trace: no file or out of memory");
+		return -1;
+	}
+
+	int n = 0;
+	pid_t pid = getpid();
+	fprintf(fp, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", \
+		(int)pid);
+	_ipceng_trace_putname(fp, eng->name);
+	fprintf(fp, "}}");
+	struct tracering *r;
+	for (r = __atomic_load_n(&_ipceng_trace_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		// copied while the thread may keep writing; events it overwrote
+		// meanwhile (and the one being written) are dropped
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t first = (head > _IPCENG_TRACE_EVENTS) ? head - _IPCENG_TRACE_EVENTS : 0, i;
+		pid_t tid = r->tid;
+		for (i = first; i < head; i++)
+			evs[i & (_IPCENG_TRACE_EVENTS - 1)] = r->ev[i & (_IPCENG_TRACE_EVENTS - 1)];
+		uint64_t now_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t start = __atomic_load_n(&r->start, __ATOMIC_ACQUIRE);
+		if (now_head >= _IPCENG_TRACE_EVENTS && first < now_head - _IPCENG_TRACE_EVENTS + 1)
+			first = now_head - _IPCENG_TRACE_EVENTS + 1;
+		if (first < start)
+			first = start;
+		for (i = first; i < head; i++) {
+			struct traceev *ev = &evs[i & (_IPCENG_TRACE_EVENTS - 1)];
+			if (ev->eng_id != eng->id)
+				continue;
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"ipceng\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f," \
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"object\":", _ipceng_trace_names[ev->point], \
+				ev->ts / 1000.0, ev->dur / 1000.0, (int)pid, (int)tid);
+			_ipceng_trace_putname(fp, ev->name);
+			fprintf(fp, ",\"len\":%u,\"ret\":%d}}", ev->len, ev->ret);
+			n++;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	free(evs);
+
+	ipceng_set_error(eng, IPCENG_ERR_NOERROR, "no error");
+	return n;
+#else
+	ipceng_set_error(eng, IPCENG_ERR_TRACE, "failed to dump trace: built without tracepoints");
+	return -1;
+#endif
 }
@@ -5,10 +5,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <errno.h>
 #include <mqueue.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include "list.h"
 
 // errors
@@ -24,6 +26,29 @@
 #define IPCENG_ERR_SHMREAD				-9
 #define IPCENG_ERR_SHMWRITE				-10
 #define IPCENG_ERR_TERM					-11
+#define IPCENG_ERR_QDOORGET				-12
+#define IPCENG_ERR_SHMGET				-13
+#define IPCENG_ERR_WAIT					-14
+#define IPCENG_ERR_DISPATCH				-15
+#define IPCENG_ERR_CHANADD				-16
+#define IPCENG_ERR_CHANGET				-17
+#define IPCENG_ERR_CHANPUSH				-18
+#define IPCENG_ERR_CHANPOP				-19
+#define IPCENG_ERR_SHMWAIT				-20
+#define IPCENG_ERR_SHMWAKE				-21
+#define IPCENG_ERR_QDOORSPILL			-22
+#define IPCENG_ERR_MSGLOAN				-23
+#define IPCENG_ERR_MSGTAKE				-24
+#define IPCENG_ERR_CALL					-25
+#define IPCENG_ERR_COALESCE				-26
+#define IPCENG_ERR_COMPRESS				-27
+#define IPCENG_ERR_TYPED				-28
+#define IPCENG_ERR_SCHED				-29
+#define IPCENG_ERR_CREDIT				-30
+#define IPCENG_ERR_ALLOC				-31
+#define IPCENG_ERR_STATS				-32
+#define IPCENG_ERR_LATENCY				-33
+#define IPCENG_ERR_TRACE				-34
 
 // default values
 #define IPCENG_DAFAULT_MSGCOUNT		10
@@ -32,20 +57,227 @@
 #define IPCENG_PRIO_MAX				31
 #define	IPCENG_DAFAULT_PRIO			IPCENG_PRIO_MIN
 #define IPCENG_DEFAULT_TIMEOUT		3					// in seconds
+#define IPCENG_DEFAULT_HSIZE		16					// initial hash buckets
+#define IPCENG_WAIT_MAXEVENTS		64					// per ipceng_wait call
+#define IPCENG_DEFAULT_DISPATCH_THREADS	1
+#define IPCENG_DISPATCH_BATCH		32					// messages per wakeup
+#define IPCENG_DEFAULT_RINGSIZE		(64 * 1024)			// in bytes
+#define IPCENG_RING_MINSIZE			4096				// in bytes
+#define IPCENG_RING_MAXSIZE			(1L << 30)			// in bytes
+#define IPCENG_DEFAULT_CHAN_CELLS	256
+#define IPCENG_CHAN_MAXCELLS		(1L << 24)
+#define IPCENG_DEFAULT_SPIN			1024				// see ipceng_set_spin
+#define IPCENG_DEFAULT_SPILL_SLOTSIZE	(4 * 1024 * 1024)	// in bytes
+#define IPCENG_DEFAULT_SPILL_SLOTS	8
+#define IPCENG_SCHED_QUANTUM		4096				// in bytes, per unit of weight
+
+// channel types
+#define IPCENG_CHAN_MPSC			0					// many producers, one consumer
+#define IPCENG_CHAN_MPMC			1					// many producers, many consumers
+#define IPCENG_CHAN_BCAST			2					// one writer, many readers
+
+// handles; a handle refers to one qdoor/shm/channel until that is deleted
+typedef uint64_t ipceng_qdoor_t;
+typedef uint64_t ipceng_shm_t;
+typedef uint64_t ipceng_chan_t;
+#define IPCENG_HANDLE_INVALID		0
+
+// internal handle slot (defined in ipceng.c)
+struct ipceng_slot;
+
+// internal typed message handler (defined in ipceng.c)
+struct ipceng_handler;
+struct ipceng_reader;
+
+// typed message header (see ipceng_qdoor_push_typed); 24 bytes with every
+// field naturally aligned, so it takes part of one cache line and leaves the
+// rest for the payload; newer versions only append fields, and hdr_len tells
+// where the payload starts
+#define IPCENG_MSGHDR_VERSION		1
+#define IPCENG_TYPE_DEFAULT			0					// see ipceng_register_handler
+#define IPCENG_TYPE_MAX				65535
+struct ipceng_msghdr
+{
+	// IPCENG_MSGHDR_VERSION of the sender; 0 for untyped messages
+	uint8_t version;
+	// header length in bytes, payload follows it
+	uint8_t hdr_len;
+	// user flags
+	uint16_t flags;
+	// message type id, 1..IPCENG_TYPE_MAX
+	uint32_t type;
+	// payload length in bytes
+	uint32_t len;
+	// per-qdoor sequence number of typed messages of the sender, from 1
+	uint32_t seq;
+	// send time, CLOCK_REALTIME nanoseconds
+	uint64_t timestamp;
+};
+
+struct ipceng;
+
+// message callback of ipceng_qdoor_on_message; msg points into the receive
+// buffer of the dispatcher thread and is valid only until the callback returns
+typedef void (*ipceng_msg_cb)(struct ipceng *eng, ipceng_qdoor_t qd,
+	const void *msg, size_t len, int prio, void *ctx);
+
+// reply callback of ipceng_call_async; resp is valid only until the callback
+// returns
+typedef void (*ipceng_reply_cb)(struct ipceng *eng, ipceng_qdoor_t qd,
+	uint32_t call_id, const void *resp, size_t len, void *ctx);
+
+// typed message handler of ipceng_register_handler; hdr is a (aligned) copy of
+// the message header, payload (not necessarily aligned) is valid only until
+// the handler returns
+typedef void (*ipceng_handler_fn)(struct ipceng *eng, ipceng_qdoor_t qd,
+	const struct ipceng_msghdr *hdr, const void *payload, void *ctx);
+
+// credit callback of ipceng_qdoor_on_credit; credits is the number of
+// messages which can be sent now
+typedef void (*ipceng_credit_cb)(struct ipceng *eng, ipceng_qdoor_t qd,
+	unsigned int credits, void *ctx);
+
+// allocator hooks of ipceng_set_allocator; alloc returns NULL on failure and
+// free takes NULL too
+typedef void *(*ipceng_alloc_fn)(size_t size, void *ctx);
+typedef void (*ipceng_free_fn)(void *ptr, void *ctx);
+struct ipceng_allocator
+{
+	ipceng_alloc_fn alloc;
+	ipceng_free_fn free;
+	void *ctx;
+};
+
+// runtime metrics of a qdoor or a shm (see ipceng_stats_get); counters are
+// since the qdoor/shm is added, depths are sampled when the stats are taken
+// (so are their maxima: a burst drained between two samples is not seen)
+#define IPCENG_STATS_QDOOR			0
+#define IPCENG_STATS_SHM			1
+#define IPCENG_STATS_NAMELEN		64
+struct ipceng_stats
+{
+	// qdoor name or shm name (truncated to IPCENG_STATS_NAMELEN - 1 chars)
+	char name[IPCENG_STATS_NAMELEN];
+	// IPCENG_STATS_QDOOR or IPCENG_STATS_SHM
+	int kind;
+	// messages and bytes pushed/popped (shm: writes and reads)
+	uint64_t tx_msgs;
+	uint64_t tx_bytes;
+	uint64_t rx_msgs;
+	uint64_t rx_bytes;
+	// failed pushes/pops: EAGAIN, ETIMEDOUT and any other error
+	uint64_t tx_again;
+	uint64_t tx_timeout;
+	uint64_t tx_errors;
+	uint64_t rx_again;
+	uint64_t rx_timeout;
+	uint64_t rx_errors;
+	// qdoors: messages (ring qdoors: bytes) waiting to be popped and waiting
+	// for the peer to pop them, the highest of both sampled so far by
+	// ipceng_stats_get/ipceng_stats_snapshot, and how many fit (shm: size in
+	// bytes)
+	long depth;
+	long depth_sampled_max;
+	long peer_depth;
+	long peer_depth_sampled_max;
+	long capacity;
+};
+
+// one-way latency of the stamped messages popped from a qdoor (see
+// ipceng_latency_get), in nanoseconds; percentiles are within ~3% (the upper
+// end of their histogram bucket), max is exact
+struct ipceng_latency
+{
+	uint64_t count;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+// message vector entry of ipceng_qdoor_pushv/ipceng_qdoor_popv
+struct ipceng_msgv
+{
+	// message data (push) or receive buffer (pop)
+	void *buff;
+	// message length (push) or received length (pop)
+	size_t len;
+	// receive buffer size in bytes (pop)
+	size_t cap;
+	// message priority (push) or received priority (pop)
+	int prio;
+};
 
 // main structure
 struct ipceng
 {
 	char *name;
 	bool has_log;
-	int err_code;
-	char *err_msg;
+	// whether operations are traced (see ipceng_trace_enable)
+	bool has_trace;
+	// busy-wait iterations of blocked shm operations before sleeping on a futex
+	unsigned int spin_count;
+	// number of qdoors with coalescing enabled (see ipceng_qdoor_set_coalesce)
+	int coalesce_count;
+	// allocator of qdoors, shms, channels and message buffers (see
+	// ipceng_set_allocator); NULL hooks mean malloc/free
+	struct ipceng_allocator mem;
+	// typed message handlers, indexed by type id, and their number
+	struct ipceng_handler *handlers;
+	unsigned int handlers_size;
+	// scheduler: qdoor currently served by ipceng_sched_pop and whether it got
+	// its quantum for this visit
+	ipceng_qdoor_t sched_cur;
+	bool sched_granted;
+	// epoll set of receiving side of all opened qdoors
+	int epfd;
+	// callback dispatcher: epoll set of qdoors with callbacks, stop event,
+	// threads, and lock held for writing while qdoors, shms and channels are
+	// added/removed (the writer lock of the engine)
+	int dispatch_epfd;
+	int dispatch_evfd;
+	pthread_t *dispatch_threads;
+	int dispatch_nthreads;
+	pthread_rwlock_t dispatch_lock;
+	// lock-free lookups: unique id of the object, sequence count of handle
+	// slots and hash indexes (odd while a writer changes them), and epoch
+	// based reclamation of removed objects (current epoch, one record per
+	// thread using the object, and objects waiting to be freed)
+	uint64_t id;
+	unsigned int seq;
+	uint64_t epoch;
+	struct ipceng_reader *readers;
+	struct list_head retired;
 	// qdoor list and count
 	struct list_head qdoor_list;
 	int qdoor_count;
+	// qdoor hash index (keyed on qdoor name) and its number of buckets
+	struct hlist_head *qdoor_htable;
+	unsigned int qdoor_hsize;
+	// qdoor handle slots, their count and head of free slots (index + 1)
+	struct ipceng_slot *qdoor_slots;
+	unsigned int qdoor_nslots;
+	unsigned int qdoor_free_slot;
 	// shared memory list and count
 	struct list_head shm_list;
 	int shm_count;
+	// shared memory hash index (keyed on shm name) and its number of buckets
+	struct hlist_head *shm_htable;
+	unsigned int shm_hsize;
+	// shared memory handle slots, their count and head of free slots (index + 1)
+	struct ipceng_slot *shm_slots;
+	unsigned int shm_nslots;
+	unsigned int shm_free_slot;
+	// channel list and count
+	struct list_head chan_list;
+	int chan_count;
+	// channel hash index (keyed on channel name) and its number of buckets
+	struct hlist_head *chan_htable;
+	unsigned int chan_hsize;
+	// channel handle slots, their count and head of free slots (index + 1)
+	struct ipceng_slot *chan_slots;
+	unsigned int chan_nslots;
+	unsigned int chan_free_slot;
 	// internal ipceng linked list member;
 	// **this is not use by libipceng**
 	// **this is used when you want to create linked-list of engines**
@@ -57,7 +289,12 @@ struct ipceng
 /**
  * @brief      function to make a 'struct ipceng *' object; call ipceng_term
  *             after you have done with the object; use 'name' field as a
- *             reference name for sending messages
+ *             reference name for sending messages; the object can be shared
+ *             by threads: adding/deleting qdoors, shms and channels is
+ *             serialized, looking them up (by name or handle) takes no lock,
+ *             and a deleted one is freed once no thread can still use it;
+ *             each direction of a qdoor (sending or receiving) and
+ *             ipceng_sched_pop are still meant for one thread at a time
  *
  * @param      name  the name which is used as reference name for sending
  *                   messages
@@ -86,6 +323,38 @@ int ipceng_term(struct ipceng *obj);
  */
 int ipceng_log_enable(struct ipceng *obj);
 
+/**
+ * @brief      function to set how long blocked shared memory operations (ring
+ *             qdoors, channels and ipceng_shm_wait) busy-wait before sleeping
+ *             on a futex; spinning keeps wakeup latency low when the other side
+ *             is just about to act, sleeping saves cpu when it is not
+ *
+ * @param      obj         target ipc engine object
+ * @param[in]  spin_count  number of spin iterations; 0 = sleep at once
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_set_spin(struct ipceng *obj, unsigned int spin_count);
+
+/**
+ * @brief      function to plug an allocator into the engine; qdoors, shms,
+ *             channels and message buffers (pop and shm read buffers) are
+ *             allocated by it from then on, the bookkeeping of the engine
+ *             itself stays on malloc; it can be changed only while the engine
+ *             has no qdoors, shms or channels, and buffers got before should
+ *             be released before
+ *
+ * @param      obj      target ipc engine object
+ * @param[in]  alloc    allocation hook; NULL (with free_fn) = malloc/free
+ * @param[in]  free_fn  release hook, called with NULL too
+ * @param      ctx      user pointer passed to the hooks
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_set_allocator(struct ipceng *obj, ipceng_alloc_fn alloc, ipceng_free_fn free_fn, void *ctx);
+
 /**
  * @brief      function to disable logging into stderr
  *
@@ -101,7 +370,9 @@ int ipceng_log_disable(struct ipceng *obj);
  *
  * @param      obj   target ipc engine object
  *
- * @return     last error code in the object
+ * @return     last error code of the calling thread in the object (error
+ *             state is kept per thread, so threads sharing an object do not
+ *             see each other's errors)
  */
 int ipceng_errno(struct ipceng *obj);
 
@@ -110,10 +381,20 @@ int ipceng_errno(struct ipceng *obj);
  *
  * @param      obj   target ipc engine object
  *
- * @return     last error message in the object
+ * @return     last error message of the calling thread in the object; it
+ *             is static, so it must not be freed or modified
  */
 char *ipceng_errmsg(struct ipceng *obj);
 
+/**
+ * @brief      get the generic message of an error code
+ *
+ * @param[in]  code  IPCENG_ERR_* code or errno value
+ *
+ * @return     static error message, never NULL
+ */
+const char *ipceng_strerror(int code);
+
 /**
  * @brief      function to add and open a new qdoor to ipc engine object
  *
@@ -156,6 +437,45 @@ int ipceng_qdoor_add(struct ipceng *obj,
 #define ipceng_qdoor_add_simple(obj, qdoor_name) \
 	ipceng_qdoor_add(obj, qdoor_name, -1, -1, IPCENG_DEFAULT_TIMEOUT, IPCENG_DEFAULT_TIMEOUT)
 
+/**
+ * @brief      function to add and open a new qdoor backed by a pair of lock-free
+ *             single-producer/single-consumer rings in shared memory instead of
+ *             posix message queues; it is used with the same push/pop functions
+ *             but skips the kernel on the message path; messages are delivered
+ *             in FIFO order (priority is carried along and reported on pop, but
+ *             does not reorder messages); ring qdoors are not reported by
+ *             ipceng_wait and can not have message callbacks; both sides should
+ *             add the qdoor with the same ring_size
+ *
+ * @param      obj           ipc engine object
+ * @param      qdoor_name    to-be-added qdoor name (same as ipceng_qdoor_add)
+ * @param[in]  ring_size     size of each ring in bytes, rounded up to a power of
+ *                           two (at least IPCENG_RING_MINSIZE, at most
+ *                           IPCENG_RING_MAXSIZE); max message size is almost
+ *                           half of it; use -1 for internal default
+ * @param[in]  timeout_send  timeout for sending side; <= 0 = never wait
+ * @param[in]  timeout_recv  timeout for receiving side; <= 0 = never wait
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_add_ring(struct ipceng *obj,
+	char *qdoor_name,
+	long ring_size,
+	int timeout_send,
+	int timeout_recv);
+
+/**
+ * @brief      macro to use ipceng_qdoor_add_ring in simple mode
+ *
+ * @param      obj         ipc engine object
+ * @param      qdoor_name  to-be-added qdoor name
+ *
+ * @return     exactly same as ipceng_qdoor_add_ring
+ */
+#define ipceng_qdoor_add_ring_simple(obj, qdoor_name) \
+	ipceng_qdoor_add_ring(obj, qdoor_name, -1, IPCENG_DEFAULT_TIMEOUT, IPCENG_DEFAULT_TIMEOUT)
+
 /**
  * @brief      function to delete a qdoor
  *
@@ -249,9 +569,10 @@ int ipceng_qdoor_push(struct ipceng *obj, char *qdoor_name, char *msg, int prio)
 #define ipceng_qdoor_send_simple(obj, qdoor_name, msg) ipceng_qdoor_push(obj, qdoor_name, msg, 0)
 
 /**
- * @brief      function to pop a message from a qdoor; you should free *buff if
- *             pop is successful (return value is not 0); if prio is NULL then
- *             filling that is ignored
+ * @brief      function to pop a message from a qdoor; you should release *buff
+ *             with ipceng_buf_release (or free it, if neither an allocator nor
+ *             a buffer pool is set) if pop is successful (return value is not
+ *             0); if prio is NULL then filling that is ignored
  *
  * @param      obj         ipc engine object
  * @param      qdoor_name  target qdoor name
@@ -291,100 +612,1190 @@ int ipceng_qdoor_pop(struct ipceng *obj, char *qdoor_name, char **buff, int *pri
 #define ipceng_qdoor_recv_simple(obj, qdoor_name, buff) ipceng_qdoor_pop(obj, qdoor_name, buff, NULL)
 
 /**
- * @brief      function to get current number of qdoors in the object; this is
- *             equivalent to obj->qdoor_count
+ * @brief      function to get a handle of an added qdoor; the handle skips name
+ *             resolution in ipceng_qdoor_*_h functions; it stays valid across
+ *             ipceng_qdoor_close/ipceng_qdoor_open and gets invalid as soon as
+ *             the qdoor is deleted (later calls with it fail safely)
+ *
+ * @param      obj         ipc engine object
+ * @param      qdoor_name  target qdoor name
+ *
+ * @return     IPCENG_HANDLE_INVALID = failed (check ipceng_errmsg() or
+ *             ipceng_errno()), otherwise the qdoor handle
+ */
+ipceng_qdoor_t ipceng_qdoor_get(struct ipceng *obj, char *qdoor_name);
+
+/**
+ * @brief      same as ipceng_qdoor_push but with a qdoor handle
  *
  * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      msg   target message
+ * @param[in]  prio  message priority
  *
- * @return     number of current qdoor_count
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
  */
-int ipceng_get_qdoor_count(struct ipceng *obj);
+int ipceng_qdoor_push_h(struct ipceng *obj, ipceng_qdoor_t qd, char *msg, int prio);
+
 /**
- * @brief      function to add and/or create a new shared memory; note that
- *             'name' should not be added already
+ * @brief      function to push binary data into a qdoor; data is sent as is
+ *             (exactly len bytes, no NUL terminator needed or added), so the
+ *             receiver gets the same length back from ipceng_qdoor_pop_into
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
- * @param[in]  size      target shared memory size
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      data  target data
+ * @param[in]  len   data length in bytes; should not exceed qdoor message size
+ * @param[in]  prio  message priority
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_add(struct ipceng *obj, char *shm_name, size_t size);
+int ipceng_qdoor_push_bin(struct ipceng *obj, ipceng_qdoor_t qd, const void *data, size_t len, int prio);
 
 /**
- * @brief      function to delete a shared memory
+ * @brief      same as ipceng_qdoor_pop but with a qdoor handle; you should
+ *             release *buff if pop is successful (see ipceng_qdoor_pop)
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      buff  target message
+ * @param[in]  prio  priority of received message
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_del(struct ipceng *obj, char *shm_name);
+int ipceng_qdoor_pop_h(struct ipceng *obj, ipceng_qdoor_t qd, char **buff, int *prio);
 
 /**
- * @brief      function to open a shared memory
+ * @brief      function to give a qdoor a pool of receive buffers; buffers of
+ *             ipceng_qdoor_pop/ipceng_qdoor_pop_h are taken from a slab of
+ *             'blocks' blocks of the message size of the qdoor (allocated
+ *             once), not from the allocator; when the pool runs out, or a
+ *             message is larger than a block, the allocator is used anyway;
+ *             all buffers of the pool should be released before the pool is
+ *             changed or the qdoor is deleted
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
+ * @param      obj     ipc engine object
+ * @param[in]  qd      target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  blocks  number of buffers in the pool; 0 = no pool (default)
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_open(struct ipceng *obj, char *shm_name);
+int ipceng_qdoor_set_pool(struct ipceng *obj, ipceng_qdoor_t qd, unsigned int blocks);
 
 /**
- * @brief      function to close a shared memory
+ * @brief      function to release a buffer returned by ipceng_qdoor_pop,
+ *             ipceng_qdoor_pop_h or ipceng_shm_read; it goes back to the pool
+ *             of the qdoor if it is taken from there, otherwise to the
+ *             allocator; it can be called from any thread
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
+ * @param      obj   ipc engine object
+ * @param[in]  qd    qdoor handle the buffer is popped from (see
+ *                   ipceng_qdoor_get); IPCENG_HANDLE_INVALID for shm reads
+ * @param      buff  buffer to release; NULL is ignored
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_close(struct ipceng *obj, char *shm_name);
+int ipceng_buf_release(struct ipceng *obj, ipceng_qdoor_t qd, void *buff);
 
 /**
- * @brief      function to read an address from shared memory; should free *buff
- *             at the end
+ * @brief      function to pop a message from a qdoor directly into caller
+ *             memory; nothing is allocated, so there is nothing to free; buff
+ *             should be able to hold the largest qdoor message (see
+ *             ipceng_qdoor_msgsize)
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
- * @param      buff      buffer containing the data; should be freed after
- *                       ending up with it
- * @param[in]  addr      shm to-be-read address
- * @param[in]  size      target size; it should not exceed shm page size
- *                       (considering address offset also)
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      buff  caller buffer for the received message
+ * @param[in]  cap   size of buff in bytes
+ * @param      len   actual length of received message; ignored if NULL
+ * @param      prio  priority of received message; ignored if NULL
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_read(struct ipceng *obj, char *shm_name, char **buff, size_t addr, size_t size);
+int ipceng_qdoor_pop_into(struct ipceng *obj, ipceng_qdoor_t qd, void *buff, size_t cap,
+	size_t *len, int *prio);
 
 /**
- * @brief      function to write a fragment into shared memory
+ * @brief      function to push a batch of messages into a qdoor in one call;
+ *             the qdoor timeout applies to the whole batch, not to each message;
+ *             pushing stops at the first failed message
  *
- * @param      obj       ipc engine object
- * @param      shm_name  target shared memory name
- * @param      data      target data for writing
- * @param[in]  addr      target shm address for writing
- * @param[in]  size      target data size; it should not exceed shm page size
- *                       (considering address offset also)
+ * @param      obj    ipc engine object
+ * @param[in]  qd     target qdoor handle (see ipceng_qdoor_get)
+ * @param      msgv   messages (buff, len and prio of each entry are used)
+ * @param[in]  count  number of entries in msgv
+ *
+ * @return     -1 = nothing pushed (check ipceng_errmsg() or ipceng_errno()),
+ *             otherwise number of pushed messages; if it is less than count,
+ *             error of the failed message is kept in the object
+ */
+int ipceng_qdoor_pushv(struct ipceng *obj, ipceng_qdoor_t qd, struct ipceng_msgv *msgv, int count);
+
+/**
+ * @brief      function to pop a batch of messages from a qdoor in one call;
+ *             it waits (up to the qdoor timeout) only for the first message and
+ *             then drains whatever else is already pending, up to count
+ *             messages; each buffer should be able to hold the largest qdoor
+ *             message (see ipceng_qdoor_msgsize)
+ *
+ * @param      obj    ipc engine object
+ * @param[in]  qd     target qdoor handle (see ipceng_qdoor_get)
+ * @param      msgv   receive buffers (buff and cap of each entry are used; len
+ *                    and prio are filled)
+ * @param[in]  count  number of entries in msgv
+ *
+ * @return     -1 = nothing popped (check ipceng_errmsg() or ipceng_errno()),
+ *             otherwise number of popped messages
+ */
+int ipceng_qdoor_popv(struct ipceng *obj, ipceng_qdoor_t qd, struct ipceng_msgv *msgv, int count);
+
+/**
+ * @brief      function to pop a message from a qdoor without copying it; data
+ *             points to the message (for spilled messages, into the shared
+ *             pool of the peer) and stays valid until ipceng_qdoor_release or
+ *             the next ipceng_qdoor_pop_view on the same qdoor; if len or prio
+ *             is NULL then filling that is ignored
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      data  received message
+ * @param      len   received message length
+ * @param      prio  received message priority
  *
  * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
  *             ipceng_errno())
  */
-int ipceng_shm_write(struct ipceng *obj, char *shm_name, char *data, size_t addr, size_t size);
+int ipceng_qdoor_pop_view(struct ipceng *obj, ipceng_qdoor_t qd, const void **data,
+	size_t *len, int *prio);
 
 /**
- * @brief      function to get current number of shms in the object; this is
- *             equivalent to obj->shm_count
+ * @brief      function to release the message of the last ipceng_qdoor_pop_view,
+ *             giving its pool slot (if any) back to the sending side
  *
  * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
  *
- * @return     number of current shm_count
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
  */
-int ipceng_get_shm_count(struct ipceng *obj);
+int ipceng_qdoor_release(struct ipceng *obj, ipceng_qdoor_t qd);
+
+/**
+ * @brief      function to let a qdoor send large messages through shared memory;
+ *             messages longer than threshold are copied into a slot of a pool
+ *             ("/<self>2<peer>.pool") and only a small descriptor goes through
+ *             the qdoor, so messages are no longer limited by the qdoor max
+ *             message size; the peer needs no setup, it attaches the pool on the
+ *             first spilled message; pops copy the message out of the pool once
+ *             (ipceng_qdoor_pop_into holds back a message larger than its buffer
+ *             for a later pop), while ipceng_qdoor_pop_view does not copy it at
+ *             all; when all slots are in use, pushes wait for a free one up to
+ *             the qdoor timeout
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  qd          target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  threshold   messages longer than threshold bytes spill; messages
+ *                         above the qdoor max message size always spill
+ * @param[in]  slot_size   max length of spilled messages in bytes; use -1 for
+ *                         internal default
+ * @param[in]  slot_count  number of pool slots (max spilled messages in flight);
+ *                         use -1 for internal default
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_spill(struct ipceng *obj, ipceng_qdoor_t qd, size_t threshold,
+	long slot_size, long slot_count);
+
+/**
+ * @brief      function to let a qdoor coalesce small messages; pushed messages
+ *             are packed into one qdoor message (batch), which is sent when it
+ *             reaches bytes or msgs messages, when a message of another
+ *             priority is pushed, or when usecs microseconds passed since its
+ *             first message; the time limit is checked by pushes, by
+ *             ipceng_wait (which wakes up for it) and by ipceng_qdoor_flush, so
+ *             an engine which does neither should flush by itself; the receiving
+ *             side needs no setup, pops unpack batches transparently; messages
+ *             which do not fit in a batch are sent as before, after the batch
+ *
+ * @param      obj    ipc engine object
+ * @param[in]  qd     target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  bytes  batch size in bytes (at most the qdoor max message size;
+ *                    each message takes 4 bytes more); 0 = disable coalescing
+ * @param[in]  msgs   max number of messages per batch; 0 = no limit
+ * @param[in]  usecs  max delay of a message in microseconds; 0 = no limit
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_coalesce(struct ipceng *obj, ipceng_qdoor_t qd, size_t bytes,
+	unsigned int msgs, unsigned int usecs);
+
+/**
+ * @brief      function to send the messages coalesced so far in a qdoor (see
+ *             ipceng_qdoor_set_coalesce) right away
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno()); the messages are kept on failure
+ */
+int ipceng_qdoor_flush(struct ipceng *obj, ipceng_qdoor_t qd);
+
+/**
+ * @brief      function to let a qdoor compress messages (built-in LZ77 codec);
+ *             a pushed message longer than threshold is sent compressed if
+ *             that makes it smaller and it then fits in one qdoor message, so
+ *             messages above the qdoor max message size can be sent as long as
+ *             they compress well enough; the receiving side needs no setup, pops
+ *             decompress transparently; coalesced and spilled messages are not
+ *             compressed
+ *
+ * @param      obj        ipc engine object
+ * @param[in]  qd         target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  threshold  messages longer than threshold bytes are compressed;
+ *                        0 = disable compression
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_compress(struct ipceng *obj, ipceng_qdoor_t qd, size_t threshold);
+
+/**
+ * @brief      function to loan a buffer for a message to be sent through a
+ *             qdoor without any copy; the buffer is a slot of the spill pool of
+ *             the qdoor (see ipceng_qdoor_set_spill; a qdoor without spill gets
+ *             a default pool used only by loans), to be filled in place and
+ *             then given to ipceng_msg_publish or ipceng_msg_discard; when all
+ *             slots are in use, it waits for a free one up to the qdoor timeout
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  size  needed buffer size in bytes; at most the pool slot size
+ *
+ * @return     NULL = failed (check ipceng_errmsg() or ipceng_errno()),
+ *             otherwise loaned buffer
+ */
+void *ipceng_msg_loan(struct ipceng *obj, ipceng_qdoor_t qd, size_t size);
+
+/**
+ * @brief      function to send a loaned buffer to the peer; only the slot index
+ *             goes through the qdoor, the peer gets the buffer itself with
+ *             ipceng_msg_take (or a copy of it with the pop functions); the
+ *             buffer should not be touched after it is published, unless
+ *             publishing fails
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      msg   buffer returned by ipceng_msg_loan
+ * @param[in]  len   message length in bytes
+ * @param[in]  prio  message priority
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_msg_publish(struct ipceng *obj, ipceng_qdoor_t qd, void *msg, size_t len, int prio);
+
+/**
+ * @brief      function to give back a loaned buffer without publishing it
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      msg   buffer returned by ipceng_msg_loan
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_msg_discard(struct ipceng *obj, ipceng_qdoor_t qd, void *msg);
+
+/**
+ * @brief      function to take a message from a qdoor without copying it; a
+ *             published (or spilled) message is returned in place in the pool
+ *             of the peer, other messages are copied into a heap buffer; any
+ *             number of taken messages can be kept, each until it is given to
+ *             ipceng_msg_release; if len or prio is NULL then filling that is
+ *             ignored
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      msg   taken message
+ * @param      len   taken message length
+ * @param      prio  taken message priority
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_msg_take(struct ipceng *obj, ipceng_qdoor_t qd, const void **msg, size_t *len, int *prio);
+
+/**
+ * @brief      function to release a message taken by ipceng_msg_take, giving
+ *             its pool slot back to the peer
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    qdoor handle the message is taken from
+ * @param[in]  msg   message returned by ipceng_msg_take
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_msg_release(struct ipceng *obj, ipceng_qdoor_t qd, const void *msg);
+
+/**
+ * @brief      function to call the peer of a qdoor and wait for its reply;
+ *             the request carries a call id, so replies of many calls in
+ *             flight (see ipceng_call_async) are matched in any order; replies
+ *             of other calls received meanwhile are completed and other
+ *             messages are kept for the pop functions (they are not reported
+ *             by ipceng_wait); the request should fit in one qdoor message;
+ *             like the other functions of a qdoor, calls on the same qdoor
+ *             should not be made from several threads at once; fails on a
+ *             qdoor with a message callback (see ipceng_qdoor_on_message), use
+ *             ipceng_call_async there
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  qd          target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  req         request data
+ * @param[in]  len         request length in bytes
+ * @param      resp        reply, which should be released by the caller (see
+ *                         ipceng_buf_release); if NULL the reply is dropped
+ * @param      resp_len    reply length; if NULL then filling that is ignored
+ * @param[in]  timeout_ms  timeout of the call in milliseconds (negative =
+ *                         wait forever)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno()); a reply arriving after a timeout is dropped
+ */
+int ipceng_call(struct ipceng *obj, ipceng_qdoor_t qd, const void *req, size_t len,
+	void **resp, size_t *resp_len, int timeout_ms);
+
+/**
+ * @brief      function to call the peer of a qdoor without waiting; cb is run
+ *             when the reply is received, by ipceng_call_poll or by any other
+ *             receiving function of the qdoor
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  req   request data
+ * @param[in]  len   request length in bytes
+ * @param[in]  cb    reply callback
+ * @param      ctx   user context passed to cb
+ *
+ * @return     call id (never 0) = succeeded, 0 = failed (check ipceng_errmsg()
+ *             or ipceng_errno())
+ */
+uint32_t ipceng_call_async(struct ipceng *obj, ipceng_qdoor_t qd, const void *req, size_t len,
+	ipceng_reply_cb cb, void *ctx);
+
+/**
+ * @brief      function to complete pending calls of a qdoor; waits up to
+ *             timeout_ms for the first reply, then takes whatever else is
+ *             already received; other messages are kept for the pop functions;
+ *             fails on a qdoor with a message callback, whose replies are
+ *             completed by the dispatcher
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  qd          target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  timeout_ms  timeout in milliseconds (negative = wait forever)
+ *
+ * @return     number of completed calls = succeeded, -1 = failed (check
+ *             ipceng_errmsg() or ipceng_errno())
+ */
+int ipceng_call_poll(struct ipceng *obj, ipceng_qdoor_t qd, int timeout_ms);
+
+/**
+ * @brief      function to receive a request (or a plain message) on the
+ *             serving side of a qdoor; like ipceng_qdoor_pop_into, plus the
+ *             call id to pass to ipceng_call_reply
+ *
+ * @param      obj      ipc engine object
+ * @param[in]  qd       target qdoor handle (see ipceng_qdoor_get)
+ * @param      buff     receive buffer
+ * @param[in]  cap      receive buffer size; at least ipceng_qdoor_msgsize
+ * @param      len      received length; if NULL then filling that is ignored
+ * @param      call_id  call id of the request, 0 for a plain message
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_call_recv(struct ipceng *obj, ipceng_qdoor_t qd, void *buff, size_t cap,
+	size_t *len, uint32_t *call_id);
+
+/**
+ * @brief      function to reply to a call received by ipceng_call_recv;
+ *             replies may be sent in any order
+ *
+ * @param      obj      ipc engine object
+ * @param[in]  qd       target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  call_id  call id given by ipceng_call_recv
+ * @param[in]  resp     reply data
+ * @param[in]  len      reply length in bytes; the reply should fit in one
+ *                      qdoor message
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_call_reply(struct ipceng *obj, ipceng_qdoor_t qd, uint32_t call_id,
+	const void *resp, size_t len);
+
+/**
+ * @brief      function to get max size of messages received from a qdoor; this
+ *             is the minimum buffer size for ipceng_qdoor_pop_into
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ *
+ * @return     0 = invalid handle, otherwise max message size in bytes
+ */
+size_t ipceng_qdoor_msgsize(struct ipceng *obj, ipceng_qdoor_t qd);
+
+/**
+ * @brief      function to wait until some qdoors have pending messages; it
+ *             watches receiving side of all opened qdoors of the object at once
+ *             (with epoll), so there is no need to poll qdoors one by one
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  timeout_ms  max waiting time in milliseconds; -1 = forever, 0 =
+ *                         just check and return
+ * @param      ready       handles of ready qdoors (see ipceng_qdoor_get)
+ * @param[in]  max         max number of handles to fill in ready; at most
+ *                         IPCENG_WAIT_MAXEVENTS are reported per call
+ *
+ * @return     -1 = failed (check ipceng_errmsg() or ipceng_errno()), 0 =
+ *             timed out, otherwise number of filled handles in ready
+ */
+int ipceng_wait(struct ipceng *obj, int timeout_ms, ipceng_qdoor_t *ready, int max);
+
+/**
+ * @brief      function to get epoll file descriptor of the object; it becomes
+ *             readable whenever some qdoor has pending messages, so it can be
+ *             added into an external event loop (then call ipceng_wait with
+ *             timeout_ms = 0 to get ready qdoors)
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     epoll file descriptor; owned by the object, do not close it
+ */
+int ipceng_epoll_fd(struct ipceng *obj);
+
+/**
+ * @brief      function to set (or remove, with cb = NULL) message callback of a
+ *             qdoor; once dispatcher is started (see ipceng_dispatch_start),
+ *             messages arriving on the qdoor are drained in batches by
+ *             dispatcher threads and handed to cb without copying; messages of
+ *             one qdoor are delivered in order, one callback at a time; do not
+ *             pop the qdoor yourself; callbacks run without engine locks, so
+ *             they may add/delete/open/close qdoors and set callbacks or
+ *             handlers (messages left in the current drain of a qdoor closed,
+ *             deleted or without callback by then are dropped), but must not
+ *             call ipceng_dispatch_stop or ipceng_term; messages kept before
+ *             the callback is set (by ipceng_call or by a pop with a short
+ *             buffer) are delivered first, once the next message arrives
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  cb    message callback; NULL to remove the current one
+ * @param      ctx   user context passed to cb
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_on_message(struct ipceng *obj, ipceng_qdoor_t qd, ipceng_msg_cb cb, void *ctx);
+
+/**
+ * @brief      function to push a typed message into a qdoor; the payload goes
+ *             after a struct ipceng_msghdr (filled by the function) and the
+ *             message is marked as typed below the user data, so it can never
+ *             be mistaken for an untyped one; coalescing, compression and spill
+ *             apply as to any other message
+ *
+ * @param      obj    ipc engine object
+ * @param[in]  qd     target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  type   message type id, 1..IPCENG_TYPE_MAX
+ * @param[in]  flags  user flags of the header
+ * @param[in]  data   payload
+ * @param[in]  len    payload length in bytes
+ * @param[in]  prio   message priority
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_push_typed(struct ipceng *obj, ipceng_qdoor_t qd, uint32_t type, uint16_t flags,
+	const void *data, size_t len, int prio);
+
+/**
+ * @brief      function to pop a message from a qdoor with its typed header;
+ *             like ipceng_qdoor_pop_into, but only the payload is copied into
+ *             buff; an untyped message gives a header with version 0 and its
+ *             length only
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      hdr   message header
+ * @param      buff  receive buffer
+ * @param[in]  cap   receive buffer size; at least ipceng_qdoor_msgsize
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_pop_typed(struct ipceng *obj, ipceng_qdoor_t qd, struct ipceng_msghdr *hdr,
+	void *buff, size_t cap);
+
+/**
+ * @brief      function to set (or remove, with fn = NULL) the handler of a
+ *             message type; handlers are looked up by type id in a table, by
+ *             ipceng_qdoor_dispatch and by dispatcher threads (see
+ *             ipceng_qdoor_on_message), which hand typed messages without a
+ *             handler to the qdoor callback instead; the IPCENG_TYPE_DEFAULT
+ *             handler gets, in ipceng_qdoor_dispatch only, untyped messages and
+ *             types without a handler
+ *
+ * @param      obj      ipc engine object
+ * @param[in]  type_id  message type id, 0..IPCENG_TYPE_MAX
+ * @param[in]  fn       handler; NULL to remove the current one
+ * @param      ctx      user context passed to fn
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_register_handler(struct ipceng *obj, uint32_t type_id, ipceng_handler_fn fn, void *ctx);
+
+/**
+ * @brief      function to pop pending messages of a qdoor and hand each one to
+ *             the handler of its type (see ipceng_register_handler); waits up
+ *             to the qdoor timeout just for the first message; messages
+ *             without a handler (and no IPCENG_TYPE_DEFAULT handler) are
+ *             dropped; do not pop the same qdoor from inside a handler
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  max   max number of messages to dispatch
+ *
+ * @return     number of dispatched messages = succeeded, -1 = failed (check
+ *             ipceng_errmsg() or ipceng_errno())
+ */
+int ipceng_qdoor_dispatch(struct ipceng *obj, ipceng_qdoor_t qd, int max);
+
+/**
+ * @brief      function to set the scheduler weight of a qdoor, which puts it
+ *             under ipceng_sched_pop; among qdoors whose next messages have
+ *             the same priority, ipceng_sched_pop serves about
+ *             weight * IPCENG_SCHED_QUANTUM bytes of each qdoor per round
+ *             (deficit round robin)
+ *
+ * @param      obj     ipc engine object
+ * @param[in]  qd      target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  weight  weight of the qdoor (> 0); qdoors are not scheduled
+ *                     until it is set
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_weight(struct ipceng *obj, ipceng_qdoor_t qd, unsigned int weight);
+
+/**
+ * @brief      function to pop the next message across the qdoors of the
+ *             object which have a weight (see ipceng_qdoor_set_weight): the
+ *             highest priority message of all goes first, and qdoors whose
+ *             next messages have the same priority are served by their
+ *             weights; the next message of each ready weighted qdoor is read
+ *             ahead, so do not pop those qdoors by other functions meanwhile;
+ *             qdoors without a weight are left alone
+ *
+ * @param      obj         ipc engine object
+ * @param[out] qd          handle of the qdoor the message came from (can be NULL)
+ * @param      buff        buffer to receive the message
+ * @param[in]  cap         capacity of buff; if too small, errno is EMSGSIZE and
+ *                         the message is kept for the next call
+ * @param[out] len         length of the message (can be NULL)
+ * @param[out] prio        priority of the message (can be NULL)
+ * @param[in]  timeout_ms  timeout in milliseconds, 0 = no wait, < 0 = forever
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno(); EAGAIN if nothing arrived in time)
+ */
+int ipceng_sched_pop(struct ipceng *obj, ipceng_qdoor_t *qd, void *buff, size_t cap,
+	size_t *len, int *prio, int timeout_ms);
+
+/**
+ * @brief      function to set the credit window of a qdoor, to be called on
+ *             the sending end before messages flow; the window is published
+ *             in counters shared with the peer (a small shm per direction,
+ *             mapped by both ends when they add the qdoor), the sending end
+ *             counts the messages it sends and the receiving end those it
+ *             consumes while a window is published, so credits are window
+ *             less the messages not consumed yet; messages queued when the
+ *             window is set or changed are not accounted for; credits are
+ *             advisory, pushes are not limited by them; each transport
+ *             message counts as one (a coalesced batch is one message)
+ *
+ * @param      obj     ipc engine object
+ * @param[in]  qd      target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  window  max messages in flight, clamped to what the peer can
+ *                     hold (msg_maxcount of a mq qdoor, empty messages of a
+ *                     ring); 0 = disabled (default)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_credit(struct ipceng *obj, ipceng_qdoor_t qd, unsigned int window);
+
+/**
+ * @brief      function to get the credits of a qdoor, i.e. how many messages
+ *             can be sent without filling the peer up (see
+ *             ipceng_qdoor_set_credit); it only reads the shared counters, so
+ *             it can be called from any thread without receiving anything
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ *
+ * @return     credits (>= 0) = succeeded, -1 = failed (check ipceng_errmsg()
+ *             or ipceng_errno())
+ */
+int ipceng_qdoor_credits(struct ipceng *obj, ipceng_qdoor_t qd);
+
+/**
+ * @brief      function to wait until a qdoor has at least min credits (see
+ *             ipceng_qdoor_credits); the peer wakes the waiting thread as it
+ *             consumes messages, so a sender out of credits does not need to
+ *             poll
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  qd          target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  min         credits to wait for, at most the window
+ * @param[in]  timeout_ms  max time to wait in milliseconds; 0 = no waiting,
+ *                         -1 = forever
+ *
+ * @return     credits (>= min) = succeeded, -1 = failed (check
+ *             ipceng_errmsg() or ipceng_errno(); EAGAIN if not enough
+ *             credits came back in time)
+ */
+int ipceng_qdoor_wait_credit(struct ipceng *obj, ipceng_qdoor_t qd, unsigned int min, int timeout_ms);
+
+/**
+ * @brief      function to set a callback called whenever the peer consumed
+ *             messages and some credits are left (see
+ *             ipceng_qdoor_set_credit); it is called from
+ *             ipceng_qdoor_credits and ipceng_qdoor_wait_credit
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  cb    credit callback, NULL to remove it
+ * @param      ctx   user context passed to cb
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_on_credit(struct ipceng *obj, ipceng_qdoor_t qd, ipceng_credit_cb cb, void *ctx);
+
+/**
+ * @brief      function to start callback dispatcher threads of the object
+ *
+ * @param      obj       ipc engine object
+ * @param[in]  nthreads  number of dispatcher threads; <= 0 means
+ *                       IPCENG_DEFAULT_DISPATCH_THREADS
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_dispatch_start(struct ipceng *obj, int nthreads);
+
+/**
+ * @brief      function to stop callback dispatcher threads; it returns after
+ *             all running callbacks are finished, so it must not be called
+ *             from a callback; ipceng_term calls it too
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_dispatch_stop(struct ipceng *obj);
+
+/**
+ * @brief      function to get current number of qdoors in the object; this is
+ *             equivalent to obj->qdoor_count
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     number of current qdoor_count
+ */
+int ipceng_get_qdoor_count(struct ipceng *obj);
+/**
+ * @brief      function to add and/or create a new shared memory; note that
+ *             'name' should not be added already
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ * @param[in]  size      target shared memory size
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_add(struct ipceng *obj, char *shm_name, size_t size);
+
+/**
+ * @brief      function to delete a shared memory
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_del(struct ipceng *obj, char *shm_name);
+
+/**
+ * @brief      function to open a shared memory
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_open(struct ipceng *obj, char *shm_name);
+
+/**
+ * @brief      function to close a shared memory
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_close(struct ipceng *obj, char *shm_name);
+
+/**
+ * @brief      function to read an address from shared memory; should release
+ *             *buff at the end (see ipceng_buf_release)
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ * @param      buff      buffer containing the data; should be released after
+ *                       ending up with it
+ * @param[in]  addr      shm to-be-read address
+ * @param[in]  size      target size; it should not exceed shm page size
+ *                       (considering address offset also)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_read(struct ipceng *obj, char *shm_name, char **buff, size_t addr, size_t size);
+
+/**
+ * @brief      function to write a fragment into shared memory
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ * @param      data      target data for writing
+ * @param[in]  addr      target shm address for writing
+ * @param[in]  size      target data size; it should not exceed shm page size
+ *                       (considering address offset also)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_write(struct ipceng *obj, char *shm_name, char *data, size_t addr, size_t size);
+
+/**
+ * @brief      function to get a handle of an added shared memory; the handle
+ *             skips name resolution in ipceng_shm_*_h functions; it stays valid
+ *             across ipceng_shm_close/ipceng_shm_open and gets invalid as soon
+ *             as the shared memory is deleted
+ *
+ * @param      obj       ipc engine object
+ * @param      shm_name  target shared memory name
+ *
+ * @return     IPCENG_HANDLE_INVALID = failed (check ipceng_errmsg() or
+ *             ipceng_errno()), otherwise the shared memory handle
+ */
+ipceng_shm_t ipceng_shm_get(struct ipceng *obj, char *shm_name);
+
+/**
+ * @brief      same as ipceng_shm_read but with a shared memory handle; should
+ *             release *buff at the end
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  shm   target shared memory handle (see ipceng_shm_get)
+ * @param      buff  buffer containing the data
+ * @param[in]  addr  shm to-be-read address
+ * @param[in]  size  target size
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_read_h(struct ipceng *obj, ipceng_shm_t shm, char **buff, size_t addr, size_t size);
+
+/**
+ * @brief      function to read from shared memory directly into caller memory;
+ *             nothing is allocated, so there is nothing to free
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  shm   target shared memory handle (see ipceng_shm_get)
+ * @param      buff  caller buffer of at least size bytes
+ * @param[in]  addr  shm to-be-read address
+ * @param[in]  size  target size
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_read_into(struct ipceng *obj, ipceng_shm_t shm, void *buff, size_t addr, size_t size);
+
+/**
+ * @brief      same as ipceng_shm_write but with a shared memory handle
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  shm   target shared memory handle (see ipceng_shm_get)
+ * @param      data  target data for writing
+ * @param[in]  addr  target shm address for writing
+ * @param[in]  size  target data size
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_shm_write_h(struct ipceng *obj, ipceng_shm_t shm, char *data, size_t addr, size_t size);
+
+/**
+ * @brief      function to get current number of shms in the object; this is
+ *             equivalent to obj->shm_count
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     number of current shm_count
+ */
+int ipceng_get_shm_count(struct ipceng *obj);
+
+/**
+ * @brief      function to wait until the 32-bit word at offset of a shared
+ *             memory is not 'expected' anymore; it spins for the engine spin
+ *             count (see ipceng_set_spin) and then sleeps on a futex until it is
+ *             woken by ipceng_shm_wake (from any engine/process); like any
+ *             futex wait, it may return without the word having changed, so
+ *             callers should recheck the word
+ *
+ * @param      obj         ipc engine object
+ * @param[in]  shm         target shm handle (see ipceng_shm_get)
+ * @param[in]  offset      offset of the word in bytes; should be 4-byte aligned
+ * @param[in]  expected    value of the word to wait on
+ * @param[in]  timeout_ms  max time to sleep in milliseconds; -1 = forever
+ *
+ * @return     0 = word is not expected or waiter is woken, -1 = failed or
+ *             timed out (check ipceng_errmsg() or ipceng_errno())
+ */
+int ipceng_shm_wait(struct ipceng *obj, ipceng_shm_t shm, size_t offset, uint32_t expected,
+	int timeout_ms);
+
+/**
+ * @brief      function to wake waiters of the 32-bit word at offset of a shared
+ *             memory (see ipceng_shm_wait); the word should be changed before
+ *             waking
+ *
+ * @param      obj     ipc engine object
+ * @param[in]  shm     target shm handle (see ipceng_shm_get)
+ * @param[in]  offset  offset of the word in bytes; should be 4-byte aligned
+ * @param[in]  count   max number of waiters to wake; <= 0 = all
+ *
+ * @return     -1 = failed (check ipceng_errmsg() or ipceng_errno()), otherwise
+ *             number of woken waiters
+ */
+int ipceng_shm_wake(struct ipceng *obj, ipceng_shm_t shm, size_t offset, int count);
+
+/**
+ * @brief      function to add (create or join) a shared memory channel; unlike
+ *             a qdoor, which connects exactly two engines, a channel is one
+ *             lock-free bounded queue in shared memory ("/<chan_name>.chan")
+ *             which any number of engines can push into, so a process receiving
+ *             from many producers drains a single queue; every engine using the
+ *             channel should add it with the same type, cell_count and
+ *             cell_size; messages are delivered in FIFO order (priority is
+ *             carried along but does not reorder messages); a broadcast channel
+ *             (IPCENG_CHAN_BCAST) has one writer engine and any number of
+ *             reader engines instead, each reader gets every message published
+ *             after it added the channel, the writer never waits for readers
+ *             (publishing costs the same for any number of them) and a reader
+ *             which falls a whole channel behind skips messages to catch up
+ *             (see ipceng_chan_lost)
+ *
+ * @param      obj           ipc engine object
+ * @param      chan_name     to-be-added channel name
+ * @param[in]  type          IPCENG_CHAN_MPSC (only one engine pops),
+ *                           IPCENG_CHAN_MPMC (many engines may pop) or
+ *                           IPCENG_CHAN_BCAST (only one engine pushes, every
+ *                           engine pops its own copy)
+ * @param[in]  cell_count    max number of pending messages, rounded up to a
+ *                           power of two (at most IPCENG_CHAN_MAXCELLS); use
+ *                           -1 for internal default
+ * @param[in]  cell_size     max message size in bytes; use -1 for internal
+ *                           default
+ * @param[in]  timeout_send  timeout for pushing into a full channel in seconds;
+ *                           <= 0 = never wait; not used for IPCENG_CHAN_BCAST
+ * @param[in]  timeout_recv  timeout for popping from an empty channel in
+ *                           seconds; <= 0 = never wait
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_chan_add(struct ipceng *obj,
+	char *chan_name,
+	int type,
+	long cell_count,
+	long cell_size,
+	int timeout_send,
+	int timeout_recv);
+
+/**
+ * @brief      macro to use ipceng_chan_add in simple mode
+ *
+ * @param      obj        ipc engine object
+ * @param      chan_name  to-be-added channel name
+ * @param      type       IPCENG_CHAN_MPSC, IPCENG_CHAN_MPMC or IPCENG_CHAN_BCAST
+ *
+ * @return     exactly same as ipceng_chan_add
+ */
+#define ipceng_chan_add_simple(obj, chan_name, type) \
+	ipceng_chan_add(obj, chan_name, type, -1, -1, IPCENG_DEFAULT_TIMEOUT, IPCENG_DEFAULT_TIMEOUT)
+
+/**
+ * @brief      function to delete a channel; the channel shared memory is
+ *             unlinked, so engines adding it later get a fresh channel while
+ *             engines which added it already keep using the old one; ipceng_term
+ *             only detaches channels
+ *
+ * @param      obj        ipc engine object
+ * @param      chan_name  target channel name
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_chan_del(struct ipceng *obj, char *chan_name);
+
+/**
+ * @brief      function to delete all channels of the object
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_chan_del_all(struct ipceng *obj);
+
+/**
+ * @brief      function to get handle of a channel
+ *
+ * @param      obj        ipc engine object
+ * @param      chan_name  target channel name
+ *
+ * @return     IPCENG_HANDLE_INVALID = failed (check ipceng_errmsg() or
+ *             ipceng_errno()), otherwise channel handle
+ */
+ipceng_chan_t ipceng_chan_get(struct ipceng *obj, char *chan_name);
+
+/**
+ * @brief      function to push len bytes of data into a channel as one message;
+ *             it is safe to push into the same channel from many engines
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  ch    target channel handle (see ipceng_chan_get)
+ * @param[in]  data  message data
+ * @param[in]  len   message length in bytes
+ * @param[in]  prio  message priority
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_chan_push(struct ipceng *obj, ipceng_chan_t ch, const void *data, size_t len, int prio);
+
+/**
+ * @brief      function to pop a message from a channel into a caller buffer;
+ *             buff should be able to hold the largest channel message (see
+ *             ipceng_chan_msgsize); if len or prio is NULL then filling that is
+ *             ignored
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  ch    target channel handle (see ipceng_chan_get)
+ * @param      buff  receive buffer
+ * @param[in]  cap   receive buffer size in bytes
+ * @param      len   received message length
+ * @param      prio  received message priority
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_chan_pop(struct ipceng *obj, ipceng_chan_t ch, void *buff, size_t cap,
+	size_t *len, int *prio);
+
+/**
+ * @brief      function to pop a batch of messages from a channel in one call;
+ *             same as ipceng_qdoor_popv but for channels
+ *
+ * @param      obj    ipc engine object
+ * @param[in]  ch     target channel handle (see ipceng_chan_get)
+ * @param      msgv   receive buffers (buff and cap of each entry are used; len
+ *                    and prio are filled)
+ * @param[in]  count  number of entries in msgv
+ *
+ * @return     -1 = nothing popped (check ipceng_errmsg() or ipceng_errno()),
+ *             otherwise number of popped messages
+ */
+int ipceng_chan_popv(struct ipceng *obj, ipceng_chan_t ch, struct ipceng_msgv *msgv, int count);
+
+/**
+ * @brief      function to get max size of messages of a channel; this is the
+ *             minimum buffer size for ipceng_chan_pop
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  ch    target channel handle (see ipceng_chan_get)
+ *
+ * @return     0 = invalid handle, otherwise max message size in bytes
+ */
+size_t ipceng_chan_msgsize(struct ipceng *obj, ipceng_chan_t ch);
+
+/**
+ * @brief      function to get current number of channels in the object; this is
+ *             equivalent to obj->chan_count
+ *
+ * @param      obj   ipc engine object
+ *
+ * @return     number of current chan_count
+ */
+int ipceng_get_chan_count(struct ipceng *obj);
+
+/**
+ * @brief      function to get number of messages a reader of a broadcast
+ *             channel has skipped, because it fell behind the writer by more
+ *             than the channel cell count
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  ch    target channel handle (see ipceng_chan_get)
+ *
+ * @return     number of lost messages since the channel is added
+ */
+uint64_t ipceng_chan_lost(struct ipceng *obj, ipceng_chan_t ch);
+
+/**
+ * @brief      function to get runtime metrics of a qdoor or a shm (qdoors are
+ *             looked up first); counters are kept on every push/pop (shm:
+ *             read/write) at the cost of a few plain stores, queue depths are
+ *             taken now (mq_getattr for mq qdoors) and only then compared to
+ *             their sampled maxima
+ *
+ * @param      obj    ipc engine object
+ * @param      name   target qdoor name or shm name
+ * @param      stats  filled metrics
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_stats_get(struct ipceng *obj, char *name, struct ipceng_stats *stats);
+
+/**
+ * @brief      function to take metrics of all qdoors and then all shms of the
+ *             object at once, e.g. for periodic scraping (see
+ *             ipceng_stats_get); qdoors and shms are not added/deleted
+ *             meanwhile
+ *
+ * @param      obj    ipc engine object
+ * @param      stats  filled metrics, one entry per qdoor/shm
+ * @param[in]  max    number of entries in stats
+ *
+ * @return     number of qdoors and shms (>= 0; only max of them are filled if
+ *             it is greater) = succeeded, -1 = failed (check ipceng_errmsg()
+ *             or ipceng_errno())
+ */
+int ipceng_stats_snapshot(struct ipceng *obj, struct ipceng_stats *stats, int max);
+
+/**
+ * @brief      function to measure one-way latency through a qdoor; while
+ *             enabled, every message pushed is stamped with its
+ *             CLOCK_MONOTONIC send time and every stamped message popped
+ *             (also by dispatcher threads) is recorded into a histogram of
+ *             the qdoor, so it should be enabled on both sides; a stamped
+ *             message takes 24 more bytes of the peer max message size (8 if
+ *             it is coalesced); call requests and replies are not stamped
+ *
+ * @param      obj     ipc engine object
+ * @param[in]  qd      target qdoor handle (see ipceng_qdoor_get)
+ * @param[in]  enable  true = stamp and record, false = stop (the histogram is
+ *                     kept)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_qdoor_set_latency(struct ipceng *obj, ipceng_qdoor_t qd, bool enable);
+
+/**
+ * @brief      function to get p50/p99/p999/max one-way latency of the
+ *             messages popped from a qdoor since latency is enabled or last
+ *             reset (see ipceng_qdoor_set_latency)
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ * @param      lat   filled latency; all 0 if no message is recorded
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_latency_get(struct ipceng *obj, ipceng_qdoor_t qd, struct ipceng_latency *lat);
+
+/**
+ * @brief      function to clear the latency histogram of a qdoor, e.g. after
+ *             each scrape; messages popped meanwhile by another thread may
+ *             be lost or kept
+ *
+ * @param      obj   ipc engine object
+ * @param[in]  qd    target qdoor handle (see ipceng_qdoor_get)
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_latency_reset(struct ipceng *obj, ipceng_qdoor_t qd);
+
+/**
+ * @brief      function to enable tracing of qdoor push/pop/add/del and shm
+ *             read/write of the object (see ipceng_trace_dump); disabled by
+ *             default, and tracepoints are only built in with the TRACE cmake
+ *             option (IPCENG_TRACE defined)
+ *
+ * @param      obj   target ipc engine object
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_trace_enable(struct ipceng *obj);
+
+/**
+ * @brief      function to disable tracing of the object (see
+ *             ipceng_trace_enable)
+ *
+ * @param      obj   target ipc engine object
+ *
+ * @return     0 = succeeded, -1 = failed (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_trace_disable(struct ipceng *obj);
+
+/**
+ * @brief      function to write the traced operations of the object as Chrome
+ *             trace/Perfetto JSON (complete events, ts and dur in
+ *             microseconds, one tid per thread); every thread keeps its last
+ *             4096 operations of all objects in a ring of its own, which is
+ *             written lock-free, so dumping does not stop other threads
+ *
+ * @param      obj   ipc engine object
+ * @param      fp    output file
+ *
+ * @return     number of events written (>= 0) = succeeded, -1 = failed, e.g.
+ *             built without tracepoints (check ipceng_errmsg() or
+ *             ipceng_errno())
+ */
+int ipceng_trace_dump(struct ipceng *obj, FILE *fp);
 
 #endif // !IPCENG_H
\ No newline at end of file
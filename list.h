@@ -142,6 +142,29 @@ extern void __list_del_entry(struct list_head *entry);
 extern void list_del(struct list_head *entry);
 #endif
 
+/*
+ * Variants for lists walked by lock-free readers while one writer at a time
+ * changes them: a new entry is fully set up before it is published, and a
+ * deleted entry keeps its next pointer, so a reader standing on it still gets
+ * back onto the list. Deleted entries must not be freed before such readers
+ * are done with them.
+ */
+static inline void list_add_tail_rcu(struct list_head *new, struct list_head *head)
+{
+	struct list_head *prev = head->prev;
+	new->next = head;
+	new->prev = prev;
+	__atomic_store_n(&prev->next, new, __ATOMIC_RELEASE);
+	head->prev = new;
+}
+
+static inline void list_del_rcu(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	__atomic_store_n(&entry->prev->next, entry->next, __ATOMIC_RELEASE);
+	entry->prev = LIST_POISON2;
+}
+
 /**
  * list_del_free_all - deletes all entries from list and frees them.
  * @ptr:	the &struct list_head pointer.
@@ -463,6 +486,21 @@ static inline void list_splice_tail_init(struct list_head *list,
 	     &pos->member != (head); 	\
 	     pos = list_entry(pos->member.next, typeof(*pos), member))
 
+/**
+ * list_for_each_entry_rcu - iterate over list of given type, lock-free
+ * @pos:	the type * to use as a loop cursor.
+ * @head:	the head for your list.
+ * @member:	the name of the list_struct within the struct.
+ *
+ * Safe against list_add_tail_rcu() and list_del_rcu() running meanwhile.
+ */
+#define list_for_each_entry_rcu(pos, head, member)			\
+	for (pos = list_entry(__atomic_load_n(&(head)->next, __ATOMIC_ACQUIRE), \
+		typeof(*pos), member);					\
+	     &pos->member != (head); 	\
+	     pos = list_entry(__atomic_load_n(&pos->member.next, __ATOMIC_ACQUIRE), \
+		typeof(*pos), member))
+
 /**
  * list_for_each_entry_reverse - iterate backwards over list of given type.
  * @pos:	the type * to use as a loop cursor.
@@ -660,6 +698,27 @@ static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
 	n->pprev = &h->first;
 }
 
+/* see list_add_tail_rcu/list_del_rcu */
+static inline void hlist_add_head_rcu(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+	n->next = first;
+	n->pprev = &h->first;
+	if (first)
+		first->pprev = &n->next;
+	__atomic_store_n(&h->first, n, __ATOMIC_RELEASE);
+}
+
+static inline void hlist_del_rcu(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+	__atomic_store_n(pprev, next, __ATOMIC_RELEASE);
+	if (next)
+		next->pprev = pprev;
+	n->pprev = LIST_POISON2;
+}
+
 /* next must be != NULL */
 static inline void hlist_add_before(struct hlist_node *n,
 					struct hlist_node *next)
@@ -705,6 +764,11 @@ static inline void hlist_move_list(struct hlist_head *old,
 #define hlist_for_each(pos, head) \
 	for (pos = (head)->first; pos ; pos = pos->next)
 
+/* safe against hlist_add_head_rcu() and hlist_del_rcu() running meanwhile */
+#define hlist_for_each_rcu(pos, head) \
+	for (pos = __atomic_load_n(&(head)->first, __ATOMIC_ACQUIRE); pos; \
+	     pos = __atomic_load_n(&pos->next, __ATOMIC_ACQUIRE))
+
 #define hlist_for_each_safe(pos, n, head) \
 	for (pos = (head)->first; pos && ({ n = pos->next; 1; }); \
 	     pos = n)
@@ -105,10 +105,2042 @@ int shm_test1()
 	return 0;
 }
 
+int handle_test1()
+{
+	struct ipceng *eng1 = ipceng_init("heng1");
+	struct ipceng *eng2 = ipceng_init("heng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "heng2") != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	if (ipceng_qdoor_add_simple(eng2, "heng1") != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "heng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "heng1");
+	if (qd1 == IPCENG_HANDLE_INVALID || qd2 == IPCENG_HANDLE_INVALID) {
+		printf("handle error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	char *new_msg;
+	if (ipceng_qdoor_push_h(eng1, qd1, "hello handle!", 0) != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	if (ipceng_qdoor_pop_h(eng2, qd2, &new_msg, NULL) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	printf("received message in heng2 (by handle): %s\n", new_msg);
+	free(new_msg);
+
+	// deleted qdoor should invalidate its handle, even if the name is re-added
+	ipceng_qdoor_del(eng1, "heng2");
+	ipceng_qdoor_add_simple(eng1, "heng2");
+	if (ipceng_qdoor_push_h(eng1, qd1, "stale handle", 0) == 0) {
+		printf("eng1 error: stale handle is still valid\n");
+		return -1;
+	}
+	printf("stale handle rejected: %s\n", ipceng_errmsg(eng1));
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int pop_into_test1()
+{
+	struct ipceng *eng1 = ipceng_init("peng1");
+	struct ipceng *eng2 = ipceng_init("peng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "peng2") != 0 || ipceng_qdoor_add_simple(eng2, "peng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "peng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "peng1");
+
+	char buff[IPCENG_DAFAULT_MSGSIZE];
+	size_t len;
+	int i, prio;
+	for (i = 0; i < 3; i++) {
+		if (ipceng_qdoor_push_h(eng1, qd1, "hello caller buffer!", i) != 0) {
+			printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+			return -1;
+		}
+		if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, &prio) != 0) {
+			printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+			return -1;
+		}
+		if (len != strlen("hello caller buffer!") + 1 || prio != i) {
+			printf("eng2 error: wrong length %zu or prio %d\n", len, prio);
+			return -1;
+		}
+		printf("received message in peng2 (%zu bytes, prio %d): %s\n", len, prio, buff);
+	}
+
+	// too small buffer should be rejected
+	if (ipceng_qdoor_pop_into(eng2, qd2, buff, 16, &len, NULL) == 0) {
+		printf("eng2 error: small buffer accepted\n");
+		return -1;
+	}
+
+	if (ipceng_shm_add(eng1, "peng_shm", 100) != 0 || ipceng_shm_add(eng2, "peng_shm", 100) != 0) {
+		printf("shm add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_shm_write(eng1, "peng_shm", "hello shm!", 10, strlen("hello shm!") + 1);
+	if (ipceng_shm_read_into(eng2, ipceng_shm_get(eng2, "peng_shm"), buff, 10, strlen("hello shm!") + 1) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	printf("eng2 reading shared memory into caller buffer: %s\n", buff);
+
+	ipceng_shm_del(eng1, "peng_shm");
+	ipceng_shm_del(eng2, "peng_shm");
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int bin_test1()
+{
+	struct ipceng *eng1 = ipceng_init("beng1");
+	struct ipceng *eng2 = ipceng_init("beng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "beng2") != 0 || ipceng_qdoor_add_simple(eng2, "beng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "beng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "beng1");
+
+	// packed binary struct with embedded zero bytes
+	struct { int id; char zeros[4]; double value; } out = {7, {0, 0, 0, 0}, 3.5}, in;
+	char buff[IPCENG_DAFAULT_MSGSIZE];
+	size_t len;
+	if (ipceng_qdoor_push_bin(eng1, qd1, &out, sizeof(out), 0) != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	memcpy(&in, buff, sizeof(in));
+	if (len != sizeof(out) || memcmp(&in, &out, sizeof(out))) {
+		printf("eng2 error: binary message mismatch (%zu bytes)\n", len);
+		return -1;
+	}
+	printf("received binary message in beng2 (%zu bytes): id=%d value=%.1f\n", len, in.id, in.value);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int batch_test1()
+{
+	struct ipceng *eng1 = ipceng_init("veng1");
+	struct ipceng *eng2 = ipceng_init("veng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "veng2") != 0 || ipceng_qdoor_add_simple(eng2, "veng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "veng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "veng1");
+
+	char *msgs[] = {"first", "second", "third", "fourth", "fifth"};
+	struct ipceng_msgv out[5], in[8];
+	char buffs[8][IPCENG_DAFAULT_MSGSIZE];
+	int i, count;
+	for (i = 0; i < 5; i++) {
+		out[i].buff = msgs[i];
+		out[i].len = strlen(msgs[i]) + 1;
+		out[i].prio = (i == 3) ? 5 : 0;
+	}
+	if ((count = ipceng_qdoor_pushv(eng1, qd1, out, 5)) != 5) {
+		printf("eng1 error: pushed %d: %s\n", count, ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	for (i = 0; i < 8; i++) {
+		in[i].buff = buffs[i];
+		in[i].cap = sizeof(buffs[i]);
+	}
+	// only 5 messages are pending, so popv should not wait for the other 3
+	if ((count = ipceng_qdoor_popv(eng2, qd2, in, 8)) != 5) {
+		printf("eng2 error: popped %d: %s\n", count, ipceng_errmsg(eng2));
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		printf("received batch message %d in veng2 (prio %d): %s\n", i, in[i].prio, (char *)in[i].buff);
+	if (strcmp(in[0].buff, "fourth") || strcmp(in[1].buff, "first")) {
+		printf("eng2 error: wrong batch order\n");
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int wait_test1()
+{
+	struct ipceng *hub = ipceng_init("whub");
+	struct ipceng *peers[3];
+	char *names[] = {"wpeer0", "wpeer1", "wpeer2"};
+	int i, n;
+
+	for (i = 0; i < 3; i++) {
+		peers[i] = ipceng_init(names[i]);
+		if (ipceng_qdoor_add_simple(hub, names[i]) != 0 || ipceng_qdoor_add_simple(peers[i], "whub") != 0) {
+			printf("add error: %s\n", ipceng_errmsg(hub));
+			return -1;
+		}
+	}
+
+	ipceng_qdoor_t ready[8];
+	if ((n = ipceng_wait(hub, 0, ready, 8)) != 0) {
+		printf("hub error: %d qdoors ready before any push\n", n);
+		return -1;
+	}
+
+	ipceng_qdoor_send_simple(peers[0], "whub", "from peer0");
+	ipceng_qdoor_send_simple(peers[2], "whub", "from peer2");
+	if ((n = ipceng_wait(hub, 1000, ready, 8)) != 2) {
+		printf("hub error: %d qdoors ready: %s\n", n, ipceng_errmsg(hub));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		char buff[IPCENG_DAFAULT_MSGSIZE];
+		if (ipceng_qdoor_pop_into(hub, ready[i], buff, sizeof(buff), NULL, NULL) != 0) {
+			printf("hub error: %s\n", ipceng_errmsg(hub));
+			return -1;
+		}
+		printf("hub woke up for: %s\n", buff);
+	}
+	if ((n = ipceng_wait(hub, 0, ready, 8)) != 0) {
+		printf("hub error: %d qdoors ready after draining\n", n);
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(hub);
+	ipceng_term(hub);
+	for (i = 0; i < 3; i++) {
+		ipceng_qdoor_del_all(peers[i]);
+		ipceng_term(peers[i]);
+	}
+	return 0;
+}
+
+struct dispatch_test_ctx
+{
+	int count;
+	int in_order;
+	pthread_mutex_t lock;
+};
+
+void dispatch_test_cb(struct ipceng *eng, ipceng_qdoor_t qd, const void *msg, size_t len, int prio, void *ctx)
+{
+	struct dispatch_test_ctx *c = (struct dispatch_test_ctx *)ctx;
+	pthread_mutex_lock(&c->lock);
+	if (atoi((const char *)msg) != c->count)
+		c->in_order = 0;
+	c->count++;
+	pthread_mutex_unlock(&c->lock);
+}
+
+int dispatch_test1()
+{
+	struct ipceng *eng1 = ipceng_init("deng1");
+	struct ipceng *eng2 = ipceng_init("deng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "deng2") != 0 || ipceng_qdoor_add_simple(eng2, "deng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	struct dispatch_test_ctx ctx = {0, 1, PTHREAD_MUTEX_INITIALIZER};
+	if (ipceng_qdoor_on_message(eng2, ipceng_qdoor_get(eng2, "deng1"), dispatch_test_cb, &ctx) != 0 || \
+		ipceng_dispatch_start(eng2, 2) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+
+	int i, try_count = 100;
+	char msg[16];
+	for (i = 0; i < try_count; i++) {
+		sprintf(msg, "%d", i);
+		if (ipceng_qdoor_send_simple(eng1, "deng2", msg) != 0) {
+			printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+			return -1;
+		}
+	}
+	for (i = 0; i < 1000 && ctx.count < try_count; i++)
+		usleep(1000);
+	ipceng_dispatch_stop(eng2);
+	printf("dispatched %d/%d messages to callback (%s)\n", ctx.count, try_count, \
+		ctx.in_order ? "in order" : "out of order");
+	if (ctx.count != try_count || !ctx.in_order)
+		return -1;
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+// removes its own callback and adds a qdoor, both taking the engine writer lock
+void dispatch_test_cb2(struct ipceng *eng, ipceng_qdoor_t qd, const void *msg, size_t len, int prio, void *ctx)
+{
+	struct dispatch_test_ctx *c = (struct dispatch_test_ctx *)ctx;
+	if (ipceng_qdoor_on_message(eng, qd, NULL, NULL) != 0 || ipceng_qdoor_add_simple(eng, "deng4") != 0)
+		c->in_order = 0;
+	c->count++;
+}
+
+int dispatch_test2()
+{
+	struct ipceng *eng1 = ipceng_init("deng3");
+	struct ipceng *eng2 = ipceng_init("deng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "deng2") != 0 || ipceng_qdoor_add_simple(eng2, "deng3") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	struct dispatch_test_ctx ctx = {0, 1, PTHREAD_MUTEX_INITIALIZER};
+	if (ipceng_qdoor_on_message(eng2, ipceng_qdoor_get(eng2, "deng3"), dispatch_test_cb2, &ctx) != 0 || \
+		ipceng_dispatch_start(eng2, 1) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	int i;
+	for (i = 0; i < 3; i++)
+		ipceng_qdoor_send_simple(eng1, "deng2", "stop");
+	for (i = 0; i < 1000 && ctx.count < 1; i++)
+		usleep(1000);
+	usleep(10000);
+	ipceng_dispatch_stop(eng2);
+	printf("callback of eng2 removed itself after %d message(s), %d qdoors\n", ctx.count, \
+		ipceng_get_qdoor_count(eng2));
+	if (ctx.count != 1 || !ctx.in_order || ipceng_get_qdoor_count(eng2) != 2)
+		return -1;
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int dispatch_test3()
+{
+	struct ipceng *eng1 = ipceng_init("deng5");
+	struct ipceng *eng2 = ipceng_init("deng6");
+
+	if (ipceng_qdoor_add_simple(eng1, "deng6") != 0 || ipceng_qdoor_add_simple(eng2, "deng5") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "deng5");
+
+	// a message received while waiting for a reply is kept by the call
+	if (ipceng_qdoor_send_simple(eng1, "deng6", "0") != 0 || \
+		ipceng_call(eng2, qd2, "req", 4, NULL, NULL, 20) == 0) {
+		printf("eng2 call error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+
+	// and delivered by the dispatcher ahead of the next one; calls are refused
+	// from now on
+	struct dispatch_test_ctx ctx = {0, 1, PTHREAD_MUTEX_INITIALIZER};
+	if (ipceng_qdoor_on_message(eng2, qd2, dispatch_test_cb, &ctx) != 0 || \
+		ipceng_dispatch_start(eng2, 1) != 0) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	if (ipceng_call(eng2, qd2, "req", 4, NULL, NULL, 20) == 0 || ipceng_errno(eng2) != IPCENG_ERR_CALL) {
+		printf("eng2 error: call on a dispatched qdoor accepted\n");
+		return -1;
+	}
+	ipceng_qdoor_send_simple(eng1, "deng6", "1");
+	int i;
+	for (i = 0; i < 1000 && ctx.count < 2; i++)
+		usleep(1000);
+	ipceng_dispatch_stop(eng2);
+	printf("dispatched %d message(s) kept by a call (%s)\n", ctx.count, \
+		ctx.in_order ? "in order" : "out of order");
+	if (ctx.count != 2 || !ctx.in_order)
+		return -1;
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int ring_test1()
+{
+	struct ipceng *eng1 = ipceng_init("reng1");
+	struct ipceng *eng2 = ipceng_init("reng2");
+
+	if (ipceng_qdoor_add_ring(eng1, "reng2", IPCENG_RING_MINSIZE, 1, 0) != 0 || \
+		ipceng_qdoor_add_ring(eng2, "reng1", IPCENG_RING_MINSIZE, 1, 0) != 0) {
+		printf("add error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "reng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "reng1");
+
+	// sizes out of range are rejected
+	if (ipceng_qdoor_add_ring(eng1, "reng3", -2, 0, 0) == 0 || \
+		ipceng_errno(eng1) != IPCENG_ERR_QDOORADD || \
+		ipceng_qdoor_add_ring(eng1, "reng3", 0, 0, 0) == 0 || \
+		ipceng_qdoor_add_ring(eng1, "reng3", IPCENG_RING_MAXSIZE + 1, 0, 0) == 0) {
+		printf("add error: bad ring size accepted\n");
+		return -1;
+	}
+
+	if (ipceng_qdoor_push(eng1, "reng2", "hello over ring", 3) != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	int prio;
+	char *msg = NULL;
+	if (ipceng_qdoor_pop(eng2, "reng1", &msg, &prio) != 0 || strcmp(msg, "hello over ring") || prio != 3) {
+		printf("eng2 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	printf("received ring message in reng2 (prio %d): %s\n", prio, msg);
+	free(msg);
+
+	// empty ring with zero receive timeout should fail at once
+	if (ipceng_qdoor_pop(eng2, "reng1", &msg, NULL) == 0) {
+		printf("eng2 error: pop from empty ring succeeded\n");
+		return -1;
+	}
+
+	// pushing many varying-length messages through a small ring to wrap it
+	char out[512], in[IPCENG_RING_MINSIZE];
+	size_t len;
+	int i;
+	for (i = 0; i < 2000; i++) {
+		size_t n = 1 + (i * 37) % sizeof(out);
+		memset(out, 'a' + i % 26, n);
+		if (ipceng_qdoor_push_bin(eng2, qd2, out, n, 0) != 0) {
+			printf("eng2 error at %d: %s\n", i, ipceng_errmsg(eng2));
+			return -1;
+		}
+		if (i % 3 == 2) {
+			int j;
+			for (j = 0; j < 3; j++) {
+				if (ipceng_qdoor_pop_into(eng1, qd1, in, sizeof(in), &len, NULL) != 0 || \
+					in[0] != 'a' + (i - 2 + j) % 26 || len != 1 + ((i - 2 + j) * 37) % sizeof(out)) {
+					printf("eng1 error at %d: %s\n", i, ipceng_errmsg(eng1));
+					return -1;
+				}
+			}
+		}
+	}
+
+	ipceng_qdoor_close(eng1, "reng2");
+	if (ipceng_qdoor_push_h(eng1, qd1, "closed", 0) == 0) {
+		printf("eng1 error: push into closed ring succeeded\n");
+		return -1;
+	}
+	ipceng_qdoor_open(eng1, "reng2");
+	if (ipceng_qdoor_push_h(eng1, qd1, "reopened", 0) != 0 || \
+		ipceng_qdoor_pop_h(eng2, qd2, &msg, NULL) != 0 || strcmp(msg, "reopened")) {
+		printf("reopen error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		return -1;
+	}
+	free(msg);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+#define CHAN_PRODUCERS		4
+#define CHAN_MSGS			5000
+
+struct chan_producer
+{
+	int id;
+	int type;
+	int failed;
+};
+
+void *chan_producer_run(void *arg)
+{
+	struct chan_producer *p = (struct chan_producer *)arg;
+	char name[16];
+	sprintf(name, "ceng%d", p->id);
+	struct ipceng *eng = ipceng_init(name);
+	if (ipceng_chan_add(eng, "cfanin", p->type, 64, 16, 3, 3) != 0) {
+		printf("%s add error: %s\n", name, ipceng_errmsg(eng));
+		p->failed = 1;
+		ipceng_term(eng);
+		return NULL;
+	}
+	ipceng_chan_t ch = ipceng_chan_get(eng, "cfanin");
+	int i, msg[2] = {p->id, 0};
+	for (i = 0; i < CHAN_MSGS; i++) {
+		msg[1] = i;
+		if (ipceng_chan_push(eng, ch, msg, sizeof(msg), 0) != 0) {
+			printf("%s push error: %s\n", name, ipceng_errmsg(eng));
+			p->failed = 1;
+			break;
+		}
+	}
+	ipceng_term(eng);
+	return NULL;
+}
+
+int chan_test1()
+{
+	int types[] = {IPCENG_CHAN_MPSC, IPCENG_CHAN_MPMC};
+	int t;
+	for (t = 0; t < 2; t++) {
+		struct ipceng *eng = ipceng_init("cagg");
+		// cell counts out of range are rejected
+		if (ipceng_chan_add(eng, "cfanin", types[t], -2, 16, 3, 3) == 0 || \
+			ipceng_errno(eng) != IPCENG_ERR_CHANADD || \
+			ipceng_chan_add(eng, "cfanin", types[t], IPCENG_CHAN_MAXCELLS + 1, 16, 3, 3) == 0) {
+			printf("cagg add error: bad cell count accepted\n");
+			return -1;
+		}
+		if (ipceng_chan_add(eng, "cfanin", types[t], 64, 16, 3, 3) != 0) {
+			printf("cagg add error: %s\n", ipceng_errmsg(eng));
+			return -1;
+		}
+		ipceng_chan_t ch = ipceng_chan_get(eng, "cfanin");
+
+		pthread_t threads[CHAN_PRODUCERS];
+		struct chan_producer producers[CHAN_PRODUCERS];
+		int i, next[CHAN_PRODUCERS] = {0}, total = 0;
+		for (i = 0; i < CHAN_PRODUCERS; i++) {
+			producers[i].id = i;
+			producers[i].type = types[t];
+			producers[i].failed = 0;
+			pthread_create(&threads[i], NULL, chan_producer_run, &producers[i]);
+		}
+
+		// draining the single inbound channel; messages of each producer
+		// should arrive in order
+		struct ipceng_msgv msgv[16];
+		int buffs[16][4];
+		for (i = 0; i < 16; i++) {
+			msgv[i].buff = buffs[i];
+			msgv[i].cap = sizeof(buffs[i]);
+		}
+		while (total < CHAN_PRODUCERS * CHAN_MSGS) {
+			int count = ipceng_chan_popv(eng, ch, msgv, 16);
+			if (count < 0) {
+				printf("cagg pop error after %d: %s\n", total, ipceng_errmsg(eng));
+				return -1;
+			}
+			for (i = 0; i < count; i++) {
+				int *msg = (int *)msgv[i].buff;
+				if (msgv[i].len != 2 * sizeof(int) || msg[1] != next[msg[0]]++) {
+					printf("cagg error: out of order message from producer %d\n", msg[0]);
+					return -1;
+				}
+			}
+			total += count;
+		}
+		for (i = 0; i < CHAN_PRODUCERS; i++) {
+			pthread_join(threads[i], NULL);
+			if (producers[i].failed)
+				return -1;
+		}
+		printf("drained %d messages from %d producers through one %s channel\n", total, \
+			CHAN_PRODUCERS, (types[t] == IPCENG_CHAN_MPSC) ? "mpsc" : "mpmc");
+
+		ipceng_chan_del_all(eng);
+		ipceng_term(eng);
+	}
+	return 0;
+}
+
+struct futex_waiter
+{
+	struct ipceng *eng;
+	int ret;
+};
+
+void *futex_shm_waiter_run(void *arg)
+{
+	struct futex_waiter *w = (struct futex_waiter *)arg;
+	ipceng_shm_t shm = ipceng_shm_get(w->eng, "fshm");
+	uint32_t word = 0;
+	// rechecking the word, as waits may return spuriously
+	while (word == 0) {
+		if (ipceng_shm_wait(w->eng, shm, 4, 0, 3000) != 0) {
+			w->ret = -1;
+			return NULL;
+		}
+		ipceng_shm_read_into(w->eng, shm, &word, 4, sizeof(word));
+	}
+	w->ret = word;
+	return NULL;
+}
+
+void *futex_chan_waiter_run(void *arg)
+{
+	struct futex_waiter *w = (struct futex_waiter *)arg;
+	ipceng_chan_t ch = ipceng_chan_get(w->eng, "fchan");
+	int msg;
+	w->ret = -1;
+	if (ipceng_chan_pop(w->eng, ch, &msg, sizeof(msg), NULL, NULL) == 0)
+		w->ret = msg;
+	return NULL;
+}
+
+int futex_test1()
+{
+	struct ipceng *eng1 = ipceng_init("feng1");
+	struct ipceng *eng2 = ipceng_init("feng2");
+	// no spinning, so waiters surely sleep on the futex
+	ipceng_set_spin(eng1, 0);
+	ipceng_set_spin(eng2, 0);
+
+	if (ipceng_shm_add(eng1, "fshm", 64) != 0 || ipceng_shm_add(eng2, "fshm", 64) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_shm_t shm = ipceng_shm_get(eng2, "fshm");
+	uint32_t word = 0;
+	ipceng_shm_write_h(eng2, shm, (char *)&word, 4, sizeof(word));
+	if (ipceng_shm_wait(eng2, shm, 4, 0, 50) == 0 || ipceng_errno(eng2) != ETIMEDOUT) {
+		printf("feng2 error: wait on unchanged word did not time out\n");
+		return -1;
+	}
+	if (ipceng_shm_wait(eng2, shm, 4, 7, 50) != 0 || ipceng_shm_wait(eng2, shm, 2, 0, 50) == 0) {
+		printf("feng2 error: wait on changed word or unaligned offset\n");
+		return -1;
+	}
+
+	struct futex_waiter w = {eng1, 0};
+	pthread_t thread;
+	pthread_create(&thread, NULL, futex_shm_waiter_run, &w);
+	usleep(20000);
+	word = 42;
+	ipceng_shm_write_h(eng2, shm, (char *)&word, 4, sizeof(word));
+	ipceng_shm_wake(eng2, shm, 4, 0);
+	pthread_join(thread, NULL);
+	if (w.ret != 42) {
+		printf("feng1 error: shm waiter got %d\n", w.ret);
+		return -1;
+	}
+	printf("shm waiter in feng1 woken with word %d\n", w.ret);
+
+	// consumer sleeping on an empty channel is woken by the producer
+	if (ipceng_chan_add(eng1, "fchan", IPCENG_CHAN_MPSC, 8, sizeof(int), 3, 3) != 0 || \
+		ipceng_chan_add(eng2, "fchan", IPCENG_CHAN_MPSC, 8, sizeof(int), 3, 3) != 0) {
+		printf("chan add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	pthread_create(&thread, NULL, futex_chan_waiter_run, &w);
+	usleep(20000);
+	int msg = 7;
+	ipceng_chan_push(eng2, ipceng_chan_get(eng2, "fchan"), &msg, sizeof(msg), 0);
+	pthread_join(thread, NULL);
+	if (w.ret != 7) {
+		printf("feng1 error: channel waiter got %d\n", w.ret);
+		return -1;
+	}
+	printf("channel waiter in feng1 woken with message %d\n", w.ret);
+
+	ipceng_chan_del_all(eng1);
+	ipceng_chan_del_all(eng2);
+	ipceng_shm_del(eng1, "fshm");
+	ipceng_shm_del(eng2, "fshm");
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int spill_test1()
+{
+	struct ipceng *eng1 = ipceng_init("seng1");
+	struct ipceng *eng2 = ipceng_init("seng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "seng2") != 0 || ipceng_qdoor_add_simple(eng2, "seng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "seng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "seng1");
+	if (ipceng_qdoor_set_spill(eng1, qd1, 512, 4 * 1024 * 1024, 4) != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// 2 MB message, far above the qdoor max message size
+	size_t i, big_len = 2 * 1024 * 1024;
+	unsigned char *big = (unsigned char *)malloc(big_len);
+	for (i = 0; i < big_len; i++)
+		big[i] = i * 7;
+	if (ipceng_qdoor_push_bin(eng1, qd1, big, big_len, 2) != 0) {
+		printf("eng1 error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	char *msg;
+	int prio;
+	if (ipceng_qdoor_pop_h(eng2, qd2, &msg, &prio) != 0 || prio != 2 || memcmp(msg, big, big_len)) {
+		printf("eng2 error: spilled message mismatch: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	free(msg);
+
+	// too small buffer: the message is held back for the next pop
+	char small[IPCENG_DAFAULT_MSGSIZE];
+	size_t len;
+	ipceng_qdoor_push_bin(eng1, qd1, big, big_len, 0);
+	if (ipceng_qdoor_pop_into(eng2, qd2, small, sizeof(small), &len, NULL) == 0 || \
+		ipceng_errno(eng2) != EMSGSIZE) {
+		printf("eng2 error: spilled message fitted a small buffer\n");
+		return -1;
+	}
+	const void *view;
+	if (ipceng_qdoor_pop_view(eng2, qd2, &view, &len, NULL) != 0 || len != big_len || \
+		memcmp(view, big, big_len)) {
+		printf("eng2 error: spilled view mismatch: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_release(eng2, qd2);
+	printf("received %zu bytes spilled message in seng2\n", len);
+
+	// user messages looking like internal frames pass through unchanged
+	unsigned char lookalike[24] = {0xf1, 0xc3, 0xe7, 0x9a, 2, 0, 0, 0, 5};
+	if (ipceng_qdoor_push_bin(eng1, qd1, lookalike, sizeof(lookalike), 0) != 0 || \
+		ipceng_qdoor_pop_into(eng2, qd2, small, sizeof(small), &len, NULL) != 0 || \
+		len != sizeof(lookalike) || memcmp(small, lookalike, len)) {
+		printf("eng2 error: frame-like message mismatch\n");
+		return -1;
+	}
+	free(big);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int loan_test1()
+{
+	struct ipceng *eng1 = ipceng_init("leng1");
+	struct ipceng *eng2 = ipceng_init("leng2");
+
+	if (ipceng_qdoor_add_simple(eng1, "leng2") != 0 || ipceng_qdoor_add_simple(eng2, "leng1") != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "leng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "leng1");
+
+	// more rounds than pool slots, so slots should come back on release
+	size_t msg_len = 256 * 1024, len;
+	const void *taken[3];
+	int round, i;
+	for (round = 0; round < 10; round++) {
+		for (i = 0; i < 3; i++) {
+			unsigned char *msg = (unsigned char *)ipceng_msg_loan(eng1, qd1, msg_len);
+			if (msg == NULL) {
+				printf("eng1 loan error: %s\n", ipceng_errmsg(eng1));
+				return -1;
+			}
+			memset(msg, round * 3 + i, msg_len);
+			if (ipceng_msg_publish(eng1, qd1, msg, msg_len, 0) != 0) {
+				printf("eng1 publish error: %s\n", ipceng_errmsg(eng1));
+				return -1;
+			}
+		}
+		for (i = 0; i < 3; i++) {
+			if (ipceng_msg_take(eng2, qd2, &taken[i], &len, NULL) != 0 || len != msg_len || \
+				((unsigned char *)taken[i])[msg_len - 1] != round * 3 + i) {
+				printf("eng2 take error: %s\n", ipceng_errmsg(eng2));
+				return -1;
+			}
+		}
+		for (i = 0; i < 3; i++)
+			ipceng_msg_release(eng2, qd2, taken[i]);
+	}
+	printf("took %d loaned messages of %zu bytes in leng2\n", round * 3, msg_len);
+
+	// oversized loans fail, discarded loans are reusable
+	if (ipceng_msg_loan(eng1, qd1, IPCENG_DEFAULT_SPILL_SLOTSIZE + 1) != NULL) {
+		printf("eng1 error: oversized loan succeeded\n");
+		return -1;
+	}
+	void *loaned = ipceng_msg_loan(eng1, qd1, 16);
+	if (ipceng_msg_discard(eng1, qd1, loaned) != 0 || ipceng_msg_discard(eng1, qd1, "x") == 0) {
+		printf("eng1 error: discard\n");
+		return -1;
+	}
+
+	// plain messages can be taken as well
+	if (ipceng_qdoor_push_h(eng1, qd1, "plain", 0) != 0 || \
+		ipceng_msg_take(eng2, qd2, &taken[0], &len, NULL) != 0 || strcmp(taken[0], "plain")) {
+		printf("eng2 error: plain take\n");
+		return -1;
+	}
+	ipceng_msg_release(eng2, qd2, taken[0]);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int bcast_test1()
+{
+	struct ipceng *writer = ipceng_init("bwriter");
+	struct ipceng *readers[3];
+	ipceng_chan_t rch[3];
+	char name[16];
+	int i, r, msg, prio;
+	size_t len;
+
+	if (ipceng_chan_add(writer, "bticks", IPCENG_CHAN_BCAST, 64, sizeof(int), 0, 0) != 0) {
+		printf("bwriter add error: %s\n", ipceng_errmsg(writer));
+		return -1;
+	}
+	ipceng_chan_t wch = ipceng_chan_get(writer, "bticks");
+	for (r = 0; r < 3; r++) {
+		sprintf(name, "breader%d", r);
+		readers[r] = ipceng_init(name);
+		if (ipceng_chan_add(readers[r], "bticks", IPCENG_CHAN_BCAST, 64, sizeof(int), 0, 0) != 0) {
+			printf("%s add error: %s\n", name, ipceng_errmsg(readers[r]));
+			return -1;
+		}
+		rch[r] = ipceng_chan_get(readers[r], "bticks");
+	}
+
+	// every reader gets its own copy of every message
+	for (i = 0; i < 40; i++)
+		ipceng_chan_push(writer, wch, &i, sizeof(i), i % 4);
+	for (r = 0; r < 3; r++) {
+		for (i = 0; i < 40; i++) {
+			if (ipceng_chan_pop(readers[r], rch[r], &msg, sizeof(msg), &len, &prio) != 0 || \
+				msg != i || prio != i % 4) {
+				printf("breader%d error at %d: %s\n", r, i, ipceng_errmsg(readers[r]));
+				return -1;
+			}
+		}
+		if (ipceng_chan_pop(readers[r], rch[r], &msg, sizeof(msg), &len, NULL) == 0) {
+			printf("breader%d error: read past the writer\n", r);
+			return -1;
+		}
+	}
+
+	// writer does not wait for slow readers; they skip ahead and count losses
+	for (i = 40; i < 240; i++)
+		ipceng_chan_push(writer, wch, &i, sizeof(i), 0);
+	int last = 39;
+	while (ipceng_chan_pop(readers[0], rch[0], &msg, sizeof(msg), &len, NULL) == 0) {
+		if (msg <= last) {
+			printf("breader0 error: message %d after %d\n", msg, last);
+			return -1;
+		}
+		last = msg;
+	}
+	if (last != 239 || ipceng_chan_lost(readers[0], rch[0]) == 0) {
+		printf("breader0 error: last %d, lost %llu\n", last, \
+			(unsigned long long)ipceng_chan_lost(readers[0], rch[0]));
+		return -1;
+	}
+	printf("overrun reader in breader0 lost %llu messages and caught up\n", \
+		(unsigned long long)ipceng_chan_lost(readers[0], rch[0]));
+
+	for (r = 0; r < 3; r++)
+		ipceng_term(readers[r]);
+	ipceng_chan_del_all(writer);
+	ipceng_term(writer);
+	return 0;
+}
+
+struct rpc_reply
+{
+	uint32_t id;
+	char resp[32];
+};
+
+void rpc_on_reply(struct ipceng *eng, ipceng_qdoor_t qd, uint32_t call_id,
+	const void *resp, size_t len, void *ctx)
+{
+	struct rpc_reply *reply = (struct rpc_reply *)ctx;
+	reply->id = call_id;
+	memcpy(reply->resp, resp, len);
+	reply->resp[len] = 0;
+}
+
+void *rpc_server(void *arg)
+{
+	struct ipceng *eng = (struct ipceng *)arg;
+	ipceng_qdoor_t qd = ipceng_qdoor_get(eng, "ceng1");
+	char req[128];
+	size_t len;
+	uint32_t id;
+
+	// a plain message goes out ahead of the reply
+	if (ipceng_call_recv(eng, qd, req, sizeof(req), &len, &id) == 0 && id != 0) {
+		ipceng_qdoor_push_bin(eng, qd, "plain", 6, 0);
+		ipceng_call_reply(eng, qd, id, "pong", 4);
+	}
+	return NULL;
+}
+
+int rpc_test1()
+{
+	struct ipceng *eng1 = ipceng_init("ceng1");
+	struct ipceng *eng2 = ipceng_init("ceng2");
+
+	if (ipceng_qdoor_add(eng1, "ceng2", 10, 128, 1, 1) != 0 || \
+		ipceng_qdoor_add(eng2, "ceng1", 10, 128, 1, 1) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "ceng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "ceng1");
+
+	// several calls in flight, replied in reverse order
+	struct rpc_reply replies[4];
+	uint32_t ids[4], recv_ids[4];
+	char buff[128];
+	size_t len;
+	int i;
+	for (i = 0; i < 4; i++) {
+		sprintf(buff, "req%d", i);
+		ids[i] = ipceng_call_async(eng1, qd1, buff, strlen(buff), rpc_on_reply, &replies[i]);
+		if (ids[i] == 0) {
+			printf("eng1 call error: %s\n", ipceng_errmsg(eng1));
+			return -1;
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		if (ipceng_call_recv(eng2, qd2, buff, sizeof(buff), &len, &recv_ids[i]) != 0 || \
+			len != 4 || buff[3] != '0' + i) {
+			printf("eng2 call recv error: %s\n", ipceng_errmsg(eng2));
+			return -1;
+		}
+	}
+	for (i = 3; i >= 0; i--) {
+		sprintf(buff, "rep%d", i);
+		ipceng_call_reply(eng2, qd2, recv_ids[i], buff, strlen(buff));
+	}
+	if (ipceng_call_poll(eng1, qd1, 1000) != 4) {
+		printf("eng1 call poll error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	for (i = 0; i < 4; i++) {
+		sprintf(buff, "rep%d", i);
+		if (replies[i].id != ids[i] || strcmp(replies[i].resp, buff)) {
+			printf("eng1 error: call %u got reply %u (%s)\n", ids[i], replies[i].id, replies[i].resp);
+			return -1;
+		}
+	}
+	printf("matched %d out of order replies in ceng1\n", i);
+
+	// a sync call keeps plain messages received meanwhile for the next pop
+	pthread_t server;
+	void *resp = NULL;
+	pthread_create(&server, NULL, rpc_server, eng2);
+	if (ipceng_call(eng1, qd1, "ping", 4, &resp, &len, 1000) != 0 || len != 4 || \
+		memcmp(resp, "pong", 4)) {
+		printf("eng1 call error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	free(resp);
+	pthread_join(server, NULL);
+	if (ipceng_qdoor_pop_into(eng1, qd1, buff, sizeof(buff), &len, NULL) != 0 || strcmp(buff, "plain")) {
+		printf("eng1 error: stashed message lost\n");
+		return -1;
+	}
+
+	// unanswered calls time out
+	if (ipceng_call(eng1, qd1, "ping", 4, NULL, NULL, 50) == 0) {
+		printf("eng1 error: unanswered call succeeded\n");
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int coalesce_test1()
+{
+	struct ipceng *eng1 = ipceng_init("geng1");
+	struct ipceng *eng2 = ipceng_init("geng2");
+
+	if (ipceng_qdoor_add(eng1, "geng2", 10, 512, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "geng1", 10, 512, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "geng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "geng1");
+	if (ipceng_qdoor_set_coalesce(eng1, qd1, 512, 8, 0) != 0) {
+		printf("eng1 coalesce error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// 20 messages are more than the mq holds, but they go in batches of 8
+	char msg[32], buff[512];
+	size_t len;
+	int i, prio;
+	for (i = 0; i < 20; i++) {
+		sprintf(msg, "msg%d", i);
+		if (ipceng_qdoor_push_h(eng1, qd1, msg, 0) != 0) {
+			printf("eng1 push error: %s\n", ipceng_errmsg(eng1));
+			return -1;
+		}
+	}
+	for (i = 0; i < 20; i++) {
+		// the last 4 are still coalescing
+		if (i == 16) {
+			if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) == 0) {
+				printf("eng2 error: popped a message not flushed yet\n");
+				return -1;
+			}
+			ipceng_qdoor_flush(eng1, qd1);
+		}
+		sprintf(msg, "msg%d", i);
+		if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) != 0 || strcmp(buff, msg)) {
+			printf("eng2 pop error at %d: %s\n", i, ipceng_errmsg(eng2));
+			return -1;
+		}
+	}
+	printf("popped %d coalesced messages in geng2\n", i);
+
+	// batches keep the priority of their messages, and a message too large
+	// for a batch goes after the batch
+	memset(buff, 'x', 500);
+	buff[500] = 0;
+	ipceng_qdoor_push_h(eng1, qd1, "low", 0);
+	ipceng_qdoor_push_h(eng1, qd1, "high", 1);
+	ipceng_qdoor_push_h(eng1, qd1, "next", 1);
+	ipceng_qdoor_push_h(eng1, qd1, buff, 1);
+	const void *data;
+	const char *expected[] = {"high", "next", buff, "low"};
+	for (i = 0; i < 4; i++) {
+		if (ipceng_qdoor_pop_view(eng2, qd2, &data, &len, &prio) != 0 || strcmp(data, expected[i]) || \
+			prio != (i < 3)) {
+			printf("eng2 error: coalesced message %d out of order\n", i);
+			return -1;
+		}
+	}
+	ipceng_qdoor_release(eng2, qd2);
+
+	// time limit is kept by ipceng_wait
+	ipceng_qdoor_set_coalesce(eng1, qd1, 512, 0, 1000);
+	ipceng_qdoor_push_h(eng1, qd1, "late", 0);
+	ipceng_qdoor_t ready;
+	ipceng_wait(eng1, 100, &ready, 1);
+	if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) != 0 || strcmp(buff, "late")) {
+		printf("eng2 error: due batch not flushed by ipceng_wait\n");
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int compress_test1()
+{
+	struct ipceng *eng1 = ipceng_init("zeng1");
+	struct ipceng *eng2 = ipceng_init("zeng2");
+
+	if (ipceng_qdoor_add(eng1, "zeng2", 10, 1024, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "zeng1", 10, 1024, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "zeng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "zeng1");
+
+	// telemetry-like text, 4 times the qdoor max message size
+	char *text = (char *)malloc(4096);
+	int i, n = 0;
+	for (i = 0; n < 4000; i++)
+		n += sprintf(text + n, "{\"sensor\":%d,\"temp\":%d,\"ok\":true},", i % 16, 20 + i % 7);
+	n++;
+	if (ipceng_qdoor_push_bin(eng1, qd1, text, n, 0) == 0) {
+		printf("eng1 error: oversized message sent without compression\n");
+		return -1;
+	}
+	if (ipceng_qdoor_set_compress(eng1, qd1, 256) != 0 || ipceng_qdoor_push_bin(eng1, qd1, text, n, 0) != 0) {
+		printf("eng1 compressed push error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	char *buff;
+	if (ipceng_qdoor_pop_h(eng2, qd2, &buff, NULL) != 0 || strcmp(buff, text)) {
+		printf("eng2 error: compressed message mismatch\n");
+		return -1;
+	}
+	free(buff);
+	printf("popped %d bytes compressed message in zeng2\n", n);
+
+	// data which does not compress is sent as is, and still fits
+	unsigned char noise[1000], out[1024];
+	size_t len;
+	srand(1);
+	for (i = 0; i < sizeof(noise); i++)
+		noise[i] = rand();
+	if (ipceng_qdoor_push_bin(eng1, qd1, noise, sizeof(noise), 0) != 0 || \
+		ipceng_qdoor_pop_into(eng2, qd2, out, sizeof(out), &len, NULL) != 0 || \
+		len != sizeof(noise) || memcmp(out, noise, len)) {
+		printf("eng2 error: incompressible message mismatch\n");
+		return -1;
+	}
+
+	free(text);
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+struct typed_count
+{
+	int count;
+	uint32_t last_seq;
+	uint32_t last_type;
+	char last[32];
+};
+
+void typed_on_msg(struct ipceng *eng, ipceng_qdoor_t qd, const struct ipceng_msghdr *hdr,
+	const void *payload, void *ctx)
+{
+	struct typed_count *tc = (struct typed_count *)ctx;
+	tc->count++;
+	tc->last_seq = hdr->seq;
+	tc->last_type = hdr->type;
+	memcpy(tc->last, payload, hdr->len < sizeof(tc->last) ? hdr->len : sizeof(tc->last));
+}
+
+int typed_test1()
+{
+	struct ipceng *eng1 = ipceng_init("teng1");
+	struct ipceng *eng2 = ipceng_init("teng2");
+
+	if (ipceng_qdoor_add(eng1, "teng2", 10, 256, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "teng1", 10, 256, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "teng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "teng1");
+
+	// handlers by type id, plus the default one for the rest
+	struct typed_count tc[3];
+	memset(tc, 0, sizeof(tc));
+	if (ipceng_register_handler(eng2, 1, typed_on_msg, &tc[1]) != 0 || \
+		ipceng_register_handler(eng2, 2, typed_on_msg, &tc[2]) != 0 || \
+		ipceng_register_handler(eng2, IPCENG_TYPE_DEFAULT, typed_on_msg, &tc[0]) != 0) {
+		printf("eng2 register error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	// typed messages stay typed inside coalesced batches as well
+	ipceng_qdoor_set_coalesce(eng1, qd1, 256, 0, 0);
+	ipceng_qdoor_push_typed(eng1, qd1, 1, 0, "one", 4, 0);
+	ipceng_qdoor_push_typed(eng1, qd1, 2, 0, "two", 4, 0);
+	ipceng_qdoor_push_typed(eng1, qd1, 1, 0, "uno", 4, 0);
+	ipceng_qdoor_push_h(eng1, qd1, "plain", 0);
+	ipceng_qdoor_push_typed(eng1, qd1, 7, 0, "seven", 6, 0);
+	ipceng_qdoor_flush(eng1, qd1);
+	int n = ipceng_qdoor_dispatch(eng2, qd2, 16);
+	if (n != 5 || tc[1].count != 2 || strcmp(tc[1].last, "uno") || tc[1].last_seq != 3 || \
+		tc[2].count != 1 || strcmp(tc[2].last, "two") || tc[0].count != 2 || tc[0].last_type != 7) {
+		printf("eng2 dispatch error: %d dispatched, counts %d/%d/%d\n", n, tc[0].count, tc[1].count, \
+			tc[2].count);
+		return -1;
+	}
+	printf("dispatched %d typed messages in teng2\n", n);
+
+	// typed pop gives the header apart from the payload
+	struct ipceng_msghdr hdr;
+	char buff[256];
+	ipceng_qdoor_set_coalesce(eng1, qd1, 0, 0, 0);
+	ipceng_qdoor_push_typed(eng1, qd1, 3, 0x5, "abc", 3, 0);
+	ipceng_qdoor_push_h(eng1, qd1, "raw", 0);
+	if (ipceng_qdoor_pop_typed(eng2, qd2, &hdr, buff, sizeof(buff)) != 0 || \
+		hdr.version != IPCENG_MSGHDR_VERSION || hdr.type != 3 || hdr.flags != 0x5 || \
+		hdr.len != 3 || memcmp(buff, "abc", 3) || hdr.timestamp == 0) {
+		printf("eng2 typed pop error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	if (ipceng_qdoor_pop_typed(eng2, qd2, &hdr, buff, sizeof(buff)) != 0 || hdr.version != 0 || \
+		hdr.len != 4 || strcmp(buff, "raw")) {
+		printf("eng2 untyped pop error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int sched_test1()
+{
+	struct ipceng *eng = ipceng_init("seng");
+	struct ipceng *enga = ipceng_init("senga");
+	struct ipceng *engb = ipceng_init("sengb");
+	struct ipceng *engc = ipceng_init("sengc");
+
+	if (ipceng_qdoor_add(eng, "senga", 10, 4096, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng, "sengb", 10, 4096, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng, "sengc", 10, 4096, 0, 0) != 0 || \
+		ipceng_qdoor_add(enga, "seng", 10, 4096, 0, 0) != 0 || \
+		ipceng_qdoor_add(engb, "seng", 10, 4096, 0, 0) != 0 || \
+		ipceng_qdoor_add(engc, "seng", 10, 4096, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng));
+		return -1;
+	}
+	ipceng_qdoor_t qda = ipceng_qdoor_get(eng, "senga");
+	ipceng_qdoor_t qdb = ipceng_qdoor_get(eng, "sengb");
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(enga, "seng");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(engb, "seng");
+
+	// senga gets twice the share of sengb; sengb has one urgent message;
+	// sengc has no weight, so it is not scheduled
+	if (ipceng_qdoor_set_weight(eng, qda, 2) != 0 || ipceng_qdoor_set_weight(eng, qda, 0) == 0 || \
+		ipceng_qdoor_set_weight(eng, qdb, 1) != 0) {
+		printf("eng weight error: %s\n", ipceng_errmsg(eng));
+		return -1;
+	}
+	char buff[4096];
+	int i;
+	for (i = 0; i < 6; i++) {
+		memset(buff, 'a', 2048);
+		ipceng_qdoor_push_bin(enga, qd1, buff, 2048, 0);
+		memset(buff, 'b', 2048);
+		ipceng_qdoor_push_bin(engb, qd2, buff, 2048, 0);
+	}
+	ipceng_qdoor_push_bin(engb, qd2, "urgent", 7, 5);
+	ipceng_qdoor_push_bin(engc, ipceng_qdoor_get(engc, "seng"), "other", 6, 9);
+
+	// urgent one first, then 2 quanta of senga per quantum of sengb
+	char order[16];
+	ipceng_qdoor_t from;
+	size_t len;
+	int prio;
+	for (i = 0; i < 13; i++) {
+		if (ipceng_sched_pop(eng, &from, buff, sizeof(buff), &len, &prio, 0) != 0) {
+			printf("eng sched pop error: %s\n", ipceng_errmsg(eng));
+			return -1;
+		}
+		if ((from == qda && buff[0] != 'a') || (from == qdb && buff[0] != 'b' && buff[0] != 'u')) {
+			printf("eng sched pop error: message from the wrong qdoor\n");
+			return -1;
+		}
+		order[i] = (prio == 5) ? 'U' : buff[0];
+	}
+	order[i] = '\0';
+	if (strcmp(order, "Ubaaaabbaabbb") || \
+		ipceng_sched_pop(eng, NULL, buff, sizeof(buff), NULL, NULL, 10) == 0 || \
+		ipceng_qdoor_pop_into(eng, ipceng_qdoor_get(eng, "sengc"), buff, sizeof(buff), NULL, NULL) != 0 || \
+		strcmp(buff, "other")) {
+		printf("eng sched order error: %s\n", order);
+		return -1;
+	}
+	printf("scheduled %s in seng\n", order);
+
+	ipceng_qdoor_del_all(eng);
+	ipceng_qdoor_del_all(enga);
+	ipceng_qdoor_del_all(engb);
+	ipceng_qdoor_del_all(engc);
+	ipceng_term(eng);
+	ipceng_term(enga);
+	ipceng_term(engb);
+	ipceng_term(engc);
+	return 0;
+}
+
+void credit_on_credit(struct ipceng *eng, ipceng_qdoor_t qd, unsigned int credits, void *ctx)
+{
+	*(unsigned int *)ctx = credits;
+}
+
+int credit_test1()
+{
+	struct ipceng *eng1 = ipceng_init("feng1");
+	struct ipceng *eng2 = ipceng_init("feng2");
+
+	if (ipceng_qdoor_add(eng1, "feng2", 8, 256, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "feng1", 8, 256, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "feng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "feng1");
+	unsigned int last_credits = 0;
+	// only the sending end sets a window, the receiving end counts anyway
+	if (ipceng_qdoor_set_credit(eng1, qd1, 8) != 0 || \
+		ipceng_qdoor_on_credit(eng1, qd1, credit_on_credit, &last_credits) != 0) {
+		printf("credit setup error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// the window is used up by 8 messages
+	int i;
+	for (i = 0; i < 8; i++)
+		ipceng_qdoor_push_h(eng1, qd1, "credit", 0);
+	if (ipceng_qdoor_credits(eng1, qd1) != 0) {
+		printf("eng1 credits error: %d left\n", ipceng_qdoor_credits(eng1, qd1));
+		return -1;
+	}
+
+	// credits come back as messages are consumed, without eng1 receiving
+	char buff[256];
+	for (i = 0; i < 3; i++)
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL);
+	int credits = ipceng_qdoor_credits(eng1, qd1);
+	ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL);
+	if (credits != 3 || last_credits != 3 || ipceng_qdoor_credits(eng1, qd1) != 4 || last_credits != 4) {
+		printf("eng1 credits error: %d then %d left\n", credits, ipceng_qdoor_credits(eng1, qd1));
+		return -1;
+	}
+
+	// and so does the rest once eng2 is drained
+	ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL);
+	if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL) < 0 || \
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL) < 0 || \
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL) < 0 || \
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL) >= 0) {
+		printf("eng2 pop error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	if (ipceng_qdoor_credits(eng1, qd1) != 8 || last_credits != 8) {
+		printf("eng1 credits error: %d left\n", ipceng_qdoor_credits(eng1, qd1));
+		return -1;
+	}
+	printf("got all %d credits back in feng1\n", last_credits);
+
+	// reading credits takes nothing from the qdoor
+	ipceng_qdoor_push_h(eng2, qd2, "after", 0);
+	if (ipceng_qdoor_set_credit(eng2, qd2, 0) != 0 || ipceng_qdoor_credits(eng1, qd1) != 8 || \
+		ipceng_qdoor_pop_into(eng1, qd1, buff, sizeof(buff), NULL, NULL) < 0 || strcmp(buff, "after")) {
+		printf("eng1 pop error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int credit_test2()
+{
+	struct ipceng *eng1 = ipceng_init("feng3");
+	struct ipceng *eng2 = ipceng_init("feng4");
+
+	if (ipceng_qdoor_add_ring(eng1, "feng4", -1, 0, 0) != 0 || \
+		ipceng_qdoor_add_ring(eng2, "feng3", -1, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "feng4");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "feng3");
+	if (ipceng_qdoor_set_credit(eng1, qd1, 4) != 0 || ipceng_qdoor_set_credit(eng2, qd2, 4) != 0) {
+		printf("credit setup error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// consuming on a ring puts nothing in the ring of the other direction
+	int i;
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_push_h(eng1, qd1, "credit", 0);
+	char buff[IPCENG_DEFAULT_RINGSIZE];
+	int credits = ipceng_qdoor_credits(eng1, qd1);
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), NULL, NULL);
+	if (credits != 0 || ipceng_qdoor_credits(eng1, qd1) != 4 || \
+		ipceng_qdoor_pop_into(eng1, qd1, buff, sizeof(buff), NULL, NULL) >= 0) {
+		printf("eng1 credits error: %d then %d left\n", credits, ipceng_qdoor_credits(eng1, qd1));
+		return -1;
+	}
+	printf("got all %d ring credits back in feng3\n", ipceng_qdoor_credits(eng1, qd1));
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+void *credit_consumer(void *arg)
+{
+	struct ipceng *eng = (struct ipceng *)arg;
+	ipceng_qdoor_t qd = ipceng_qdoor_get(eng, "feng5");
+	char buff[256];
+	usleep(20000);
+	ipceng_qdoor_pop_into(eng, qd, buff, sizeof(buff), NULL, NULL);
+	ipceng_qdoor_pop_into(eng, qd, buff, sizeof(buff), NULL, NULL);
+	return NULL;
+}
+
+int credit_test3()
+{
+	struct ipceng *eng1 = ipceng_init("feng5");
+	struct ipceng *eng2 = ipceng_init("feng6");
+
+	if (ipceng_qdoor_add(eng1, "feng6", 4, 256, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "feng5", 4, 256, 0, 0) != 0) {
+		printf("add error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "feng6");
+	unsigned int last_credits = 0;
+	if (ipceng_qdoor_set_credit(eng1, qd1, 100) != 0 || \
+		ipceng_qdoor_on_credit(eng1, qd1, credit_on_credit, &last_credits) != 0) {
+		printf("credit setup error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// the window is clamped to what the peer mq holds
+	if (ipceng_qdoor_credits(eng1, qd1) != 4) {
+		printf("eng1 credits error: %d left\n", ipceng_qdoor_credits(eng1, qd1));
+		return -1;
+	}
+	int i;
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_push_h(eng1, qd1, "credit", 0);
+	if (ipceng_qdoor_wait_credit(eng1, qd1, 2, 0) >= 0 || ipceng_errno(eng1) != EAGAIN || \
+		ipceng_qdoor_wait_credit(eng1, qd1, 5, 0) >= 0) {
+		printf("eng1 wait credit error: %s\n", ipceng_errmsg(eng1));
+		return -1;
+	}
+
+	// the sender sleeps until the peer consumed enough
+	pthread_t th;
+	pthread_create(&th, NULL, credit_consumer, eng2);
+	int credits = ipceng_qdoor_wait_credit(eng1, qd1, 2, 2000);
+	pthread_join(th, NULL);
+	if (credits != 2 || last_credits != 2) {
+		printf("eng1 wait credit error: %d (%s)\n", credits, ipceng_errmsg(eng1));
+		return -1;
+	}
+	printf("woken with %d credits in feng5\n", credits);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+void *error_thread(void *arg)
+{
+	// error state of other threads is not seen here
+	return (void *)(intptr_t)ipceng_errno((struct ipceng *)arg);
+}
+
+int error_test1()
+{
+	struct ipceng *eng = ipceng_init("reng");
+	if (ipceng_qdoor_set_weight(eng, IPCENG_HANDLE_INVALID, 1) == 0 || \
+		ipceng_errno(eng) != IPCENG_ERR_SCHED || ipceng_errmsg(eng) == NULL) {
+		printf("eng error code error: %d\n", ipceng_errno(eng));
+		return -1;
+	}
+	pthread_t th;
+	void *th_code;
+	pthread_create(&th, NULL, error_thread, eng);
+	pthread_join(th, &th_code);
+	if ((intptr_t)th_code != IPCENG_ERR_NOERROR || ipceng_errno(eng) != IPCENG_ERR_SCHED) {
+		printf("eng thread error code error: %d\n", (int)(intptr_t)th_code);
+		return -1;
+	}
+	if (strcmp(ipceng_strerror(IPCENG_ERR_CALL), "failed to call") || \
+		strcmp(ipceng_strerror(EAGAIN), strerror(EAGAIN)) || ipceng_strerror(-1000) == NULL) {
+		printf("strerror error\n");
+		return -1;
+	}
+	printf("last error of reng: %s\n", ipceng_errmsg(eng));
+
+	ipceng_term(eng);
+	return 0;
+}
+
+#define THREAD_TEST_N 4
+#define THREAD_TEST_MSGS 200
+
+struct thread_test {
+	struct ipceng *eng;
+	struct ipceng *peer;
+	char name[16];
+	int got;
+};
+
+void *thread_test_worker(void *arg)
+{
+	struct thread_test *t = (struct thread_test *)arg;
+	int i;
+	for (i = 0; i < THREAD_TEST_MSGS; i++) {
+		// looked up each time, while the main thread adds and deletes qdoors
+		ipceng_qdoor_t qd = ipceng_qdoor_get(t->eng, t->name);
+		ipceng_qdoor_t pqd = ipceng_qdoor_get(t->peer, "keng");
+		char *new_msg;
+		if (ipceng_qdoor_push_h(t->eng, qd, t->name, 0) != 0 || \
+			ipceng_qdoor_pop_h(t->peer, pqd, &new_msg, NULL) != 0)
+			break;
+		if (strcmp(new_msg, t->name) == 0)
+			t->got++;
+		free(new_msg);
+	}
+	return NULL;
+}
+
+int thread_test1()
+{
+	// one engine shared by all threads, one peer engine per thread
+	struct ipceng *eng = ipceng_init("keng");
+	struct thread_test t[THREAD_TEST_N];
+	pthread_t th[THREAD_TEST_N];
+	int i, j;
+	for (i = 0; i < THREAD_TEST_N; i++) {
+		sprintf(t[i].name, "kpeer%d", i);
+		t[i].eng = eng;
+		t[i].peer = ipceng_init(t[i].name);
+		t[i].got = 0;
+		if (ipceng_qdoor_add_simple(eng, t[i].name) != 0 || \
+			ipceng_qdoor_add_simple(t[i].peer, "keng") != 0) {
+			printf("keng error: %s\n", ipceng_errmsg(eng));
+			return -1;
+		}
+	}
+	for (i = 0; i < THREAD_TEST_N; i++)
+		pthread_create(&th[i], NULL, thread_test_worker, &t[i]);
+	for (j = 0; j < 100; j++) {
+		char name[16];
+		sprintf(name, "kjunk%d", j % 8);
+		if (ipceng_qdoor_get(eng, name) != IPCENG_HANDLE_INVALID)
+			ipceng_qdoor_del(eng, name);
+		else if (ipceng_qdoor_add_simple(eng, name) != 0 || \
+			ipceng_qdoor_get(eng, name) == IPCENG_HANDLE_INVALID)
+			printf("keng error: %s\n", ipceng_errmsg(eng));
+	}
+	for (i = 0; i < THREAD_TEST_N; i++) {
+		pthread_join(th[i], NULL);
+		if (t[i].got != THREAD_TEST_MSGS) {
+			printf("keng thread %d got %d messages\n", i, t[i].got);
+			return -1;
+		}
+	}
+	printf("got %d messages in each of %d threads sharing keng\n", THREAD_TEST_MSGS, THREAD_TEST_N);
+
+	ipceng_qdoor_del_all(eng);
+	ipceng_term(eng);
+	for (i = 0; i < THREAD_TEST_N; i++) {
+		ipceng_qdoor_del_all(t[i].peer);
+		ipceng_term(t[i].peer);
+	}
+	return 0;
+}
+
+void *thread_test_pusher(void *arg)
+{
+	struct thread_test *t = (struct thread_test *)arg;
+	ipceng_qdoor_t qd = ipceng_qdoor_get(t->eng, "keng4");
+	int i;
+	for (i = 0; i < THREAD_TEST_MSGS * 10 && !__atomic_load_n(&t->got, __ATOMIC_ACQUIRE); i++) {
+		if (ipceng_qdoor_push_bin(t->eng, qd, &i, sizeof(i), 0) != 0)
+			break;
+	}
+	ipceng_qdoor_flush(t->eng, qd);
+	return NULL;
+}
+
+void *thread_test_waiter(void *arg)
+{
+	struct thread_test *t = (struct thread_test *)arg;
+	ipceng_qdoor_t ready[4];
+	// flushes due batches while the pusher fills them, until all are popped
+	while (!__atomic_load_n(&t->got, __ATOMIC_ACQUIRE))
+		ipceng_wait(t->eng, 0, ready, 4);
+	return NULL;
+}
+
+int thread_test2()
+{
+	struct thread_test t = {ipceng_init("keng3"), ipceng_init("keng4"), "keng3", 0};
+	if (ipceng_qdoor_add_simple(t.eng, "keng4") != 0 || ipceng_qdoor_add_simple(t.peer, "keng3") != 0 || \
+		ipceng_qdoor_set_coalesce(t.eng, ipceng_qdoor_get(t.eng, "keng4"), 256, 0, 1) != 0) {
+		printf("keng3 error: %s\n", ipceng_errmsg(t.eng));
+		return -1;
+	}
+	pthread_t pusher, waiter;
+	pthread_create(&pusher, NULL, thread_test_pusher, &t);
+	pthread_create(&waiter, NULL, thread_test_waiter, &t);
+	ipceng_qdoor_t qd = ipceng_qdoor_get(t.peer, "keng3");
+	char buff[IPCENG_DAFAULT_MSGSIZE];
+	int i;
+	size_t len;
+	for (i = 0; i < THREAD_TEST_MSGS * 10; i++) {
+		if (ipceng_qdoor_pop_into(t.peer, qd, buff, sizeof(buff), &len, NULL) != 0 || \
+			len != sizeof(i) || memcmp(buff, &i, sizeof(i)))
+			break;
+	}
+	__atomic_store_n(&t.got, 1, __ATOMIC_RELEASE);
+	pthread_join(pusher, NULL);
+	pthread_join(waiter, NULL);
+	if (i != THREAD_TEST_MSGS * 10) {
+		printf("keng4 error: message %d of %d: %s\n", i, THREAD_TEST_MSGS * 10, ipceng_errmsg(t.peer));
+		return -1;
+	}
+	printf("got %d coalesced messages in order while keng3 waited\n", i);
+
+	ipceng_qdoor_del_all(t.eng);
+	ipceng_qdoor_del_all(t.peer);
+	ipceng_term(t.eng);
+	ipceng_term(t.peer);
+	return 0;
+}
+
+struct reply_del_test {
+	struct ipceng *eng;
+	int stage;
+};
+
+void *reply_del_deleter(void *arg)
+{
+	struct reply_del_test *t = (struct reply_del_test *)arg;
+	while (__atomic_load_n(&t->stage, __ATOMIC_ACQUIRE) != 1)
+		usleep(100);
+	ipceng_qdoor_del(t->eng, "keng7");
+	__atomic_store_n(&t->stage, 2, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// replies, then lets the qdoor it runs for be deleted before returning
+void reply_del_on_msg(struct ipceng *eng, ipceng_qdoor_t qd, const struct ipceng_msghdr *hdr,
+	const void *payload, void *ctx)
+{
+	struct reply_del_test *t = (struct reply_del_test *)ctx;
+	ipceng_qdoor_push_h(eng, qd, "reply", 0);
+	__atomic_store_n(&t->stage, 1, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&t->stage, __ATOMIC_ACQUIRE) != 2)
+		usleep(100);
+}
+
+int thread_test3()
+{
+	struct ipceng *eng1 = ipceng_init("keng7");
+	struct ipceng *eng2 = ipceng_init("keng8");
+	struct reply_del_test t = {eng2, 0};
+	if (ipceng_qdoor_add_simple(eng1, "keng8") != 0 || ipceng_qdoor_add_simple(eng2, "keng7") != 0 || \
+		ipceng_register_handler(eng2, 1, reply_del_on_msg, &t) != 0) {
+		printf("keng8 error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_push_typed(eng1, ipceng_qdoor_get(eng1, "keng8"), 1, 0, "ask", 4, 0);
+
+	// the qdoor being dispatched is freed only once the dispatch is over
+	pthread_t deleter;
+	pthread_create(&deleter, NULL, reply_del_deleter, &t);
+	int n = ipceng_qdoor_dispatch(eng2, ipceng_qdoor_get(eng2, "keng7"), 1);
+	pthread_join(deleter, NULL);
+	char buff[IPCENG_DAFAULT_MSGSIZE];
+	if (n != 1 || ipceng_qdoor_get(eng2, "keng7") != IPCENG_HANDLE_INVALID || \
+		ipceng_qdoor_pop_into(eng1, ipceng_qdoor_get(eng1, "keng8"), buff, sizeof(buff), NULL, NULL) != 0 || \
+		strcmp(buff, "reply")) {
+		printf("keng8 dispatch error: %d dispatched: %s\n", n, ipceng_errmsg(eng2));
+		return -1;
+	}
+	printf("replied from keng8 while its qdoor was deleted\n");
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+struct alloc_test {
+	int allocs;
+	int frees;
+	// allocations failing once allocs reaches it, 0 = none
+	int limit;
+};
+
+void *alloc_test_alloc(size_t size, void *ctx)
+{
+	struct alloc_test *at = (struct alloc_test *)ctx;
+	if (at->limit && at->allocs >= at->limit)
+		return NULL;
+	at->allocs++;
+	return malloc(size);
+}
+
+void alloc_test_free(void *ptr, void *ctx)
+{
+	if (ptr)
+		((struct alloc_test *)ctx)->frees++;
+	free(ptr);
+}
+
+int alloc_test1()
+{
+	struct alloc_test at = {0, 0};
+	struct ipceng *eng1 = ipceng_init("aeng1");
+	struct ipceng *eng2 = ipceng_init("aeng2");
+	if (ipceng_set_allocator(eng2, alloc_test_alloc, alloc_test_free, &at) != 0 || \
+		ipceng_qdoor_add_simple(eng1, "aeng2") != 0 || ipceng_qdoor_add_simple(eng2, "aeng1") != 0) {
+		printf("aeng error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	if (ipceng_set_allocator(eng2, NULL, NULL, NULL) == 0) {
+		printf("aeng2 error: allocator changed while it has qdoors\n");
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "aeng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "aeng1");
+
+	// pooled buffers do not go through the allocator, the last one (pool
+	// empty) does
+	char *msgs[3];
+	int i;
+	ipceng_qdoor_set_pool(eng2, qd2, 2);
+	int allocs = at.allocs;
+	for (i = 0; i < 3; i++) {
+		if (ipceng_qdoor_push_h(eng1, qd1, "pooled", 0) != 0 || \
+			ipceng_qdoor_pop_h(eng2, qd2, &msgs[i], NULL) != 0 || strcmp(msgs[i], "pooled")) {
+			printf("aeng error: %s\n", ipceng_errmsg(eng2));
+			return -1;
+		}
+	}
+	if (at.allocs != allocs + 1 || ipceng_qdoor_set_pool(eng2, qd2, 4) == 0) {
+		printf("aeng2 pool error: %d allocations\n", at.allocs - allocs);
+		return -1;
+	}
+	for (i = 0; i < 3; i++)
+		ipceng_buf_release(eng2, qd2, msgs[i]);
+	if (ipceng_qdoor_push_h(eng1, qd1, "pooled again", 0) != 0 || \
+		ipceng_qdoor_pop_h(eng2, qd2, &msgs[0], NULL) != 0 || at.allocs != allocs + 1) {
+		printf("aeng2 pool error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_buf_release(eng2, qd2, msgs[0]);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	if (at.allocs == 0 || at.allocs != at.frees) {
+		printf("aeng2 allocator error: %d allocations, %d frees\n", at.allocs, at.frees);
+		return -1;
+	}
+	printf("aeng2 allocator balanced: %d allocations\n", at.allocs);
+	return 0;
+}
+
+int alloc_test2()
+{
+	struct alloc_test at = {0, 0, 0};
+	struct ipceng *eng = ipceng_init("aeng3");
+	if (ipceng_set_allocator(eng, alloc_test_alloc, alloc_test_free, &at) != 0) {
+		printf("aeng3 error: %s\n", ipceng_errmsg(eng));
+		return -1;
+	}
+
+	// each allocation of an add fails in turn, until the add gets through;
+	// a failed add leaves nothing behind
+	int kind, n;
+	for (kind = 0; kind < 3; kind++) {
+		for (n = 0; ; n++) {
+			at.limit = at.allocs + n;
+			if (at.limit == 0)
+				continue;
+			int ret = (kind == 0) ? ipceng_qdoor_add_simple(eng, "aeng4") : \
+				(kind == 1) ? ipceng_qdoor_add_ring(eng, "aeng4", -1, 0, 0) : \
+				ipceng_chan_add(eng, "achan", IPCENG_CHAN_MPSC, 8, 16, 0, 0);
+			if (ret == 0)
+				break;
+			if (at.allocs < at.limit) {
+				printf("aeng3 add error: %s\n", ipceng_errmsg(eng));
+				return -1;
+			}
+		}
+		at.limit = 0;
+		if (kind == 2)
+			ipceng_chan_del(eng, "achan");
+		else
+			ipceng_qdoor_del(eng, "aeng4");
+	}
+
+	ipceng_term(eng);
+	if (at.allocs != at.frees) {
+		printf("aeng3 allocator error: %d allocations, %d frees\n", at.allocs, at.frees);
+		return -1;
+	}
+	printf("aeng3 survived failing allocations: %d allocations\n", at.allocs);
+	return 0;
+}
+
+int stats_test1()
+{
+	struct ipceng *eng1 = ipceng_init("meng1");
+	struct ipceng *eng2 = ipceng_init("meng2");
+	char buff[64];
+	size_t len;
+	int i;
+
+	if (ipceng_qdoor_add(eng1, "meng2", 4, 64, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "meng1", 4, 64, 0, 0) != 0 || \
+		ipceng_shm_add(eng2, "mshm", 4096) != 0) {
+		printf("meng error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "meng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "meng1");
+	for (i = 0; i < 3; i++)
+		ipceng_qdoor_push_bin(eng1, qd1, "metric", 6, 0);
+
+	struct ipceng_stats st;
+	if (ipceng_stats_get(eng2, "meng1", &st) != 0 || st.depth != 3 || st.capacity != 4) {
+		printf("meng2 stats error: depth %ld, capacity %ld\n", st.depth, st.capacity);
+		return -1;
+	}
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL);
+	ipceng_shm_write(eng2, "mshm", "metric", 0, 6);
+	ipceng_shm_write(eng2, "mshm", "metric", 4095, 6);
+	if (ipceng_stats_get(eng2, "meng1", &st) != 0 || st.rx_msgs != 3 || st.rx_bytes != 18 || \
+		st.rx_again != 1 || st.depth != 0 || st.depth_sampled_max != 3) {
+		printf("meng2 stats error: %lu messages, %lu bytes, %lu again, depth %ld/%ld\n", \
+			st.rx_msgs, st.rx_bytes, st.rx_again, st.depth, st.depth_sampled_max);
+		return -1;
+	}
+	struct ipceng_stats all[4];
+	int n = ipceng_stats_snapshot(eng2, all, 4);
+	if (n != 2 || strcmp(all[1].name, "mshm") || all[1].kind != IPCENG_STATS_SHM || \
+		all[1].tx_msgs != 1 || all[1].tx_errors != 1 || ipceng_stats_get(eng1, "meng2", &st) != 0 || \
+		st.tx_msgs != 3 || st.tx_bytes != 18) {
+		printf("meng stats snapshot error: %d entries\n", n);
+		return -1;
+	}
+	printf("meng2 stats: %lu messages popped, max sampled depth %ld\n", all[0].rx_msgs, all[0].depth_sampled_max);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_shm_del(eng2, "mshm");
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int latency_test1()
+{
+	struct ipceng *eng1 = ipceng_init("leng1");
+	struct ipceng *eng2 = ipceng_init("leng2");
+	char text[512], buff[512];
+	size_t len;
+	int i;
+
+	if (ipceng_qdoor_add(eng1, "leng2", 10, sizeof(buff), 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "leng1", 10, sizeof(buff), 0, 0) != 0) {
+		printf("leng error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "leng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "leng1");
+	struct ipceng_latency lat;
+	if (ipceng_latency_get(eng2, qd2, &lat) == 0 || ipceng_qdoor_set_latency(eng1, qd1, true) != 0 || \
+		ipceng_qdoor_set_latency(eng2, qd2, true) != 0) {
+		printf("leng latency error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+
+	// plain, coalesced and compressed messages are all stamped
+	memset(text, 'l', sizeof(text));
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_push_bin(eng1, qd1, "latency", 7, 0);
+	ipceng_qdoor_set_coalesce(eng1, qd1, 256, 0, 0);
+	for (i = 0; i < 4; i++)
+		ipceng_qdoor_push_bin(eng1, qd1, "latency", 7, 0);
+	ipceng_qdoor_set_coalesce(eng1, qd1, 0, 0, 0);
+	ipceng_qdoor_set_compress(eng1, qd1, 256);
+	ipceng_qdoor_push_bin(eng1, qd1, text, sizeof(text), 0);
+	for (i = 0; i < 8; i++) {
+		if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) != 0 || \
+			len != 7 || memcmp(buff, "latency", 7)) {
+			printf("leng2 pop error: %s\n", ipceng_errmsg(eng2));
+			return -1;
+		}
+	}
+	if (ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL) != 0 || \
+		len != sizeof(text) || memcmp(buff, text, len)) {
+		printf("leng2 compressed pop error: %s\n", ipceng_errmsg(eng2));
+		return -1;
+	}
+	if (ipceng_latency_get(eng2, qd2, &lat) != 0 || lat.count != 9 || lat.max == 0 || \
+		lat.p50 > lat.p99 || lat.p99 > lat.p999 || lat.p999 > lat.max) {
+		printf("leng2 latency error: %lu messages, p50 %lu, p99 %lu, p999 %lu, max %lu\n", \
+			lat.count, lat.p50, lat.p99, lat.p999, lat.max);
+		return -1;
+	}
+	printf("leng2 latency: p50 %lu ns, p99 %lu ns, max %lu ns\n", lat.p50, lat.p99, lat.max);
+	if (ipceng_latency_reset(eng2, qd2) != 0 || ipceng_latency_get(eng2, qd2, &lat) != 0 || \
+		lat.count != 0 || lat.max != 0) {
+		printf("leng2 latency reset error\n");
+		return -1;
+	}
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
+int trace_test1()
+{
+	struct ipceng *eng1 = ipceng_init("teng1");
+	struct ipceng *eng2 = ipceng_init("teng2");
+	char buff[64], out[4096];
+	size_t len;
+
+	// tracing is off by default
+	ipceng_trace_enable(eng1);
+
+	if (ipceng_qdoor_add(eng1, "teng2", 4, 64, 0, 0) != 0 || \
+		ipceng_qdoor_add(eng2, "teng1", 4, 64, 0, 0) != 0 || ipceng_shm_add(eng1, "tshm", 64) != 0) {
+		printf("teng error: %s / %s\n", ipceng_errmsg(eng1), ipceng_errmsg(eng2));
+		return -1;
+	}
+	ipceng_qdoor_t qd1 = ipceng_qdoor_get(eng1, "teng2");
+	ipceng_qdoor_t qd2 = ipceng_qdoor_get(eng2, "teng1");
+	ipceng_qdoor_push_bin(eng1, qd1, "trace", 5, 0);
+	ipceng_qdoor_pop_into(eng2, qd2, buff, sizeof(buff), &len, NULL);
+	ipceng_shm_write(eng1, "tshm", "trace", 0, 5);
+	ipceng_trace_disable(eng1);
+	ipceng_qdoor_push_bin(eng1, qd1, "untraced", 8, 0);
+
+	FILE *fp = tmpfile();
+	int n = ipceng_trace_dump(eng1, fp);
+	if (n < 0 && ipceng_errno(eng1) == IPCENG_ERR_TRACE) {
+		printf("teng1 trace: %s\n", ipceng_errmsg(eng1));
+	} else {
+		// qdoor_add, qdoor_push and shm_write of eng1 only
+		rewind(fp);
+		len = fread(out, 1, sizeof(out) - 1, fp);
+		out[len] = '\0';
+		if (n != 3 || !strstr(out, "\"traceEvents\"") || !strstr(out, "\"qdoor_push\"") || \
+			!strstr(out, "\"shm_write\"") || strstr(out, "\"qdoor_pop\"") || strstr(out, "\"len\":8,")) {
+			printf("teng1 trace error: %d events\n%s", n, out);
+			return -1;
+		}
+		printf("teng1 trace: %d events\n", n);
+	}
+	fclose(fp);
+
+	ipceng_qdoor_del_all(eng1);
+	ipceng_qdoor_del_all(eng2);
+	ipceng_shm_del(eng1, "tshm");
+	ipceng_term(eng1);
+	ipceng_term(eng2);
+	return 0;
+}
+
 int main(int argc, char const *argv[])
 {
 	// qdoor_test1();
 	// qdoor_test2();
 	shm_test1();
+	if (handle_test1() != 0)
+		return 1;
+	if (pop_into_test1() != 0)
+		return 1;
+	if (bin_test1() != 0)
+		return 1;
+	if (batch_test1() != 0)
+		return 1;
+	if (wait_test1() != 0)
+		return 1;
+	if (dispatch_test1() != 0)
+		return 1;
+	if (dispatch_test2() != 0)
+		return 1;
+	if (dispatch_test3() != 0)
+		return 1;
+	if (ring_test1() != 0)
+		return 1;
+	if (chan_test1() != 0)
+		return 1;
+	if (futex_test1() != 0)
+		return 1;
+	if (spill_test1() != 0)
+		return 1;
+	if (loan_test1() != 0)
+		return 1;
+	if (bcast_test1() != 0)
+		return 1;
+	if (rpc_test1() != 0)
+		return 1;
+	if (coalesce_test1() != 0)
+		return 1;
+	if (compress_test1() != 0)
+		return 1;
+	if (typed_test1() != 0)
+		return 1;
+	if (sched_test1() != 0)
+		return 1;
+	if (credit_test1() != 0)
+		return 1;
+	if (credit_test2() != 0)
+		return 1;
+	if (credit_test3() != 0)
+		return 1;
+	if (error_test1() != 0)
+		return 1;
+	if (thread_test1() != 0)
+		return 1;
+	if (thread_test2() != 0)
+		return 1;
+	if (thread_test3() != 0)
+		return 1;
+	if (alloc_test1() != 0)
+		return 1;
+	if (alloc_test2() != 0)
+		return 1;
+	if (stats_test1() != 0)
+		return 1;
+	if (latency_test1() != 0)
+		return 1;
+	if (trace_test1() != 0)
+		return 1;
 	return 0;
 }
\ No newline at end of file